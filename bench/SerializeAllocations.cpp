@@ -0,0 +1,69 @@
+#include <dictos/net/all.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+
+namespace {
+	// Counts heap allocations on this thread
+	thread_local size_t s_allocations = 0;
+}
+
+void * operator new(size_t size)
+{
+	s_allocations++;
+	if (auto block = std::malloc(size ? size : 1))
+		return block;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept { std::free(block); }
+void operator delete(void *block, size_t) noexcept { std::free(block); }
+
+/**
+ * Command::SerializeAllocations, compares the allocations and time it takes to serialize a
+ * request through a json tree into a fresh string against serializeTo into a reused buffer.
+ */
+
+int main(int argc, char *argv[])
+{
+	static constexpr size_t Iterations = 100000;
+
+	Command request("hello", json{{"name", "a name long enough to not fit in place"}, {"values", {1, 2, 3, 4}}});
+
+	auto result = 0;
+	for (auto encoding : {Command::ENCODING::Json, Command::ENCODING::Cbor, Command::ENCODING::MsgPack}) {
+		// The old way around, through a json tree and a fresh string per command
+		auto before = s_allocations;
+		auto start = std::chrono::steady_clock::now();
+		size_t treeSize = 0;
+		for (size_t i = 0; i < Iterations; i++)
+			treeSize += Command::serialize(json(request), encoding).size();
+		auto treeAllocations = s_allocations - before;
+		auto treeTime = std::chrono::steady_clock::now() - start;
+
+		// Straight into a reused buffer
+		std::string buffer;
+		before = s_allocations;
+		start = std::chrono::steady_clock::now();
+		size_t directSize = 0;
+		for (size_t i = 0; i < Iterations; i++) {
+			buffer.clear();
+			request.serializeTo(buffer, encoding);
+			directSize += buffer.size();
+		}
+		auto directAllocations = s_allocations - before;
+		auto directTime = std::chrono::steady_clock::now() - start;
+
+		std::printf("%-8s allocations per command, json tree: %.2f direct: %.2f, ns per command, json tree: %lld direct: %lld\n",
+			std::string(Command::encodingName(encoding)).c_str(),
+			double(treeAllocations) / Iterations, double(directAllocations) / Iterations,
+			static_cast<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(treeTime).count() / Iterations),
+			static_cast<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(directTime).count() / Iterations));
+
+		// Both have to come out the same size, and the direct path has to save allocations
+		if (directSize != treeSize || directAllocations >= treeAllocations)
+			result = 1;
+	}
+
+	return result;
+}
@@ -30,15 +30,26 @@ public:
 
 	std::string ip() const;
 
+	// The host name the address was given by, or the ip for literal addresses
+	std::string host() const;
+
+	// True if the address names a host that needs resolving rather than a literal ip
+	bool named() const noexcept;
+
+	// The literal ip, unspecified for named addresses
+	const IpAddress & ipAddress() const noexcept;
+
 	std::string __toString() const;
 	PROTOCOL_TYPE protocol() const;
 	explicit operator bool () const;
 
 protected:
-	static IpAddress validate(const std::string &_address, unsigned short &port, PROTOCOL_TYPE &type);
+	static IpAddress validate(const std::string &_address, unsigned short &port, PROTOCOL_TYPE &type, std::string &host);
+	static bool validHost(const std::string_view &host) noexcept;
 
 	unsigned short m_port = 0;
 	IpAddress m_address;
+	std::string m_host;
 	PROTOCOL_TYPE m_protocol = PROTOCOL_TYPE::Init;
 };
 
@@ -19,6 +19,7 @@ inline Address &Address::operator = (const Address &addr)
 
 	m_protocol = addr.m_protocol;
 	m_address = addr.m_address;
+	m_host = addr.m_host;
 	m_port = addr.m_port;
 	return *this;
 }
@@ -27,10 +28,12 @@ inline Address &Address::operator = (Address &&addr)
 {
 	m_protocol = addr.m_protocol;
 	m_address = std::move(addr.m_address);
+	m_host = std::move(addr.m_host);
 	m_port = addr.m_port;
 	addr.m_protocol = PROTOCOL_TYPE::Init;
 	addr.m_port = 0;
 	addr.m_address = IpAddress();
+	addr.m_host.clear();
 	return *this;
 }
 
@@ -41,7 +44,7 @@ inline Address::Address(const std::string &addr)
 
 inline Address & Address::operator = (const std::string &addr)
 {
-	m_address = validate(addr, m_port, m_protocol);
+	m_address = validate(addr, m_port, m_protocol, m_host);
 	return *this;
 }
 
@@ -54,16 +57,33 @@ inline unsigned short Address::port() const
 
 inline std::string Address::ip() const
 {
-	if (m_protocol != PROTOCOL_TYPE::Tcp && m_protocol != PROTOCOL_TYPE::WebSocket && m_protocol != PROTOCOL_TYPE::Ssl && m_protocol != PROTOCOL_TYPE::SslWebSocket)
+	if (m_protocol != PROTOCOL_TYPE::Tcp && m_protocol != PROTOCOL_TYPE::TcpUring && m_protocol != PROTOCOL_TYPE::WebSocket && m_protocol != PROTOCOL_TYPE::Ssl && m_protocol != PROTOCOL_TYPE::SslWebSocket)
 		DCORE_THROW(RuntimeError, "Address type does not support an ip");
+	if (named())
+		DCORE_THROW(RuntimeError, "Address:", m_host, "is a host name, it has no ip until resolved");
 	return m_address.to_string();
 }
 
+inline std::string Address::host() const
+{
+	return named() ? m_host : m_address.to_string();
+}
+
+inline bool Address::named() const noexcept
+{
+	return !m_host.empty();
+}
+
+inline const Address::IpAddress & Address::ipAddress() const noexcept
+{
+	return m_address;
+}
+
 inline std::string Address::__toString() const
 {
 	if (m_port)
-		return string::toString(m_protocol, "://", m_address, ":", m_port);
-	return string::toString(m_protocol, "://", m_address);
+		return string::toString(m_protocol, "://", host(), ":", m_port);
+	return string::toString(m_protocol, "://", host());
 }
 
 inline PROTOCOL_TYPE Address::protocol() const
@@ -76,7 +96,7 @@ inline Address::operator bool () const
 	return m_protocol != PROTOCOL_TYPE::Init;
 }
 
-inline Address::IpAddress Address::validate(const std::string &__address, unsigned short &_port, TYPE &type)
+inline Address::IpAddress Address::validate(const std::string &__address, unsigned short &_port, TYPE &type, std::string &host)
 {
 	// Extract the protocol type and look it up in the protocol registrar
 	auto [prefix, _address] = string::split("://", __address);
@@ -85,15 +105,21 @@ inline Address::IpAddress Address::validate(const std::string &__address, unsign
 	// Extract the port
 	auto [address, port] = string::split(":", _address);
 
-	// Now we can have boost parse the ip portion
+	// Now we can have boost parse the ip portion, anything else has to be a host name
 	boost::system::error_code ec;
 	auto addr = IpAddress::from_string(address, ec);
-	if (ec)
-		DCORE_THROW(InvalidArgument, "Un-recognized address:", address, ec);
+	host.clear();
+	if (ec) {
+		if (!validHost(address))
+			DCORE_THROW(InvalidArgument, "Un-recognized address:", address, ec);
+		host.assign(address.begin(), address.end());
+		addr = IpAddress();
+	}
 
 	// If tcp fetch port
 	switch (type) {
 		case PROTOCOL_TYPE::Tcp:
+		case PROTOCOL_TYPE::TcpUring:
 		case PROTOCOL_TYPE::Udp:
 		case PROTOCOL_TYPE::WebSocket:
 		case PROTOCOL_TYPE::SslWebSocket:
@@ -106,4 +132,26 @@ inline Address::IpAddress Address::validate(const std::string &__address, unsign
 	return addr;
 }
 
+inline bool Address::validHost(const std::string_view &host) noexcept
+{
+	// Dns names, dot separated labels of letters, digits and dashes
+	if (host.empty() || host.size() > 253)
+		return false;
+
+	size_t label = 0;
+	for (auto c : host) {
+		if (c == '.') {
+			if (!label)
+				return false;
+			label = 0;
+			continue;
+		}
+		if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_')
+			return false;
+		if (++label > 63)
+			return false;
+	}
+	return true;
+}
+
 }
@@ -14,11 +14,90 @@ class Command
 public:
 	Command() = default;
 
+	/**
+	 * The wire encodings a command can travel in. Commands are always maps, which
+	 * every encoding marks with a different leading byte, so the encoding of an
+	 * incoming payload can be told from the payload itself.
+	 */
+	enum class ENCODING {
+		Json,
+		Cbor,
+		MsgPack
+	};
+
 	Command(memory::HeapView data) :
-		Command(json::parse(data.begin(), data.end()))
+		Command(parse(data, detectEncoding(data)))
 	{
 	}
 
+	Command(memory::HeapView data, ENCODING encoding) :
+		Command(parse(data, encoding))
+	{
+	}
+
+	/**
+	 * Scans a json payload for just the id, method and type, leaving params, result and
+	 * error as raw text until they are first accessed. Routers and proxies passing commands
+	 * on untouched never pay for their DOM, serializing an untouched command to json splices
+	 * the raw text back in. Binary payloads, batches and anything the scanner can't make
+	 * sense of get parsed in full as usual.
+	 *
+	 * Parsing on first access means even the const accessors modify a scanned command, so
+	 * unlike a parsed one it is not safe to read from several threads at once. Call
+	 * materialize() before sharing it.
+	 */
+	static Command scan(memory::HeapView data)
+	{
+		std::string_view text(reinterpret_cast<const char *>(data.begin()), data.size());
+		if (detectEncoding(data) != ENCODING::Json || !JsonScanner::isObject(text))
+			return Command(data);
+
+		Command cmd;
+		cmd.m_raw.assign(text);
+		std::string_view raw(cmd.m_raw);
+
+		bool hasParams = false, hasError = false, hasMethod = false, hasResult = false;
+		auto complete = JsonScanner::members(raw, [&](std::string_view key, std::string_view value) {
+			Slice slice = {static_cast<size_t>(value.data() - raw.data()), value.size()};
+			if (key == "params") {
+				cmd.m_rawParams = slice;
+				hasParams = true;
+			} else if (key == "result") {
+				cmd.m_rawResult = slice;
+				hasResult = true;
+			} else if (key == "error") {
+				cmd.m_rawError = slice;
+				hasError = true;
+			} else if (key == "method") {
+				cmd.m_method = json::parse(value.begin(), value.end()).get<std::string>();
+				hasMethod = true;
+			} else if (key == "id") {
+				if (!value.empty() && value.front() >= '0' && value.front() <= '9')
+					std::from_chars(value.data(), value.data() + value.size(), cmd.m_compactId);
+				else
+					cmd.m_id = json::parse(value.begin(), value.end()).get<Uuid>();
+			}
+		});
+
+		if (!complete)
+			return Command(data);
+
+		// Same precedence as the json constructor
+		if (hasResult)
+			cmd.m_type = TYPE::Result;
+		else if (hasMethod)
+			cmd.m_type = TYPE::Request;
+		else if (hasError)
+			cmd.m_type = TYPE::Error;
+		else if (hasParams)
+			cmd.m_type = TYPE::Request;
+
+		if (!cmd.m_id && !cmd.m_compactId && cmd.type() == TYPE::Request)
+			cmd.m_id = Uuid::create();
+
+		return cmd;
+	}
+
 	Command(json j)
 	{
 		auto _param = j.find("params");
@@ -39,15 +118,19 @@ public:
 			m_method = std::move(_method->get<std::string>());
 			m_type = TYPE::Request;
 		}
-		if (_id != j.end())
-			m_id = _id->get<Uuid>();	 
+		if (_id != j.end()) {
+			if (_id->is_number_unsigned())
+				m_compactId = _id->get<uint64_t>();
+			else
+				m_id = _id->get<Uuid>();
+		}
 		if (_result != j.end()) {
 			m_result = std::move(*_result);
 			m_type = TYPE::Result;
 		}
 
 		// If we've constructed as a request with no id, generate one here implicitly
-		if (!m_id && type() == TYPE::Request) {
+		if (!m_id && !m_compactId && type() == TYPE::Request) {
 			m_id = Uuid::create();
 		}
 	}
@@ -70,7 +153,12 @@ public:
 		m_error(std::move(cmd.m_error)),
 		m_jsonRpcVersion(std::move(cmd.m_jsonRpcVersion)),
 		m_method(std::move(cmd.m_method)),
-		m_type(cmd.m_type)
+		m_type(cmd.m_type),
+		m_compactId(cmd.m_compactId),
+		m_raw(std::move(cmd.m_raw)),
+		m_rawParams(cmd.m_rawParams),
+		m_rawResult(cmd.m_rawResult),
+		m_rawError(cmd.m_rawError)
 	{
 		cmd.m_type = TYPE::Init;
 	}
@@ -84,6 +172,11 @@ public:
 		m_jsonRpcVersion = std::move(cmd.m_jsonRpcVersion);
 		m_method = std::move(cmd.m_method);
 		m_type = cmd.m_type;
+		m_compactId = cmd.m_compactId;
+		m_raw = std::move(cmd.m_raw);
+		m_rawParams = cmd.m_rawParams;
+		m_rawResult = cmd.m_rawResult;
+		m_rawError = cmd.m_rawError;
 		cmd.m_type = TYPE::Init;
 		return *this;
 	}
@@ -91,30 +184,74 @@ public:
 	void setResult(json result)
 	{
 		m_result = std::move(result);
+		m_rawResult.reset();
 		m_type = TYPE::Result;
 	}
 
 	void setError(json error)
 	{
 		m_error = std::move(error);
+		m_rawError.reset();
 		m_type = TYPE::Error;
 	}
 
 	const std::string &method() const { return m_method; }
 	std::string method() { return m_method; }
 
-	const json &params() const { return m_params; }
-	json &params() { return m_params; }
+	const json &params() const { return materialize(m_params, m_rawParams); }
+	json &params() { return materialize(m_params, m_rawParams); }
+
+	const json &result() const { return materialize(m_result, m_rawResult); }
+	json &result() { return materialize(m_result, m_rawResult); }
 
-	const json &result() const { return m_result; }
-	json &result() { return m_result; }
+	const json &error() const { return materialize(m_error, m_rawError); }
+	json &error() { return materialize(m_error, m_rawError); }
 
-	const json &error() const { return m_error; }
-	json &error() { return m_error; }
+	// The raw json text of a scanned command's params/result/error, until first accessed
+	std::optional<std::string_view> rawParams() const { return rawText(m_rawParams); }
+	std::optional<std::string_view> rawResult() const { return rawText(m_rawResult); }
+	std::optional<std::string_view> rawError() const { return rawText(m_rawError); }
+
+	// True while any part of a scanned command is still raw text
+	bool lazy() const noexcept { return m_rawParams || m_rawResult || m_rawError; }
+
+	// Parses whatever a scan left as raw text, after which concurrent reads are safe
+	void materialize() const
+	{
+		materialize(m_params, m_rawParams);
+		materialize(m_result, m_rawResult);
+		materialize(m_error, m_rawError);
+	}
 
 	const Uuid &id() const { return m_id; }
 	Uuid &id() { return m_id; }
 
+	/**
+	 * A compact id is a plain 64 bit number used in place of the uuid, e.g. a per session
+	 * counter, which is cheaper to make, hash and compare and goes on the wire as a number.
+	 * Zero means the command goes by its uuid.
+	 */
+	uint64_t compactId() const noexcept { return m_compactId; }
+
+	void setCompactId(uint64_t id) noexcept
+	{
+		m_compactId = id;
+		m_id = Uuid::nill();
+	}
+
+	// Makes this command answer the given request, taking over whichever id it goes by
+	void replyTo(const Command &request)
+	{
+		m_id = request.m_id;
+		m_compactId = request.m_compactId;
+	}
+
+	// The id as it goes on the wire
+	json idJson() const
+	{
+		return m_compactId ? json(m_compactId) : json(m_id);
+	}
+
 	void checkError()
 	{
 		if (error().size() != 0) {
@@ -134,19 +271,355 @@ public:
 		return json(*this).dump();
 	}
 
+	/**
+	 * Serializes the command for the wire, binary encodings come back as a
+	 * string of raw bytes.
+	 */
+	std::string serialize(ENCODING encoding) const
+	{
+		std::string result;
+		serializeTo(result, encoding);
+		return result;
+	}
+
+	/**
+	 * Appends the serialized command to out. The envelope is written out directly and
+	 * only params/result/error go through the json serializers, so no json tree gets
+	 * built on the way (json text still dumps the value into a temporary before it is
+	 * appended), reusing out skips its allocation too. Anything still raw text from a
+	 * scan is copied across as is on json.
+	 */
+	void serializeTo(std::string &out, ENCODING encoding) const
+	{
+		if (type() != TYPE::Request && type() != TYPE::Result && type() != TYPE::Error)
+			DCORE_THROW(RuntimeError, "Cannot convert an un-setup command to json");
+
+		Envelope envelope(out, encoding, type() == TYPE::Request ? 4 : 3);
+		envelope.key("jsonrpc");
+		envelope.string("2.0");
+		envelope.key("id");
+		if (m_compactId)
+			envelope.number(m_compactId);
+		else
+			envelope.string(m_id.__toString());
+
+		auto member = [&](std::string_view name, json &value, std::optional<Slice> &raw) {
+			envelope.key(name);
+			if (raw && encoding == ENCODING::Json)
+				envelope.raw(rawText(raw).value());
+			else
+				envelope.value(materialize(value, raw));
+		};
+
+		switch (type()) {
+			case TYPE::Request:
+				envelope.key("method");
+				envelope.string(m_method);
+				member("params", m_params, m_rawParams);
+				break;
+			case TYPE::Result:
+				member("result", m_result, m_rawResult);
+				break;
+			default:
+				member("error", m_error, m_rawError);
+				break;
+		}
+
+		envelope.end();
+	}
+
+	static std::string serialize(const json &j, ENCODING encoding)
+	{
+		std::string result;
+		switch (encoding) {
+			case ENCODING::Json:
+				return j.dump();
+			case ENCODING::Cbor:
+				json::to_cbor(j, result);
+				return result;
+			case ENCODING::MsgPack:
+				json::to_msgpack(j, result);
+				return result;
+			default:
+				DCORE_THROW(RuntimeError, "Invalid command encoding:", static_cast<uint32_t>(encoding));
+		}
+	}
+
+	static json parse(memory::HeapView data, ENCODING encoding)
+	{
+		auto begin = reinterpret_cast<const uint8_t *>(data.begin());
+		auto end = reinterpret_cast<const uint8_t *>(data.end());
+
+		switch (encoding) {
+			case ENCODING::Json:
+				return json::parse(begin, end);
+			case ENCODING::Cbor:
+				return json::from_cbor(begin, end);
+			case ENCODING::MsgPack:
+				return json::from_msgpack(begin, end);
+			default:
+				DCORE_THROW(RuntimeError, "Invalid command encoding:", static_cast<uint32_t>(encoding));
+		}
+	}
+
+	/**
+	 * Wraps an array of commands up as a batch for the given encoding. On json that is
+	 * the plain json rpc 2.0 batch array, the binary encodings carry it in a map under
+	 * "batch" so the leading byte still tells the encoding apart.
+	 */
+	static json batch(json commands, ENCODING encoding)
+	{
+		if (encoding == ENCODING::Json)
+			return commands;
+		return json{{"batch", std::move(commands)}};
+	}
+
+	/**
+	 * Returns the commands of a parsed batch payload, or null if it holds a single command.
+	 */
+	static json * unbatch(json &j) noexcept
+	{
+		if (j.is_array())
+			return &j;
+		if (j.is_object()) {
+			if (auto commands = j.find("batch"); commands != j.end() && commands->is_array())
+				return &*commands;
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Tells the encoding from the leading byte, a cbor map is 0xa0-0xbf, a msgpack
+	 * map 0x80-0x8f/0xde/0xdf, anything else (a batch array included) is taken to be
+	 * json text.
+	 */
+	static ENCODING detectEncoding(memory::HeapView data) noexcept
+	{
+		if (!data.size())
+			return ENCODING::Json;
+
+		auto lead = std::to_integer<uint8_t>(*data.begin());
+		if (lead >= 0xa0 && lead <= 0xbf)
+			return ENCODING::Cbor;
+		if ((lead >= 0x80 && lead <= 0x8f) || lead == 0xde || lead == 0xdf)
+			return ENCODING::MsgPack;
+		return ENCODING::Json;
+	}
+
+	static std::string_view encodingName(ENCODING encoding) noexcept
+	{
+		switch (encoding) {
+			case ENCODING::Cbor:
+				return "cbor";
+			case ENCODING::MsgPack:
+				return "msgpack";
+			default:
+				return "json";
+		}
+	}
+
 	TYPE type() const { return m_type; }
 
 	bool operator < (const Command &command) const
 	{
+		if (m_compactId != command.m_compactId)
+			return m_compactId < command.m_compactId;
 		return m_id < command.m_id;
 	}
 
 protected:
+	// Where a raw value sits in m_raw
+	struct Slice {
+		size_t offset = 0, size = 0;
+	};
+
+	json & materialize(json &value, std::optional<Slice> &raw) const
+	{
+		if (raw) {
+			auto begin = m_raw.data() + raw->offset;
+			value = json::parse(begin, begin + raw->size);
+			raw.reset();
+		}
+		return value;
+	}
+
+	std::optional<std::string_view> rawText(const std::optional<Slice> &raw) const
+	{
+		if (!raw)
+			return {};
+		return std::string_view(m_raw).substr(raw->offset, raw->size);
+	}
+
+	/**
+	 * Writes a map out member by member in one of the encodings, strings and the map
+	 * header directly, other values through the json library's serializers.
+	 */
+	class Envelope
+	{
+	public:
+		Envelope(std::string &out, ENCODING encoding, size_t members) :
+			m_out(out), m_encoding(encoding)
+		{
+			switch (m_encoding) {
+				case ENCODING::Json:
+					m_out += '{';
+					break;
+				case ENCODING::Cbor:
+					header(0xa0, members);
+					break;
+				case ENCODING::MsgPack:
+					m_out += static_cast<char>(0x80 | members);
+					break;
+				default:
+					DCORE_THROW(RuntimeError, "Invalid command encoding:", static_cast<uint32_t>(m_encoding));
+			}
+		}
+
+		void key(std::string_view name)
+		{
+			if (m_encoding == ENCODING::Json && !std::exchange(m_first, false))
+				m_out += ',';
+			string(name);
+			if (m_encoding == ENCODING::Json)
+				m_out += ':';
+		}
+
+		void string(std::string_view value)
+		{
+			switch (m_encoding) {
+				case ENCODING::Json:
+					escape(value);
+					return;
+				case ENCODING::Cbor:
+					header(0x60, value.size());
+					break;
+				default:
+					if (value.size() < 32)
+						m_out += static_cast<char>(0xa0 | value.size());
+					else if (value.size() <= 0xff)
+						bigEndian(0xd9, value.size(), 1);
+					else if (value.size() <= 0xffff)
+						bigEndian(0xda, value.size(), 2);
+					else
+						bigEndian(0xdb, value.size(), 4);
+					break;
+			}
+			m_out.append(value);
+		}
+
+		void number(uint64_t value)
+		{
+			switch (m_encoding) {
+				case ENCODING::Json: {
+					char digits[20];
+					auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+					m_out.append(digits, end - digits);
+					break;
+				}
+				case ENCODING::Cbor:
+					header(0x00, value);
+					break;
+				default:
+					if (value < 0x80)
+						m_out += static_cast<char>(value);
+					else if (value <= 0xff)
+						bigEndian(0xcc, value, 1);
+					else if (value <= 0xffff)
+						bigEndian(0xcd, value, 2);
+					else if (value <= 0xffffffff)
+						bigEndian(0xce, value, 4);
+					else
+						bigEndian(0xcf, value, 8);
+					break;
+			}
+		}
+
+		void value(const json &value)
+		{
+			switch (m_encoding) {
+				case ENCODING::Json:
+					// The public api can only dump into a string of its own
+					m_out += value.dump();
+					break;
+				case ENCODING::Cbor:
+					json::to_cbor(value, m_out);
+					break;
+				default:
+					json::to_msgpack(value, m_out);
+					break;
+			}
+		}
+
+		// Already serialized json text
+		void raw(std::string_view text) { m_out.append(text); }
+
+		void end()
+		{
+			if (m_encoding == ENCODING::Json)
+				m_out += '}';
+		}
+
+	protected:
+		// Cbor's initial byte, the major type with the size packed in or following it
+		void header(uint8_t major, uint64_t size)
+		{
+			if (size < 24)
+				m_out += static_cast<char>(major | size);
+			else if (size <= 0xff)
+				bigEndian(major | 24, size, 1);
+			else if (size <= 0xffff)
+				bigEndian(major | 25, size, 2);
+			else if (size <= 0xffffffff)
+				bigEndian(major | 26, size, 4);
+			else
+				bigEndian(major | 27, size, 8);
+		}
+
+		void bigEndian(uint8_t lead, uint64_t value, size_t bytes)
+		{
+			m_out += static_cast<char>(lead);
+			for (size_t i = bytes; i > 0; i--)
+				m_out += static_cast<char>(value >> (8 * (i - 1)));
+		}
+
+		void escape(std::string_view value)
+		{
+			m_out += '"';
+			for (auto c : value) {
+				switch (c) {
+					case '"': m_out += "\\\""; break;
+					case '\\': m_out += "\\\\"; break;
+					case '\n': m_out += "\\n"; break;
+					case '\r': m_out += "\\r"; break;
+					case '\t': m_out += "\\t"; break;
+					default:
+						if (static_cast<uint8_t>(c) < 0x20) {
+							char code[8];
+							std::snprintf(code, sizeof(code), "\\u%04x", static_cast<uint8_t>(c));
+							m_out += code;
+						} else {
+							m_out += c;
+						}
+				}
+			}
+			m_out += '"';
+		}
+
+		std::string &m_out;
+		ENCODING m_encoding;
+		bool m_first = true;
+	};
+
 	std::string m_method;
-	json m_params, m_result, m_error;
+	mutable json m_params, m_result, m_error;
 	Uuid m_id = {};
 	std::string m_jsonRpcVersion = "2.0";
 	TYPE m_type = TYPE::Init;
+	uint64_t m_compactId = 0;
+
+	// The payload a scanned command was read from, and its values not parsed yet
+	std::string m_raw;
+	mutable std::optional<Slice> m_rawParams, m_rawResult, m_rawError;
 };
 
 // Conversion hooks for Command to json/from json
@@ -154,13 +627,13 @@ inline void to_json(json& j, const Command& cmd)
 {
 	switch (cmd.type()) {
 		case Command::TYPE::Request:
-			j = json{{"jsonrpc", "2.0"}, {"id", cmd.id()}, {"method", cmd.method()}, {"params", cmd.params()}};
+			j = json{{"jsonrpc", "2.0"}, {"id", cmd.idJson()}, {"method", cmd.method()}, {"params", cmd.params()}};
 			break;
 		case Command::TYPE::Result:
-			j = json{{"jsonrpc", "2.0"}, {"id", cmd.id()}, {"result", cmd.result()}};
+			j = json{{"jsonrpc", "2.0"}, {"id", cmd.idJson()}, {"result", cmd.result()}};
 			break;
 		case Command::TYPE::Error:
-			j = json{{"jsonrpc", "2.0"}, {"id", cmd.id()}, {"error", cmd.result()}};
+			j = json{{"jsonrpc", "2.0"}, {"id", cmd.idJson()}, {"error", cmd.error()}};
 			break;
 		default:
 			DCORE_THROW(RuntimeError, "Cannot convert an un-setup command to json");
@@ -6,18 +6,64 @@ namespace dictos::net {
  * The net 'EventMachine' is where the threads get to participate in the asio state machine
  * loop. You can either call the apis on a context to process it with  your current thread
  * or you can create a context that has in it a pre-set number of dedicated threads.
+ *
+ * In sharded mode every dedicated thread owns its own io context (a shard) and each protocol
+ * allocated against the machine is pinned to one shard for its whole life, so completions for
+ * a given stream never contend with other threads and always land on the same core.
+ *
+ * Thread placement is controlled through the net_event_machine config section, service threads
+ * can be pinned to an explicit cpu list and/or a numa node, in which case they also prefer that
+ * node's memory for everything they allocate.
+ *
+ * The run mode can also be switched from 'blocking' to 'hybrid', where each thread busy polls
+ * the reactor for a configurable spin budget before parking in the kernel wait, trading idle
+ * cpu for wakeup latency. Time spent spinning and parked is tracked per thread.
  */
-class EventMachine
+class EventMachine : public config::Context
 {
 public:
-	EventMachine(uint32_t threadCount = 0)
+	enum class MODE
 	{
-		for (uint32_t threadIdx = 0; threadIdx < threadCount; threadIdx++) {
-			m_threads.push_back(std::make_unique<async::Thread>(
-				string::toString("Context service thread:", threadIdx),
-				std::bind(&EventMachine::run, this)
-			));
-		}
+		Shared,		// All threads run the one io context
+		Sharded,	// One io context per thread, protocols are pinned to a shard
+	};
+
+	enum class PLACEMENT
+	{
+		RoundRobin,		// Shards are handed out in turn
+		LeastLoaded,	// The shard with the fewest live protocols wins
+	};
+
+	/**
+	 * Per thread accounting of where a hybrid run loop spent its time. Spin time is only
+	 * the polling that came up empty, handlers run while spinning don't count. Parked time
+	 * includes running the handler which woke the thread back up.
+	 */
+	struct PollStats
+	{
+		std::atomic<uint64_t> spinNanos = {0};	// Time spent busy polling with nothing ready
+		std::atomic<uint64_t> parkNanos = {0};	// Time spent blocked in the reactor
+		std::atomic<uint64_t> spinHits = {0};	// Handlers picked up while spinning
+		std::atomic<uint64_t> parks = {0};		// Times the spin budget ran out and we parked
+	};
+
+	EventMachine(uint32_t threadCount = 0, MODE mode = MODE::Shared, PLACEMENT placement = PLACEMENT::RoundRobin, config::Options options = config::Options()) :
+		Context(getSection(), std::move(options)),
+		m_mode(mode), m_placement(placement)
+	{
+		start(threadCount);
+	}
+
+	/**
+	 * Constructs the machine with everything (thread count, mode, placement, cpu list
+	 * and numa node) sourced from the net_event_machine options.
+	 */
+	EventMachine(config::Options options) :
+		Context(getSection(), std::move(options)),
+		m_mode(parseMode(getOption<std::string>("mode"))),
+		m_placement(parsePlacement(getOption<std::string>("placement")))
+	{
+		start(getOption<uint32_t>("thread_count"));
 	}
 
 	EventMachine(const EventMachine &em) = delete;
@@ -27,18 +73,26 @@ public:
 
 	virtual ~EventMachine() noexcept
 	{
-		for(auto &thread : m_threads) {
-			thread->cancel();
+		for (auto &shard : m_shards) {
+			for(auto &thread : shard->threads) {
+				thread->cancel();
+			}
+			shard->work.reset();
+			shard->context.stop();
+		}
+		for (auto &shard : m_shards) {
+			shard->threads.clear();
 		}
-		m_asioContext.stop();
-		m_threads.clear();
 	}
 
-	void run()
+	void run(uint32_t shardIdx = 0)
 	{
 		LOGT(net, "Run called");
 		try {
-			m_asioContext.run();
+			if (m_hybrid)
+				runHybrid(context(shardIdx), m_callerStats);
+			else
+				context(shardIdx).run();
 		} catch (dictos::error::Exception &e) {
 			LOGT(CRITICAL, "Exception:", e);
 			throw;
@@ -48,11 +102,19 @@ public:
 		}
 	}
 
+	/**
+	 * Runs at most one handler, waiting for one to become ready. A sharded machine's shards
+	 * are each run by their own service thread only, so this throws in sharded mode.
+	 */
 	void runOne()
 	{
 		LOGT(net, "Run one called");
+		requireShared();
 		try {
-			m_asioContext.run_one();
+			if (m_hybrid)
+				runOneHybrid(context(0), m_callerStats);
+			else
+				context(0).run_one();
 		} catch (dictos::error::Exception &e) {
 			LOGT(CRITICAL, "Exception:", e);
 			throw;
@@ -66,7 +128,8 @@ public:
 	{
 		LOGT(net, "Stop called");
 		try {
-			m_asioContext.stop();
+			for (auto &shard : m_shards)
+				shard->context.stop();
 		} catch (dictos::error::Exception &e) {
 			LOGT(CRITICAL, "Exception:", e);
 			throw;
@@ -76,12 +139,308 @@ public:
 		}
 	}
 
-	operator boost::asio::io_context & () noexcept { return m_asioContext; }
-	operator const boost::asio::io_context & () const noexcept { return m_asioContext; }
+	/**
+	 * Picks a shard for a new protocol according to the placement policy and
+	 * accounts for it in that shards load. Every acquire must be balanced with
+	 * a call to releaseShard once the protocol goes away.
+	 */
+	uint32_t acquireShard() noexcept
+	{
+		uint32_t shardIdx = 0;
+
+		if (m_shards.size() > 1) {
+			switch (m_placement) {
+				case PLACEMENT::RoundRobin:
+					shardIdx = m_nextShard.fetch_add(1, std::memory_order_relaxed) % m_shards.size();
+					break;
+
+				case PLACEMENT::LeastLoaded:
+				{
+					auto leastLoad = std::numeric_limits<uint32_t>::max();
+					for (uint32_t idx = 0; idx < m_shards.size(); idx++) {
+						auto load = m_shards[idx]->load.load(std::memory_order_relaxed);
+						if (load < leastLoad) {
+							leastLoad = load;
+							shardIdx = idx;
+						}
+					}
+					break;
+				}
+			}
+		}
+
+		m_shards[shardIdx]->load.fetch_add(1, std::memory_order_relaxed);
+		return shardIdx;
+	}
+
+	void releaseShard(uint32_t shardIdx) noexcept
+	{
+		m_shards[shardIdx]->load.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	boost::asio::io_context & context(uint32_t shardIdx) noexcept { return m_shards[shardIdx]->context; }
+	const boost::asio::io_context & context(uint32_t shardIdx) const noexcept { return m_shards[shardIdx]->context; }
+
+	uint32_t shardCount() const noexcept { return static_cast<uint32_t>(m_shards.size()); }
+	uint32_t shardLoad(uint32_t shardIdx) const noexcept { return m_shards[shardIdx]->load.load(std::memory_order_relaxed); }
+
+	MODE mode() const noexcept { return m_mode; }
+	PLACEMENT placement() const noexcept { return m_placement; }
+
+	const std::vector<uint32_t> & cpus() const noexcept { return m_cpus; }
+	int32_t numaNode() const noexcept { return m_numaNode; }
+
+	bool hybrid() const noexcept { return m_hybrid; }
+	std::chrono::nanoseconds spinBudget() const noexcept { return m_spinBudget; }
+
+	// Poll stats for each dedicated service thread, and for callers driving run()/runOne() themselves
+	uint32_t threadCount() const noexcept { return static_cast<uint32_t>(m_threadStats.size()); }
+	const PollStats & pollStats(uint32_t threadIdx) const noexcept { return *m_threadStats[threadIdx]; }
+	const PollStats & callerPollStats() const noexcept { return m_callerStats; }
+
+	/**
+	 * The one io context of a shared machine. A sharded machine has no single context to
+	 * hand out, streams are pinned to their own shard, so this throws in sharded mode. Use
+	 * context() instead.
+	 */
+	[[deprecated("Use context(shardIdx)")]]
+	operator boost::asio::io_context & () { requireShared(); return context(0); }
+	[[deprecated("Use context(shardIdx)")]]
+	operator const boost::asio::io_context & () const { requireShared(); return context(0); }
 
 protected:
-	boost::asio::io_context m_asioContext;
-	std::vector<std::unique_ptr<async::Thread>> m_threads;
+	using clock = std::chrono::steady_clock;
+
+	/**
+	 * A shard is one io context along with the threads servicing it, and a
+	 * count of the protocols currently pinned to it.
+	 */
+	struct Shard
+	{
+		Shard(int concurrencyHint) :
+			context(concurrencyHint)
+		{
+		}
+
+		boost::asio::io_context context;
+		std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work;
+		std::vector<std::unique_ptr<async::Thread>> threads;
+		std::atomic<uint32_t> load = {0};
+	};
+
+	void start(uint32_t threadCount)
+	{
+		// Resolve which cpus our threads get spread across, an explicit list wins
+		// over the cpus of the numa node
+		m_numaNode = getOption<int32_t>("numa_node");
+		m_cpus = affinity::parseCpuList(getOption<std::string>("cpu_list"));
+		if (m_cpus.empty() && m_numaNode >= 0)
+			m_cpus = affinity::nodeCpus(m_numaNode);
+
+		auto runMode = getOption<std::string>("run_mode");
+		if (runMode != "blocking" && runMode != "hybrid")
+			DCORE_THROW(InvalidArgument, "Invalid event machine run mode:", runMode);
+		m_hybrid = runMode == "hybrid";
+		m_spinBudget = std::chrono::microseconds(getOption<uint32_t>("spin_budget_us"));
+
+		// A shard without a thread of its own would have nobody to run it
+		if (m_mode == MODE::Sharded && threadCount < 2)
+			DCORE_THROW(InvalidArgument, "Sharded event machine needs at least 2 threads, got:", threadCount);
+
+		if (m_mode == MODE::Sharded) {
+			// Each shard is only ever run by its own service thread, a concurrency hint of 1
+			// promises asio a single runner (it still locks, only the unsafe hint drops that)
+			for (uint32_t shardIdx = 0; shardIdx < threadCount; shardIdx++) {
+				m_shards.push_back(std::make_unique<Shard>(1));
+				startThread(shardIdx, shardIdx);
+			}
+		} else {
+			m_shards.push_back(std::make_unique<Shard>(BOOST_ASIO_CONCURRENCY_HINT_DEFAULT));
+			for (uint32_t threadIdx = 0; threadIdx < threadCount; threadIdx++)
+				startThread(0, threadIdx);
+		}
+	}
+
+	void requireShared() const
+	{
+		if (m_shards.size() > 1)
+			DCORE_THROW(RuntimeError, "A sharded event machine has no single io context to hand out or run, use context(shardIdx)");
+	}
+
+	void startThread(uint32_t shardIdx, uint32_t threadIdx)
+	{
+		auto &shard = *m_shards[shardIdx];
+
+		// Dedicated threads must not fall out of run() just because there is no work yet
+		if (!shard.work)
+			shard.work.emplace(shard.context.get_executor());
+
+		m_threadStats.push_back(std::make_unique<PollStats>());
+
+		shard.threads.push_back(std::make_unique<async::Thread>(
+			string::toString("Context service thread:", threadIdx),
+			[this,shardIdx,threadIdx,&stats = *m_threadStats.back()]() {
+				place(threadIdx);
+				serve(shardIdx, stats);
+			}
+		));
+	}
+
+	/**
+	 * The body of a dedicated service thread.
+	 */
+	void serve(uint32_t shardIdx, PollStats &stats)
+	{
+		LOGT(net, "Serving shard:", shardIdx);
+		try {
+			if (m_hybrid)
+				runHybrid(context(shardIdx), stats);
+			else
+				context(shardIdx).run();
+		} catch (dictos::error::Exception &e) {
+			LOGT(CRITICAL, "Exception:", e);
+			throw;
+		} catch (std::exception &e) {
+			LOGT(CRITICAL, "Exception:", e);
+			throw;
+		}
+	}
+
+	/**
+	 * Spins on poll() until the spin budget passes without a single handler
+	 * becoming ready, then parks in run_one() until the reactor wakes us. Like
+	 * run() this returns once the context is stopped or runs out of work.
+	 */
+	void runHybrid(boost::asio::io_context &context, PollStats &stats)
+	{
+		while (!context.stopped()) {
+			auto lastHit = clock::now(), now = lastHit;
+			clock::duration idle = {};
+
+			// Any handler we pick up restarts the budget
+			while (now - lastHit < m_spinBudget && !context.stopped()) {
+				auto handled = context.poll();
+				auto polled = clock::now();
+				if (handled) {
+					stats.spinHits.fetch_add(handled, std::memory_order_relaxed);
+					lastHit = polled;
+				} else
+					idle += polled - now;
+				now = polled;
+			}
+			stats.spinNanos.fetch_add(nanos(idle), std::memory_order_relaxed);
+
+			if (context.stopped())
+				break;
+
+			auto parkStart = clock::now();
+			auto handled = context.run_one();
+			stats.parkNanos.fetch_add(nanos(clock::now() - parkStart), std::memory_order_relaxed);
+			stats.parks.fetch_add(1, std::memory_order_relaxed);
+
+			if (!handled)
+				break;
+		}
+	}
+
+	/**
+	 * Spins on poll_one() for up to the spin budget, parking in run_one() if
+	 * nothing became ready in that time.
+	 */
+	void runOneHybrid(boost::asio::io_context &context, PollStats &stats)
+	{
+		auto spinStart = clock::now(), now = spinStart;
+		auto handled = false;
+		while (now - spinStart < m_spinBudget && !context.stopped()) {
+			if ((handled = context.poll_one()))
+				break;
+			now = clock::now();
+		}
+
+		// Only the polls that came up empty count, not the handler the last one may have run
+		stats.spinNanos.fetch_add(nanos(now - spinStart), std::memory_order_relaxed);
+		if (handled) {
+			stats.spinHits.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		if (context.stopped())
+			return;
+
+		auto parkStart = clock::now();
+		context.run_one();
+		stats.parkNanos.fetch_add(nanos(clock::now() - parkStart), std::memory_order_relaxed);
+		stats.parks.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static uint64_t nanos(clock::duration elapsed) noexcept
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+
+	/**
+	 * Called on each service thread before it starts running, applies the
+	 * configured cpu pinning and numa memory policy to it.
+	 */
+	void place(uint32_t threadIdx)
+	{
+		if (!m_cpus.empty()) {
+			auto cpu = m_cpus[threadIdx % m_cpus.size()];
+			if (!affinity::pinThread(cpu))
+				LOG(ERROR, "Failed to pin service thread:", threadIdx, "to cpu:", cpu);
+		}
+
+		if (m_numaNode >= 0 && !affinity::bindMemory(m_numaNode))
+			LOG(ERROR, "Failed to bind service thread:", threadIdx, "memory to numa node:", m_numaNode);
+	}
+
+	static MODE parseMode(const std::string &mode)
+	{
+		if (mode == "shared")
+			return MODE::Shared;
+		if (mode == "sharded")
+			return MODE::Sharded;
+		DCORE_THROW(InvalidArgument, "Invalid event machine mode:", mode);
+	}
+
+	static PLACEMENT parsePlacement(const std::string &placement)
+	{
+		if (placement == "round_robin")
+			return PLACEMENT::RoundRobin;
+		if (placement == "least_loaded")
+			return PLACEMENT::LeastLoaded;
+		DCORE_THROW(InvalidArgument, "Invalid event machine placement:", placement);
+	}
+
+	static const config::Section & getSection()
+	{
+		if (auto section = config::Sections::find("net_event_machine"))
+			return *section;
+
+		static config::Section section("net_event_machine", {
+				{"thread_count", 0u, "Number of dedicated service threads (0 means the caller drives the machine)"},
+				{"mode", "shared"s, "Either 'shared' (one io context for all threads) or 'sharded' (one per thread)"},
+				{"placement", "round_robin"s, "How streams are placed on shards, 'round_robin' or 'least_loaded'"},
+				{"cpu_list", ""s, "Cpus to pin service threads to (e.g. 0-3,8), assigned to threads in turn"},
+				{"numa_node", -1, "Numa node to place service threads and their memory on (-1 to disable)"},
+				{"run_mode", "blocking"s, "Either 'blocking' (always wait in the reactor) or 'hybrid' (busy poll first)"},
+				{"spin_budget_us", 50u, "In hybrid mode, how long to busy poll without work before parking"},
+			}
+		);
+
+		return section;
+	}
+
+	MODE m_mode;
+	PLACEMENT m_placement;
+	std::atomic<uint32_t> m_nextShard = {0};
+	std::vector<uint32_t> m_cpus;
+	int32_t m_numaNode = -1;
+	bool m_hybrid = false;
+	std::chrono::nanoseconds m_spinBudget = {};
+	std::vector<std::unique_ptr<PollStats>> m_threadStats;
+	PollStats m_callerStats;
+	std::vector<std::unique_ptr<Shard>> m_shards;
 };
 
 }
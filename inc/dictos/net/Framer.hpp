@@ -0,0 +1,175 @@
+#pragma once
+
+namespace dictos::net {
+
+/**
+ * The framer delimits messages on byte stream transports (tcp, unix sockets) with a length
+ * header, either a fixed 32 bit big endian length or a LEB128 varint one. Message oriented
+ * transports like websockets already frame for us so there the framer is TYPE::None and
+ * passes data through as is.
+ *
+ * Decoding works on whatever chunk the stream received, complete frames in it are handed
+ * out as views straight into that chunk. Only a frame straddling two chunks gets copied,
+ * into a staging buffer kept until the rest of it arrives.
+ */
+class Framer
+{
+public:
+	enum class TYPE
+	{
+		None,
+		Fixed32,
+		Varint,
+	};
+
+	Framer(TYPE type = TYPE::Fixed32, Size maxFrameSize = 64 * 1024 * 1024) :
+		m_type(type), m_maxFrameSize(maxFrameSize)
+	{
+	}
+
+	TYPE type() const noexcept { return m_type; }
+
+	/**
+	 * Returns just the length header for a payload of the given size, for
+	 * sending header and payload as separate segments.
+	 */
+	memory::Heap header(Size payloadSize) const
+	{
+		std::byte header[MaxHeaderSize];
+		auto headerSize = encodeHeader(header, payloadSize);
+
+		memory::Heap result(headerSize);
+		std::memcpy(result.begin(), header, headerSize);
+		return result;
+	}
+
+	/**
+	 * Prepends the length header to the payload.
+	 */
+	memory::Heap encode(std::string_view payload) const
+	{
+		std::byte header[MaxHeaderSize];
+		auto headerSize = encodeHeader(header, payload.size());
+
+		memory::Heap frame(headerSize + payload.size());
+		std::memcpy(frame.begin(), header, headerSize);
+		std::memcpy(frame.begin() + headerSize, payload.data(), payload.size());
+		return frame;
+	}
+
+	/**
+	 * Feeds a received chunk through the framer, calling back with a view of each
+	 * complete frame payload in order. The views are only valid during the callback.
+	 */
+	template<class Callback>
+	void decode(memory::HeapView data, Callback &&cb)
+	{
+		if (m_type == TYPE::None)
+			return cb(data);
+
+		auto pos = data.begin(), end = data.end();
+
+		// Finish off a frame left over from the previous chunk first
+		if (!m_partial.empty()) {
+			size_t headerSize = 0;
+			uint64_t length = 0;
+			while (!parseHeader(m_partial.data(), m_partial.data() + m_partial.size(), headerSize, length)) {
+				// Headers are a few bytes at most, take them one at a time so we never
+				// run past a short frame into the next one
+				if (pos == end)
+					return;
+				m_partial.push_back(*pos++);
+			}
+
+			pos = stage(pos, end, headerSize + length);
+			if (m_partial.size() < headerSize + length)
+				return;
+
+			cb(memory::HeapView(m_partial.data() + headerSize, length));
+			m_partial.clear();
+		}
+
+		while (pos < end) {
+			size_t headerSize = 0;
+			uint64_t length = 0;
+			if (!parseHeader(pos, end, headerSize, length) || static_cast<uint64_t>(end - pos) < headerSize + length) {
+				m_partial.assign(pos, end);
+				return;
+			}
+
+			cb(memory::HeapView(pos + headerSize, length));
+			pos += headerSize + length;
+		}
+	}
+
+protected:
+	static constexpr size_t MaxHeaderSize = 10;
+
+	size_t encodeHeader(std::byte *header, uint64_t length) const
+	{
+		if (m_type == TYPE::Fixed32) {
+			if (length > std::numeric_limits<uint32_t>::max())
+				DCORE_THROW(InvalidArgument, "Frame too large for a 32 bit length header:", length);
+
+			for (size_t i = 0; i < 4; i++)
+				header[i] = std::byte(length >> (8 * (3 - i)));
+			return 4;
+		}
+
+		size_t size = 0;
+		do {
+			auto bits = static_cast<uint8_t>(length & 0x7f);
+			length >>= 7;
+			header[size++] = std::byte(length ? bits | 0x80 : bits);
+		} while (length);
+		return size;
+	}
+
+	/**
+	 * Returns false if [pos, end) doesn't hold a whole header yet.
+	 */
+	bool parseHeader(const std::byte *pos, const std::byte *end, size_t &headerSize, uint64_t &length) const
+	{
+		length = 0;
+
+		if (m_type == TYPE::Fixed32) {
+			if (end - pos < 4)
+				return false;
+
+			for (size_t i = 0; i < 4; i++)
+				length = (length << 8) | std::to_integer<uint64_t>(pos[i]);
+			headerSize = 4;
+		} else {
+			for (headerSize = 0; ; headerSize++) {
+				if (headerSize == MaxHeaderSize)
+					DCORE_THROW(RuntimeError, "Malformed varint frame header");
+				if (pos + headerSize == end)
+					return false;
+
+				auto byte = std::to_integer<uint64_t>(pos[headerSize]);
+				length |= (byte & 0x7f) << (7 * headerSize);
+				if (!(byte & 0x80))
+					break;
+			}
+			headerSize++;
+		}
+
+		if (length > m_maxFrameSize)
+			DCORE_THROW(RuntimeError, "Frame length:", length, "exceeds the maximum of:", m_maxFrameSize);
+		return true;
+	}
+
+	// Tops the staging buffer up to at most total bytes from [pos, end)
+	const std::byte * stage(const std::byte *pos, const std::byte *end, size_t total)
+	{
+		auto count = std::min<size_t>(end - pos, total > m_partial.size() ? total - m_partial.size() : 0);
+		m_partial.insert(m_partial.end(), pos, pos + count);
+		return pos + count;
+	}
+
+	TYPE m_type;
+	Size m_maxFrameSize;
+	std::vector<std::byte> m_partial;
+};
+
+}
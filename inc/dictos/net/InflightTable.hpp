@@ -0,0 +1,252 @@
+#pragma once
+
+namespace dictos::net {
+
+/**
+ * Hashes a Uuid by its raw bytes, it is a plain 16 byte value.
+ */
+struct UuidHash
+{
+	size_t operator () (const Uuid &id) const noexcept
+	{
+		return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char *>(&id), sizeof(id)));
+	}
+};
+
+/**
+ * A snapshot of how full an in flight table is and how well it probes, the same for every
+ * key and value type so tables of different types can be reported on alike.
+ */
+struct InflightStats
+{
+	size_t entries = 0;			// Requests currently in flight
+	size_t capacity = 0;		// Slots across all shards
+	size_t maxProbe = 0;		// Longest probe sequence seen
+	double meanProbe = 0;		// Slots looked at per lookup on average
+
+	double occupancy() const noexcept { return capacity ? double(entries) / capacity : 0; }
+};
+
+/**
+ * The in flight table maps request ids to whatever their completion needs (e.g. the reply
+ * handler) for as long as the request is outstanding. It is split into shards, each behind
+ * its own lock, so i/o threads completing different requests rarely contend.
+ *
+ * Each shard is an open addressing table with linear probing and backward shift deletion, the
+ * slots only hold the key and an index into the shard's value arena, so probing walks a small
+ * contiguous array and values are recycled in place instead of allocated per request.
+ */
+template<class Key, class Value, class Hash = std::hash<Key>>
+class InflightTable
+{
+public:
+	using Stats = InflightStats;
+
+	explicit InflightTable(size_t shardCount = 16, size_t shardCapacity = 64) :
+		m_shards(roundShards(shardCount))
+	{
+		for (auto &shard : m_shards)
+			shard.slots.resize(roundCapacity(shardCapacity));
+	}
+
+	/**
+	 * Adds the value under key, returns false (leaving the table as is) if the key is
+	 * already in flight.
+	 */
+	bool insert(const Key &key, Value value)
+	{
+		auto hash = mix(Hash()(key));
+		auto &shard = shardOf(hash);
+		auto guard = shard.lock.lock();
+
+		if (find(shard, key, hash) != NotFound)
+			return false;
+
+		if ((shard.count + 1) * 10 > shard.slots.size() * 7)
+			grow(shard);
+
+		uint32_t index;
+		if (!shard.freeValues.empty()) {
+			index = shard.freeValues.back();
+			shard.freeValues.pop_back();
+			shard.values[index] = std::move(value);
+		} else {
+			index = static_cast<uint32_t>(shard.values.size());
+			shard.values.emplace_back(std::move(value));
+		}
+
+		place(shard, Slot{key, hash, index});
+		shard.count++;
+		return true;
+	}
+
+	/**
+	 * Removes the key and hands back its value, if it was in flight.
+	 */
+	std::optional<Value> take(const Key &key)
+	{
+		auto hash = mix(Hash()(key));
+		auto &shard = shardOf(hash);
+		auto guard = shard.lock.lock();
+
+		auto pos = find(shard, key, hash);
+		if (pos == NotFound)
+			return {};
+
+		auto index = shard.slots[pos].value;
+		std::optional<Value> result = std::move(shard.values[index]);
+		shard.values[index].reset();
+		shard.freeValues.push_back(index);
+
+		erase(shard, pos);
+		shard.count--;
+		return result;
+	}
+
+	bool contains(const Key &key) const
+	{
+		auto hash = mix(Hash()(key));
+		auto &shard = shardOf(hash);
+		auto guard = shard.lock.lock();
+		return find(shard, key, hash) != NotFound;
+	}
+
+	Stats stats() const
+	{
+		Stats result;
+		uint64_t probes = 0, lookups = 0;
+
+		for (auto &shard : m_shards) {
+			auto guard = shard.lock.lock();
+			result.entries += shard.count;
+			result.capacity += shard.slots.size();
+			result.maxProbe = std::max(result.maxProbe, shard.maxProbe);
+			probes += shard.probes;
+			lookups += shard.lookups;
+		}
+
+		result.meanProbe = lookups ? double(probes) / lookups : 0;
+		return result;
+	}
+
+protected:
+	static constexpr uint32_t Empty = std::numeric_limits<uint32_t>::max();
+	static constexpr size_t NotFound = std::numeric_limits<size_t>::max();
+
+	struct Slot
+	{
+		Key key = {};
+		size_t hash = 0;
+		uint32_t value = Empty;
+	};
+
+	struct Shard
+	{
+		mutable async::SpinLock lock;
+		std::vector<Slot> slots;
+		std::vector<std::optional<Value>> values;
+		std::vector<uint32_t> freeValues;
+		size_t count = 0;
+
+		// Probe accounting, only ever touched under the lock
+		mutable size_t maxProbe = 0;
+		mutable uint64_t probes = 0, lookups = 0;
+	};
+
+	// Spreads weak hashes (e.g. sequential integers) over both the shard and the slot bits
+	static size_t mix(uint64_t hash) noexcept
+	{
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ull;
+		hash ^= hash >> 33;
+		return static_cast<size_t>(hash);
+	}
+
+	static size_t roundShards(size_t count) noexcept
+	{
+		size_t rounded = 1;
+		while (rounded < count)
+			rounded <<= 1;
+		return rounded;
+	}
+
+	static size_t roundCapacity(size_t capacity) noexcept
+	{
+		size_t rounded = 8;
+		while (rounded < capacity)
+			rounded <<= 1;
+		return rounded;
+	}
+
+	// The top bits pick the shard, the bottom ones the slot
+	Shard & shardOf(size_t hash) noexcept
+	{
+		return m_shards[(hash >> 48) & (m_shards.size() - 1)];
+	}
+
+	const Shard & shardOf(size_t hash) const noexcept
+	{
+		return m_shards[(hash >> 48) & (m_shards.size() - 1)];
+	}
+
+	size_t find(const Shard &shard, const Key &key, size_t hash) const
+	{
+		auto mask = shard.slots.size() - 1;
+		size_t probe = 1;
+		for (auto pos = hash & mask; ; pos = (pos + 1) & mask, probe++) {
+			auto &slot = shard.slots[pos];
+			if (slot.value == Empty || (slot.hash == hash && slot.key == key)) {
+				shard.lookups++;
+				shard.probes += probe;
+				shard.maxProbe = std::max(shard.maxProbe, probe);
+				return slot.value == Empty ? NotFound : pos;
+			}
+		}
+	}
+
+	void place(Shard &shard, Slot slot)
+	{
+		auto mask = shard.slots.size() - 1;
+		auto pos = slot.hash & mask;
+		while (shard.slots[pos].value != Empty)
+			pos = (pos + 1) & mask;
+		shard.slots[pos] = std::move(slot);
+	}
+
+	/**
+	 * Empties the slot, pulling later entries of the same probe run back into
+	 * the gap so lookups never need tombstones.
+	 */
+	void erase(Shard &shard, size_t hole)
+	{
+		auto mask = shard.slots.size() - 1;
+		for (auto pos = (hole + 1) & mask; shard.slots[pos].value != Empty; pos = (pos + 1) & mask) {
+			auto home = shard.slots[pos].hash & mask;
+
+			// Entries whose home lies cyclically in (hole, pos] are still reachable, leave them
+			auto reachable = hole <= pos ? (hole < home && home <= pos) : (hole < home || home <= pos);
+			if (reachable)
+				continue;
+
+			shard.slots[hole] = std::move(shard.slots[pos]);
+			hole = pos;
+		}
+		shard.slots[hole] = Slot();
+	}
+
+	void grow(Shard &shard)
+	{
+		auto slots = std::move(shard.slots);
+		shard.slots = std::vector<Slot>(slots.size() * 2);
+		for (auto &slot : slots) {
+			if (slot.value != Empty)
+				place(shard, std::move(slot));
+		}
+	}
+
+	std::vector<Shard> m_shards;
+};
+
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+namespace dictos::net {
+
+/**
+ * The json scanner walks the top level members of a json object without building a DOM,
+ * handing out each key along with the raw text of its value. Nested values are skipped by
+ * matching brackets, the scan for the next quote or bracket goes 16 bytes at a time where
+ * SSE2 is available, so skipping over a large params object costs little more than a memchr.
+ *
+ * It only checks as much structure as it needs to find the members, values are not
+ * validated until whoever wants them parses them. Brackets do have to match, and nothing
+ * but whitespace may follow the object. Values nested deeper than MaxDepth aren't scanned,
+ * such text is reported as not scannable so the caller falls back to a full parse.
+ */
+class JsonScanner
+{
+public:
+	static constexpr size_t npos = std::string_view::npos;
+
+	/**
+	 * Calls cb(key, value) for each top level member, the key without its quotes (and
+	 * escapes left as is), the value as raw json text. Returns false if the text isn't
+	 * an object, is cut short or has anything after it.
+	 */
+	template<class Callback>
+	static bool members(std::string_view text, Callback &&cb)
+	{
+		auto pos = skipSpace(text, 0);
+		if (pos >= text.size() || text[pos] != '{')
+			return false;
+
+		pos = skipSpace(text, pos + 1);
+		if (pos < text.size() && text[pos] == '}')
+			return skipSpace(text, pos + 1) == text.size();
+
+		while (true) {
+			if (pos >= text.size() || text[pos] != '"')
+				return false;
+
+			auto keyEnd = stringEnd(text, pos + 1);
+			if (keyEnd == npos)
+				return false;
+			auto key = text.substr(pos + 1, keyEnd - pos - 1);
+
+			pos = skipSpace(text, keyEnd + 1);
+			if (pos >= text.size() || text[pos] != ':')
+				return false;
+
+			pos = skipSpace(text, pos + 1);
+			auto end = valueEnd(text, pos);
+			if (end == npos)
+				return false;
+			cb(key, text.substr(pos, end - pos));
+
+			pos = skipSpace(text, end);
+			if (pos >= text.size())
+				return false;
+			if (text[pos] == '}')
+				return skipSpace(text, pos + 1) == text.size();
+			if (text[pos] != ',')
+				return false;
+			pos = skipSpace(text, pos + 1);
+		}
+	}
+
+	/**
+	 * Returns the raw text of a single top level member, if the object has it.
+	 */
+	static std::optional<std::string_view> member(std::string_view text, std::string_view name)
+	{
+		std::optional<std::string_view> result;
+		members(text, [&](std::string_view key, std::string_view value) {
+			if (!result && key == name)
+				result = value;
+		});
+		return result;
+	}
+
+	// True if the text starts with an object, as opposed to e.g. a batch array
+	static bool isObject(std::string_view text) noexcept
+	{
+		auto pos = skipSpace(text, 0);
+		return pos < text.size() && text[pos] == '{';
+	}
+
+protected:
+	static constexpr size_t MaxDepth = 64;
+
+	static bool isSpace(char c) noexcept
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	static size_t skipSpace(std::string_view text, size_t pos) noexcept
+	{
+		while (pos < text.size() && isSpace(text[pos]))
+			pos++;
+		return pos;
+	}
+
+	/**
+	 * Finds the first of the given characters at or after pos.
+	 */
+	template<char ...Chars>
+	static size_t findAny(std::string_view text, size_t pos) noexcept
+	{
+#if defined(__SSE2__)
+		while (pos + 16 <= text.size()) {
+			auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + pos));
+			auto hits = _mm_setzero_si128();
+			((hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Chars)))), ...);
+			if (auto mask = _mm_movemask_epi8(hits))
+				return pos + __builtin_ctz(static_cast<unsigned>(mask));
+			pos += 16;
+		}
+#endif
+		for (; pos < text.size(); pos++) {
+			if (((text[pos] == Chars) || ...))
+				return pos;
+		}
+		return npos;
+	}
+
+	// Given the position just past an opening quote returns that of the closing one
+	static size_t stringEnd(std::string_view text, size_t pos) noexcept
+	{
+		while ((pos = findAny<'"', '\\'>(text, pos)) != npos) {
+			if (text[pos] == '"')
+				return pos;
+			pos += 2;
+		}
+		return npos;
+	}
+
+	// Returns the position just past the value starting at pos
+	static size_t valueEnd(std::string_view text, size_t pos) noexcept
+	{
+		if (pos >= text.size())
+			return npos;
+
+		switch (text[pos]) {
+			case '"': {
+				auto end = stringEnd(text, pos + 1);
+				return end == npos ? npos : end + 1;
+			}
+
+			case '{':
+			case '[': {
+				// One bit per open bracket, set for a brace, so each closer can be matched
+				uint64_t braces = 0;
+				size_t depth = 0;
+				while ((pos = findAny<'"', '{', '}', '[', ']'>(text, pos)) != npos) {
+					switch (text[pos]) {
+						case '"':
+							pos = stringEnd(text, pos + 1);
+							if (pos == npos)
+								return npos;
+							break;
+						case '{':
+						case '[':
+							if (depth == MaxDepth)
+								return npos;
+							braces = (braces << 1) | (text[pos] == '{');
+							depth++;
+							break;
+						default:
+							if ((braces & 1) != (text[pos] == '}'))
+								return npos;
+							braces >>= 1;
+							if (--depth == 0)
+								return pos + 1;
+					}
+					pos++;
+				}
+				return npos;
+			}
+
+			default: {
+				// Numbers, true, false and null run up to the next delimiter
+				auto start = pos;
+				while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ']' && !isSpace(text[pos]))
+					pos++;
+				return pos == start ? npos : pos;
+			}
+		}
+	}
+};
+
+}
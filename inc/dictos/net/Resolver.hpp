@@ -0,0 +1,277 @@
+#pragma once
+
+namespace dictos::net {
+
+/**
+ * The resolver turns host names into endpoints for connects, through a process wide cache
+ * shared by every stream. Lookups for a name that is already being resolved wait on that
+ * one resolve instead of starting their own, answers are kept for ttl_s and failures for
+ * negative_ttl_s, so a name that doesn't resolve isn't hammered either.
+ *
+ * The system resolver (getaddrinfo) doesn't hand out the record ttls, the configured ttl
+ * caps how long an answer is trusted instead.
+ *
+ * Resolves run on the resolver's own thread, so they complete (and every waiter on them
+ * gets its answer) whatever becomes of the io context of whoever started them. Each waiter
+ * gets its callback posted to its own io context, which counts as outstanding work there
+ * until then and so has to outlive the lookup. Cache hits get their callback posted the
+ * same way.
+ */
+class Resolver : public config::Context
+{
+public:
+	using tcp = boost::asio::ip::tcp;
+
+	/**
+	 * The endpoints a name resolved to, in the order the system resolver prefers them.
+	 * Copies share the one list.
+	 */
+	class Endpoints
+	{
+	public:
+		using Entries = std::vector<tcp::endpoint>;
+		using value_type = tcp::endpoint;
+		using const_iterator = Entries::const_iterator;
+		using iterator = const_iterator;
+
+		Endpoints() = default;
+
+		explicit Endpoints(Entries entries) :
+			m_entries(std::make_shared<const Entries>(std::move(entries)))
+		{
+		}
+
+		const_iterator begin() const noexcept { return m_entries ? m_entries->begin() : const_iterator(); }
+		const_iterator end() const noexcept { return m_entries ? m_entries->end() : const_iterator(); }
+
+		size_t size() const noexcept { return m_entries ? m_entries->size() : 0; }
+		bool empty() const noexcept { return !size(); }
+
+	protected:
+		std::shared_ptr<const Entries> m_entries;
+	};
+
+	typedef std::function<void(boost::system::error_code ec, Endpoints endpoints)> Callback;
+
+	struct Stats
+	{
+		std::atomic<uint64_t> hits = {0};			// Lookups answered from the cache
+		std::atomic<uint64_t> negativeHits = {0};	// Of those, ones answered with a cached failure
+		std::atomic<uint64_t> misses = {0};			// Lookups that started a resolve
+		std::atomic<uint64_t> coalesced = {0};		// Lookups that waited on a resolve already running
+		std::atomic<uint64_t> failures = {0};		// Resolves that failed
+	};
+
+	static Resolver & instance()
+	{
+		static Resolver resolver;
+		return resolver;
+	}
+
+	Resolver(config::Options options = config::Options()) :
+		Context(getSection(), std::move(options)),
+		m_ttl(std::chrono::seconds(getOption<uint32_t>("ttl_s"))),
+		m_negativeTtl(std::chrono::seconds(getOption<uint32_t>("negative_ttl_s"))),
+		m_maxEntries(std::max<size_t>(getOption<uint32_t>("max_entries"), 1)),
+		m_work(m_context.get_executor())
+	{
+		m_thread = std::make_unique<async::Thread>("Resolver thread", [this]() { m_context.run(); });
+	}
+
+	Resolver(const Resolver &resolver) = delete;
+	Resolver & operator = (const Resolver &resolver) = delete;
+
+	~Resolver() noexcept
+	{
+		m_thread->cancel();
+		m_work.reset();
+		m_context.stop();
+		m_thread.reset();
+	}
+
+	/**
+	 * Resolves host, calling back with its endpoints (for the given port) or the error
+	 * resolving it failed with.
+	 */
+	void resolve(boost::asio::io_context &context, const std::string &host, unsigned short port, Callback cb)
+	{
+		auto key = string::toString(host, ":", port);
+
+		auto guard = m_lock.lock();
+		auto now = clock::now();
+
+		auto existing = m_entries.find(key);
+		if (existing != m_entries.end()) {
+			auto &entry = existing->second;
+
+			if (entry.pending) {
+				entry.waiters.push_back({boost::asio::make_work_guard(context), std::move(cb)});
+				m_stats.coalesced.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			if (now < entry.expiry) {
+				auto ec = entry.ec;
+				auto endpoints = entry.endpoints;
+				guard.unlock();
+
+				m_stats.hits.fetch_add(1, std::memory_order_relaxed);
+				if (ec)
+					m_stats.negativeHits.fetch_add(1, std::memory_order_relaxed);
+
+				// Posted like any other answer, so callers never get called back from within resolve
+				boost::asio::post(context, [ec,endpoints = std::move(endpoints),cb = std::move(cb)]() {
+					cb(ec, endpoints);
+				});
+				return;
+			}
+		} else {
+			makeRoom(now);
+			existing = m_entries.emplace(key, Entry()).first;
+		}
+
+		// Nothing usable cached, we get to resolve it
+		auto &entry = existing->second;
+		entry.pending = true;
+		entry.waiters.push_back({boost::asio::make_work_guard(context), std::move(cb)});
+		m_stats.misses.fetch_add(1, std::memory_order_relaxed);
+
+		auto resolver = std::make_shared<tcp::resolver>(m_context);
+		guard.unlock();
+
+		LOGT(net, "Resolving:", key);
+		resolver->async_resolve(host, string::toString(port),
+			[this,key,resolver](boost::system::error_code ec, tcp::resolver::results_type results) {
+				complete(key, ec, results);
+			}
+		);
+	}
+
+	// Forgets everything cached, resolves in flight still complete
+	void flush()
+	{
+		auto guard = m_lock.lock();
+		for (auto entry = m_entries.begin(); entry != m_entries.end(); ) {
+			if (entry->second.pending)
+				++entry;
+			else
+				entry = m_entries.erase(entry);
+		}
+	}
+
+	size_t size() const
+	{
+		auto guard = m_lock.lock();
+		return m_entries.size();
+	}
+
+	const Stats & stats() const noexcept { return m_stats; }
+
+protected:
+	using clock = std::chrono::steady_clock;
+
+	// A lookup waiting on a resolve, its io context is kept from running out of work meanwhile
+	struct Waiter
+	{
+		boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+		Callback cb;
+	};
+
+	struct Entry
+	{
+		bool pending = false;
+		boost::system::error_code ec;
+		Endpoints endpoints;
+		clock::time_point expiry;
+		std::vector<Waiter> waiters;
+	};
+
+	void complete(const std::string &key, boost::system::error_code ec, const tcp::resolver::results_type &results)
+	{
+		Endpoints endpoints;
+		if (!ec) {
+			Endpoints::Entries entries;
+			for (auto &result : results)
+				entries.push_back(result.endpoint());
+			endpoints = Endpoints(std::move(entries));
+
+			if (endpoints.empty())
+				ec = boost::asio::error::host_not_found;
+		}
+
+		if (ec)
+			m_stats.failures.fetch_add(1, std::memory_order_relaxed);
+
+		auto guard = m_lock.lock();
+		auto &entry = m_entries[key];
+		auto waiters = std::move(entry.waiters);
+		entry.waiters.clear();
+
+		// A cancelled resolve says nothing about the name, don't remember it
+		if (ec == boost::asio::error::operation_aborted) {
+			m_entries.erase(key);
+		} else {
+			entry.pending = false;
+			entry.ec = ec;
+			entry.endpoints = endpoints;
+			entry.expiry = clock::now() + (ec ? m_negativeTtl : m_ttl);
+		}
+		guard.unlock();
+
+		for (auto &waiter : waiters) {
+			boost::asio::post(waiter.work.get_executor(), [ec,endpoints,cb = std::move(waiter.cb)]() {
+				cb(ec, endpoints);
+			});
+			waiter.work.reset();
+		}
+	}
+
+	// Keeps the cache under its limit, expired entries go first then whichever comes first
+	void makeRoom(clock::time_point now)
+	{
+		if (m_entries.size() < m_maxEntries)
+			return;
+
+		for (auto entry = m_entries.begin(); entry != m_entries.end(); ) {
+			if (!entry->second.pending && entry->second.expiry <= now)
+				entry = m_entries.erase(entry);
+			else
+				++entry;
+		}
+
+		for (auto entry = m_entries.begin(); entry != m_entries.end() && m_entries.size() >= m_maxEntries; ) {
+			if (!entry->second.pending)
+				entry = m_entries.erase(entry);
+			else
+				++entry;
+		}
+	}
+
+	static const config::Section & getSection()
+	{
+		if (auto section = config::Sections::find("net_resolver"))
+			return *section;
+
+		static config::Section section("net_resolver", {
+				{"ttl_s", 30u, "Seconds a resolved host name is cached for"},
+				{"negative_ttl_s", 5u, "Seconds a host name that failed to resolve is cached for"},
+				{"max_entries", 4096u, "Most host names to keep cached"},
+			}
+		);
+
+		return section;
+	}
+
+	mutable async::SpinLock m_lock;
+	std::unordered_map<std::string, Entry> m_entries;
+	clock::duration m_ttl, m_negativeTtl;
+	size_t m_maxEntries;
+	Stats m_stats;
+
+	// Where resolves run
+	boost::asio::io_context m_context;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+	std::unique_ptr<async::Thread> m_thread;
+};
+
+}
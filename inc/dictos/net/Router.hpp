@@ -0,0 +1,357 @@
+#pragma once
+
+namespace dictos::net {
+
+/**
+ * The router dispatches incoming requests to a handler per method, instead of every
+ * IncomingSig handler seeing every request. It can be shared by any number of sessions.
+ *
+ * Method names are interned into a perfect hash table when routes get added (hash and
+ * displace: a first hash picks a bucket, the bucket's displacement seed picks a slot no
+ * other method uses), so a lookup is one pass over the method name, one slot and one
+ * string compare. Routes are meant to be set up front, adding one rebuilds the table.
+ *
+ * Each route runs either inline on the i/o thread the request arrived on or on the
+ * worker context the router was given, optionally with a limit on how many calls may
+ * run at once, calls over the limit queue up in order. Calls, failures and latency are
+ * counted per method.
+ */
+class Router :
+	public util::SharedFromThis<Router>
+{
+public:
+	typedef std::function<void(SessionPtr session, Command request)> Handler;
+
+	enum class EXECUTION {
+		Inline,		// On the i/o thread that received the request
+		Worker,		// Posted to the router's worker context
+	};
+
+	struct Options
+	{
+		EXECUTION execution = EXECUTION::Inline;
+		uint32_t maxConcurrency = 0;	// Calls allowed to run at once, 0 for no limit
+	};
+
+	struct Stats
+	{
+		std::atomic<uint64_t> calls = {0};			// Completed calls
+		std::atomic<uint64_t> failures = {0};		// Calls whose handler threw
+		std::atomic<uint64_t> queued = {0};			// Calls that had to wait for the concurrency limit
+		std::atomic<uint64_t> active = {0};			// Calls running (or posted to run) right now
+		std::atomic<uint64_t> totalNanos = {0};		// Time spent in the handler over all calls
+		std::atomic<uint64_t> maxNanos = {0};		// Slowest call
+
+		double meanNanos() const noexcept
+		{
+			auto count = calls.load();
+			return count ? double(totalNanos.load()) / count : 0;
+		}
+	};
+
+	Router() = default;
+
+	// Worker routes get posted to the given context, e.g. a dedicated event machine
+	explicit Router(boost::asio::io_context &worker) :
+		m_worker(&worker)
+	{
+	}
+
+	/**
+	 * Adds the handler for a method, replacing any previous one.
+	 */
+	void route(std::string_view method, Handler handler)
+	{
+		route(method, std::move(handler), Options());
+	}
+
+	void route(std::string_view method, Handler handler, Options options)
+	{
+		if (options.execution == EXECUTION::Worker && !m_worker)
+			DCORE_THROW(InvalidArgument, "Worker route for:", method, "on a router without a worker context");
+
+		auto guard = m_lock.lock();
+
+		auto route = std::make_unique<Route>();
+		route->method.assign(method.begin(), method.end());
+		route->handler = std::move(handler);
+		route->options = options;
+
+		auto existing = std::find_if(m_routes.begin(), m_routes.end(),
+			[&](const auto &current) { return current->method == method; });
+		if (existing != m_routes.end()) {
+			// The old route may still be looked up or running, keep it around
+			m_retired.push_back(std::move(*existing));
+			*existing = std::move(route);
+		} else {
+			m_routes.push_back(std::move(route));
+		}
+
+		std::atomic_store(&m_table, build(m_routes));
+	}
+
+	bool routes(std::string_view method) const noexcept { return find(method) != nullptr; }
+
+	/**
+	 * Hands the request to its method's route, returns false leaving the request as is
+	 * if there is no route for it.
+	 */
+	bool dispatch(SessionPtr session, Command &request)
+	{
+		auto route = find(std::as_const(request).method());
+		if (!route)
+			return false;
+
+		Call call = {std::move(session), std::move(request)};
+		if (acquire(*route, call))
+			start(*route, std::move(call));
+		return true;
+	}
+
+	// The counters for a method, null if it has no route
+	const Stats * stats(std::string_view method) const noexcept
+	{
+		auto route = find(method);
+		return route ? &route->stats : nullptr;
+	}
+
+protected:
+	struct Call
+	{
+		SessionPtr session;
+		Command request;
+	};
+
+	struct Route
+	{
+		std::string method;
+		Handler handler;
+		Options options;
+		Stats stats;
+
+		async::SpinLock lock;
+		std::deque<Call> pending;
+	};
+
+	/**
+	 * The perfect hash table, rebuilt whole on every change and swapped in so lookups
+	 * never take a lock.
+	 */
+	struct Table
+	{
+		std::vector<uint32_t> seeds;	// Displacement per bucket
+		std::vector<Route *> slots;
+		uint64_t bucketMask = 0, slotMask = 0;
+	};
+
+	static uint64_t mix(uint64_t hash) noexcept
+	{
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ull;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	// Fnv-1a over the name, everything else is derived from this one pass
+	static uint64_t hash(std::string_view method) noexcept
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (auto c : method) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	static uint64_t bucketOf(uint64_t hash, uint64_t mask) noexcept { return mix(hash) & mask; }
+
+	static uint64_t slotOf(uint64_t hash, uint32_t seed, uint64_t mask) noexcept
+	{
+		return mix(hash + (seed + 1) * 0x9e3779b97f4a7c15ull) & mask;
+	}
+
+	static size_t roundUp(size_t count) noexcept
+	{
+		size_t rounded = 1;
+		while (rounded < count)
+			rounded <<= 1;
+		return rounded;
+	}
+
+	static std::shared_ptr<const Table> build(const std::vector<std::unique_ptr<Route>> &routes)
+	{
+		auto table = std::make_shared<Table>();
+
+		std::vector<uint64_t> hashes;
+		for (auto &route : routes)
+			hashes.push_back(hash(route->method));
+
+		for (auto slotCount = roundUp(std::max<size_t>(routes.size() * 2, 8)); ; slotCount <<= 1) {
+			auto bucketCount = roundUp(std::max<size_t>(routes.size() / 2, 1));
+			table->bucketMask = bucketCount - 1;
+			table->slotMask = slotCount - 1;
+			table->seeds.assign(bucketCount, 0);
+			table->slots.assign(slotCount, nullptr);
+
+			// Place the fullest buckets first, while the table is still empty
+			std::vector<std::vector<size_t>> buckets(bucketCount);
+			for (size_t index = 0; index < routes.size(); index++)
+				buckets[bucketOf(hashes[index], table->bucketMask)].push_back(index);
+
+			std::vector<size_t> order(bucketCount);
+			std::iota(order.begin(), order.end(), 0);
+			std::stable_sort(order.begin(), order.end(),
+				[&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+			if (std::all_of(order.begin(), order.end(), [&](size_t bucket) {
+					return displace(*table, bucket, buckets[bucket], hashes, routes);
+				}))
+				return table;
+		}
+	}
+
+	/**
+	 * Looks for a seed that puts every member of the bucket in a free slot of its own,
+	 * gives up (so the table grows) after a bounded number of tries.
+	 */
+	static bool displace(Table &table, size_t bucket, const std::vector<size_t> &members,
+		const std::vector<uint64_t> &hashes, const std::vector<std::unique_ptr<Route>> &routes)
+	{
+		static constexpr uint32_t MaxSeeds = 4096;
+
+		std::vector<uint64_t> slots;
+		for (uint32_t seed = 0; seed < MaxSeeds; seed++) {
+			slots.clear();
+			for (auto index : members) {
+				auto slot = slotOf(hashes[index], seed, table.slotMask);
+				if (table.slots[slot] || std::find(slots.begin(), slots.end(), slot) != slots.end())
+					break;
+				slots.push_back(slot);
+			}
+
+			if (slots.size() != members.size())
+				continue;
+
+			table.seeds[bucket] = seed;
+			for (size_t i = 0; i < members.size(); i++)
+				table.slots[slots[i]] = routes[members[i]].get();
+			return true;
+		}
+		return false;
+	}
+
+	Route * find(std::string_view method) const noexcept
+	{
+		auto table = std::atomic_load(&m_table);
+		if (!table)
+			return nullptr;
+
+		auto methodHash = hash(method);
+		auto seed = table->seeds[bucketOf(methodHash, table->bucketMask)];
+		auto route = table->slots[slotOf(methodHash, seed, table->slotMask)];
+		return route && route->method == method ? route : nullptr;
+	}
+
+	// Takes a slot under the concurrency limit, or queues the call if there is none
+	bool acquire(Route &route, Call &call)
+	{
+		if (!route.options.maxConcurrency) {
+			route.stats.active.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		auto guard = route.lock.lock();
+		if (route.stats.active.load(std::memory_order_relaxed) >= route.options.maxConcurrency) {
+			route.pending.push_back(std::move(call));
+			route.stats.queued.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		route.stats.active.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Gives the slot of a finished call to the next queued one, if any
+	std::optional<Call> release(Route &route)
+	{
+		if (route.options.maxConcurrency) {
+			auto guard = route.lock.lock();
+			if (!route.pending.empty()) {
+				std::optional<Call> next = std::move(route.pending.front());
+				route.pending.pop_front();
+				return next;
+			}
+		}
+
+		route.stats.active.fetch_sub(1, std::memory_order_relaxed);
+		return {};
+	}
+
+	void start(Route &route, Call call)
+	{
+		if (route.options.execution == EXECUTION::Worker) {
+			boost::asio::post(*m_worker, [router = thisPtr(), &route, call = std::move(call)]() mutable {
+				router->run(route, std::move(call));
+			});
+			return;
+		}
+
+		run(route, std::move(call));
+	}
+
+	void run(Route &route, Call call)
+	{
+		while (true) {
+			invoke(route, std::move(call));
+
+			auto next = release(route);
+			if (!next)
+				return;
+
+			// Queued worker calls go back through the worker so they take turns with everything else
+			if (route.options.execution == EXECUTION::Worker)
+				return start(route, std::move(next.value()));
+			call = std::move(next.value());
+		}
+	}
+
+	void invoke(Route &route, Call call)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		try {
+			route.handler(std::move(call.session), std::move(call.request));
+		} catch (dictos::error::Exception &e) {
+			route.stats.failures.fetch_add(1, std::memory_order_relaxed);
+			LOG(ERROR, "Handler for method:", route.method, "threw:", e);
+		} catch (std::exception &e) {
+			route.stats.failures.fetch_add(1, std::memory_order_relaxed);
+			LOG(ERROR, "Handler for method:", route.method, "threw:", e.what());
+		} catch (...) {
+			// Whatever it was it must not get past us, the route's slot still has to be released
+			route.stats.failures.fetch_add(1, std::memory_order_relaxed);
+			LOG(ERROR, "Handler for method:", route.method, "threw an unknown exception");
+		}
+
+		auto elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count());
+
+		auto &stats = route.stats;
+		stats.calls.fetch_add(1, std::memory_order_relaxed);
+		stats.totalNanos.fetch_add(elapsed, std::memory_order_relaxed);
+
+		auto slowest = stats.maxNanos.load(std::memory_order_relaxed);
+		while (elapsed > slowest && !stats.maxNanos.compare_exchange_weak(slowest, elapsed, std::memory_order_relaxed))
+			;
+	}
+
+	boost::asio::io_context *m_worker = nullptr;
+	async::SpinLock m_lock;
+	std::vector<std::unique_ptr<Route>> m_routes;
+	std::vector<std::unique_ptr<Route>> m_retired;
+	std::shared_ptr<const Table> m_table;
+};
+
+}
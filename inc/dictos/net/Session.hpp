@@ -13,8 +13,19 @@ class Session :
 public:
 	typedef std::function<void(Command result)> ReplyHandler;
 
+	/**
+	 * Byte stream transports get a fixed 32 bit length header per command unless
+	 * told otherwise, message oriented ones (websockets) are sent as is.
+	 */
 	Session(StreamPtr stream) :
-		m_stream(std::move(stream))
+		Session(stream, Framer(stream->messageOriented() ? Framer::TYPE::None : Framer::TYPE::Fixed32))
+	{
+	}
+
+	Session(StreamPtr stream, Framer framer) :
+		m_stream(std::move(stream)),
+		m_framer(std::move(framer)),
+		m_timers(boost::asio::use_service<TimingWheel>(m_stream->ioContext()))
 	{
 		// Link to the streams error signal
 		m_errCon = m_stream->ErrorSig.connect([this](
@@ -26,63 +37,144 @@ public:
 		m_stream->close();
 	}
 
+	/**
+	 * Connects the stream and starts reading from it, requests submitted early (see
+	 * submitEarly) that didn't make it out as early data get written first.
+	 */
+	void connect(Stream::ConnectCallback cb = Stream::ConnectCallback()) {
+		m_stream->connect([session = getThisPtr(), cb = std::move(cb)]() {
+			session->onConnected();
+			session->enqueueRead();
+			if (cb)
+				cb();
+		});
+	}
+
 	/**
 	 * The request context remains around for the life of an outstanding
 	 * or incoming request. It tracks the callback which will be triggered
 	 * upon the completion of its registration in the queues, when we
-	 * receive the associated reply.
+	 * receive the associated reply. It only holds what the reply needs,
+	 * not the request itself.
 	 */
 	struct RequestCtx {
-		Command request;
 		ReplyHandler replyHandler;
+		std::optional<TimingWheel::TimerId> deadline;
 	};
 
+	using OutgoingTable = InflightTable<Uuid, RequestCtx, UuidHash>;
+	using CompactTable = InflightTable<uint64_t, RequestCtx>;
+
 	/**
-	 * Submits the payload to the stream for async sending.
+	 * How the session ids its outgoing requests, by the uuid each command carries or, for
+	 * peers known to support it (e.g. within a cluster), by a 64 bit per session counter.
 	 */
-	void submitRequest(Command cmd, std::optional<ReplyHandler> replyHandler = {}) {
-		// Has to be a request
-		if (cmd.type() != Command::TYPE::Request) {
-			DCORE_THROW(RuntimeError, "Invalid command type:", cmd);
-		}
+	enum class ID_MODE {
+		Uuid,
+		Compact
+	};
 
-		// Id can't be nil
-		if (cmd.id() == Uuid::nill()) {
-			DCORE_THROW(RuntimeError, "Id must not be nil for request:", cmd);
-		}
+	/**
+	 * A request in a batch along with its (optional) reply handler.
+	 */
+	struct BatchRequest {
+		Command request;
+		std::optional<ReplyHandler> replyHandler;
+	};
 
-		auto guard = m_lock.lock();
+	/**
+	 * Submits the payload to the stream for async sending. With a timeout, if no reply
+	 * arrives in time the reply handler gets called with a timeout error instead and the
+	 * request is forgotten, a late reply is then ignored.
+	 */
+	void submitRequest(Command cmd, std::optional<ReplyHandler> replyHandler = {},
+		std::optional<std::chrono::steady_clock::duration> timeout = {}) {
+		assignId(cmd);
+		registerRequest(cmd, std::move(replyHandler), timeout);
 
-		// Ensure a duplicate id wasn't used
-		auto iter = m_outgoing.find(cmd.id());
+		auto &payload = scratch();
+		encode(cmd, payload);
 
-		if (iter != m_outgoing.end()) {
-			DCORE_THROW(RuntimeError, "Duplicate outgoing request id detected:", cmd);
+		// Submit it over the wire
+		LOGT(SESSION, "Sending request:", cmd.id(), "encoded as:", Command::encodingName(m_encoding));
+		// The request has to outlive this call for the write signal, commands don't copy
+		send(payload, [this, cmd = std::make_shared<Command>(std::move(cmd))]() {
+			WriteSig(thisPtr(), *cmd);
+		});
+
+		// And enqueue a read
+		enqueueRead();
+	}
+
+	/**
+	 * Submits a request before the stream connects, to go out as tls 1.3 early data if the
+	 * stream resumes a session that allows it, saving the request a round trip. Otherwise
+	 * (the stream can't send early data, or the server turned it down) it is written as a
+	 * regular request once connected. Early data can be replayed by an attacker, so this is
+	 * for idempotent requests only. No write signal is raised for a request that went out
+	 * early, connect the session (not just the stream) so the rest go out and replies get read.
+	 */
+	void submitEarly(Command cmd, std::optional<ReplyHandler> replyHandler = {},
+		std::optional<std::chrono::steady_clock::duration> timeout = {}) {
+		assignId(cmd);
+		registerRequest(cmd, std::move(replyHandler), timeout);
+
+		auto &payload = scratch();
+		encode(cmd, payload);
+
+		auto frame = m_framer.type() != Framer::TYPE::None ? m_framer.encode(payload) : memory::Heap(payload.size());
+		if (m_framer.type() == Framer::TYPE::None)
+			std::memcpy(frame.begin(), payload.data(), payload.size());
+
+		auto guard = m_lock.lock();
+		if (!m_connected) {
+			auto sentEarly = m_stream->writeEarly(memory::HeapView(frame.begin(), frame.size()));
+			LOGT(SESSION, "Queued early request:", cmd.id(), "as early data:", sentEarly);
+			m_early.push_back(EarlyRequest{std::move(frame), std::move(cmd), sentEarly});
+			return;
 		}
+		guard.unlock();
 
-		guard.release();
+		// Connected already, too late for early data
+		writeFrame(std::move(frame), std::move(cmd));
+		enqueueRead();
+	}
 
-		// Add a request context for this request id
-		auto id = cmd.id();
-		auto json = string::toString(cmd);
+	/**
+	 * Submits a number of requests as one batch, they go out in a single payload and a
+	 * single write. Each reply still comes back to its own handler, the timeout (if any)
+	 * applies to each request on its own. Either all requests get registered or, if one
+	 * is invalid, none of them do and nothing is sent.
+	 */
+	void submitBatch(std::vector<BatchRequest> batch,
+		std::optional<std::chrono::steady_clock::duration> timeout = {}) {
+		if (batch.empty())
+			DCORE_THROW(InvalidArgument, "Request batch is empty");
 
-		// May be unset, which implies no reply
-		if (replyHandler) {
-			LOGT(SESSION, "Registering a command context with id:", id);
-			guard.lock();
-			m_outgoing[id] = RequestCtx(
-						{std::move(cmd), std::move(replyHandler.value())
-					});
-			guard.unlock();
+		size_t registered = 0;
+		try {
+			for (auto &entry : batch) {
+				assignId(entry.request);
+				registerRequest(entry.request, std::move(entry.replyHandler), timeout);
+				registered++;
+			}
+		} catch (...) {
+			for (size_t i = 0; i < registered; i++)
+				forgetRequest(batch[i].request);
+			throw;
 		}
 
-		// Submit it over the wire
-		LOGT(SESSION, "Sending request:", json);
-		m_stream->write(std::move(json), [this, &cmd]() {
-			WriteSig(thisPtr(), cmd);
+		auto payload = encode(batch);
+
+		LOGT(SESSION, "Sending batch of:", batch.size(), "requests encoded as:", Command::encodingName(m_encoding));
+
+		// The write signal fires per request, keep them around until the write completes
+		auto requests = std::make_shared<std::vector<BatchRequest>>(std::move(batch));
+		send(payload, [this, requests]() {
+			for (auto &entry : *requests)
+				WriteSig(thisPtr(), entry.request);
 		});
 
-		// And enqueue a read
 		enqueueRead();
 	}
 
@@ -93,7 +185,8 @@ public:
 		> ErrorSig;
 
 	// This signal is emitted when we receive an incoming request,
-	// gives the user a chance to handle it.
+	// gives the user a chance to handle it. Requests taken by the
+	// router (if set) don't make it here.
 	signals::signal<
 		void (SessionPtr session, const Command &request)
 		> IncomingSig;
@@ -105,15 +198,124 @@ public:
 
 	StreamPtr stream() const { return m_stream; }
 
+	/**
+	 * Routes incoming requests by method through the router, requests for methods
+	 * it has no route for still go out through IncomingSig.
+	 */
+	void setRouter(RouterPtr router) { std::atomic_store(&m_router, std::move(router)); }
+	RouterPtr router() const { return std::atomic_load(&m_router); }
+
+	/**
+	 * Sets the binary encodings this session will offer and accept, in order of preference.
+	 * Sessions stay on plain json-rpc unless given some. The offer is an extension to json-rpc,
+	 * an "encodings" member listing the encoding names (e.g. ["cbor","msgpack"]) added to each
+	 * outgoing json command until the peer agrees on one, by offering it back or by sending in
+	 * it. Peers that don't know the extension ignore the member and both sides stay on json.
+	 */
+	void setEncodings(std::vector<Command::ENCODING> encodings)
+	{
+		auto guard = m_lock.lock();
+		m_encodings = std::move(encodings);
+	}
+
+	/**
+	 * Switches how outgoing requests get their ids, compact ids replace whatever uuid a
+	 * request was made with. The peer has to echo numeric ids back, replies to requests
+	 * already in flight still match up after a switch.
+	 */
+	void setIdMode(ID_MODE mode) noexcept { m_idMode = mode; }
+	ID_MODE idMode() const noexcept { return m_idMode; }
+
+	// Occupancy and probe lengths of the outstanding request table for the current id mode
+	InflightStats outgoingStats() const
+	{
+		return m_idMode == ID_MODE::Compact ? m_compactOutgoing.stats() : m_outgoing.stats();
+	}
+
+	// The encoding outgoing commands are currently sent in
+	Command::ENCODING encoding() const noexcept { return m_encoding; }
+
 protected:
 	/**
-	 * Called when we receive an incoming payload
+	 * Called when we receive an incoming payload, on byte stream transports this can
+	 * hold any number of whole or partial frames.
 	 */
 	void onIncoming(memory::HeapView data)
 	{
+		try {
+			m_framer.decode(std::move(data), [this](memory::HeapView frame) {
+				// A bad command doesn't spoil the frames after it
+				try {
+					onIncomingFrame(frame);
+				} catch (dictos::error::Exception &e) {
+					LOG(ERROR, "Failed to handle incoming frame:", e);
+					dictos::error::block([&](){ ErrorSig(e, thisPtr()); });
+				}
+			});
+		} catch (dictos::error::Exception &e) {
+			// A bad length header leaves no telling where the next frame starts, so
+			// there's nothing left to read on this stream
+			LOG(ERROR, "Failed to decode incoming frames, closing:", e);
+			m_readPending = false;
+			dictos::error::block([&](){ ErrorSig(e, thisPtr()); });
+			close();
+			return;
+		}
+
+		// Queue up another read
+		m_readPending = false;
+		enqueueRead();
+	}
+
+	/**
+	 * Called for each complete command payload, which may be a batch of commands.
+	 */
+	void onIncomingFrame(memory::HeapView data)
+	{
+		auto encoding = Command::detectEncoding(data);
+
+		// A single json command only gets scanned, routing needs no more than its id and type
+		std::string_view text(reinterpret_cast<const char *>(data.begin()), data.size());
+		if (encoding == Command::ENCODING::Json && JsonScanner::isObject(text)) {
+			if (!m_negotiated) {
+				json offer = json::object();
+				if (auto encodings = JsonScanner::member(text, "encodings"))
+					offer["encodings"] = json::parse(encodings->begin(), encodings->end());
+				negotiate(encoding, offer);
+			}
+
+			dispatch(Command::scan(data));
+			return;
+		}
+
 		// Parse the command and figure out what to do with it
-		Command cmd(std::move(data));
+		auto j = Command::parse(data, encoding);
+
+		if (auto commands = Command::unbatch(j)) {
+			LOGT(SESSION, "Received batch of:", commands->size(), "commands");
+
+			// Any encoding offer rides along with the first command of a batch
+			if (!commands->empty())
+				negotiate(encoding, commands->front());
+
+			// One bad element doesn't spoil the rest of the batch
+			for (auto &element : *commands) {
+				try {
+					dispatch(Command(std::move(element)));
+				} catch (dictos::error::Exception &e) {
+					LOG(ERROR, "Failed to dispatch batched command:", e);
+					dictos::error::block([&](){ ErrorSig(e, thisPtr()); });
+				}
+			}
+			return;
+		}
+
+		negotiate(encoding, j);
+		dispatch(Command(std::move(j)));
+	}
 
+	void dispatch(Command cmd)
+	{
 		switch (cmd.type()) {
 			case Command::TYPE::Request:
 				// Register it and notify the callback
@@ -128,14 +330,243 @@ protected:
 			default:
 				DCORE_THROW(RuntimeError, "Invalid command received:", cmd);
 		}
+	}
 
-		// Queue up another read
-		enqueueRead();
+	/**
+	 * Validates an outgoing request and adds a request context for it, with its
+	 * deadline scheduled if it has a timeout.
+	 */
+	void registerRequest(const Command &cmd, std::optional<ReplyHandler> replyHandler,
+		std::optional<std::chrono::steady_clock::duration> timeout)
+	{
+		// Has to be a request
+		if (cmd.type() != Command::TYPE::Request) {
+			DCORE_THROW(RuntimeError, "Invalid command type:", cmd);
+		}
+
+		// Id can't be nil
+		if (cmd.id() == Uuid::nill() && !cmd.compactId()) {
+			DCORE_THROW(RuntimeError, "Id must not be nil for request:", cmd);
+		}
+
+		if (cmd.compactId())
+			registerIn(m_compactOutgoing, cmd.compactId(), cmd, std::move(replyHandler), timeout);
+		else
+			registerIn(m_outgoing, cmd.id(), cmd, std::move(replyHandler), timeout);
+	}
+
+	// Gives the request a compact id from our counter if that's the mode we're in
+	void assignId(Command &cmd)
+	{
+		if (m_idMode == ID_MODE::Compact)
+			cmd.setCompactId(m_nextId.fetch_add(1, std::memory_order_relaxed));
+	}
+
+	template<class Table, class Key>
+	void registerIn(Table &table, const Key &id, const Command &cmd, std::optional<ReplyHandler> replyHandler,
+		std::optional<std::chrono::steady_clock::duration> timeout)
+	{
+		// Add a request context for this request id, may be unset which implies no reply,
+		// either way ensure a duplicate id wasn't used
+		if (replyHandler) {
+			LOGT(SESSION, "Registering a command context with id:", id);
+
+			RequestCtx context = {std::move(replyHandler.value())};
+			if (timeout) {
+				context.deadline = m_timers.schedule(timeout.value(),
+					[session = thisPtr(), id]() { session->onRequestTimeout(id); });
+			}
+
+			auto deadline = context.deadline;
+			if (!table.insert(id, std::move(context))) {
+				if (deadline)
+					m_timers.cancel(deadline.value());
+				DCORE_THROW(RuntimeError, "Duplicate outgoing request id detected:", cmd);
+			}
+		} else if (table.contains(id)) {
+			DCORE_THROW(RuntimeError, "Duplicate outgoing request id detected:", cmd);
+		}
+	}
+
+	// Takes the context of the request the command answers out of the outgoing tables
+	std::optional<RequestCtx> takeOutgoing(const Command &cmd)
+	{
+		if (cmd.compactId())
+			return m_compactOutgoing.take(cmd.compactId());
+		return m_outgoing.take(cmd.id());
+	}
+
+	// Drops a registered request again, e.g. when the batch it was part of failed
+	void forgetRequest(const Command &cmd)
+	{
+		if (auto context = takeOutgoing(cmd); context && context->deadline)
+			m_timers.cancel(context->deadline.value());
+	}
+
+	/**
+	 * Writes an encoded payload out, behind its length header on framed streams. The
+	 * payload gets copied into the one buffer that goes to the stream, header included.
+	 */
+	void send(std::string_view payload, Stream::WriteCallback onWrite)
+	{
+		if (m_framer.type() != Framer::TYPE::None)
+			return m_stream->write(m_framer.encode(payload), std::move(onWrite));
+
+		memory::Heap frame(payload.size());
+		std::memcpy(frame.begin(), payload.data(), payload.size());
+		m_stream->write(std::move(frame), std::move(onWrite));
+	}
+
+	/**
+	 * The per thread buffer commands get serialized into, it keeps its capacity between
+	 * uses so encoding a command doesn't allocate once it has grown to fit.
+	 */
+	static std::string & scratch()
+	{
+		static constexpr size_t MaxRetained = 1024 * 1024;
+		static thread_local std::string buffer;
+
+		if (buffer.capacity() > MaxRetained)
+			std::string().swap(buffer);
+		buffer.clear();
+		return buffer;
+	}
+
+	/**
+	 * Serializes an outgoing command in the current encoding into out. While still on
+	 * json the binary encodings we take are listed alongside, for the peer to pick from,
+	 * those first few commands go through a json tree to add the offer.
+	 */
+	void encode(const Command &cmd, std::string &out)
+	{
+		auto encoding = m_encoding.load();
+		if (encoding != Command::ENCODING::Json || !offering())
+			return cmd.serializeTo(out, encoding);
+
+		json j = cmd;
+		offerEncodings(j);
+		out = Command::serialize(j, Command::ENCODING::Json);
+	}
+
+	/**
+	 * Serializes a batch of requests as one payload, the encoding offer goes along with
+	 * the first of them.
+	 */
+	std::string encode(const std::vector<BatchRequest> &batch)
+	{
+		auto encoding = m_encoding.load();
+
+		json commands = json::array();
+		for (auto &entry : batch)
+			commands.push_back(entry.request);
+
+		if (encoding == Command::ENCODING::Json)
+			offerEncodings(commands.front());
+
+		return Command::serialize(Command::batch(std::move(commands), encoding), encoding);
+	}
+
+	bool offering()
+	{
+		auto guard = m_lock.lock();
+		return !m_negotiated && !m_encodings.empty();
+	}
+
+	void offerEncodings(json &j)
+	{
+		auto guard = m_lock.lock();
+		if (!m_negotiated && !m_encodings.empty()) {
+			auto &offer = j["encodings"] = json::array();
+			for (auto encoding : m_encodings)
+				offer.push_back(Command::encodingName(encoding));
+		}
+	}
+
+	/**
+	 * Settles on a binary encoding the first time the peer shows it supports one, either
+	 * by sending in it or by offering it alongside a json command. Both sides converge on
+	 * the same encoding since we only ever switch to one of ours the peer can decode.
+	 */
+	void negotiate(Command::ENCODING received, const json &j)
+	{
+		if (m_negotiated)
+			return;
+
+		auto guard = m_lock.lock();
+
+		std::optional<Command::ENCODING> chosen;
+		if (received != Command::ENCODING::Json) {
+			if (std::find(m_encodings.begin(), m_encodings.end(), received) != m_encodings.end())
+				chosen = received;
+		} else if (auto offer = j.find("encodings"); offer != j.end() && offer->is_array()) {
+			for (auto encoding : m_encodings) {
+				if (std::find(offer->begin(), offer->end(), std::string(Command::encodingName(encoding))) != offer->end()) {
+					chosen = encoding;
+					break;
+				}
+			}
+		}
+
+		if (!chosen)
+			return;
+
+		m_encoding = chosen.value();
+		m_negotiated = true;
+		guard.unlock();
+
+		LOGT(SESSION, "Negotiated command encoding:", Command::encodingName(m_encoding));
+		m_stream->binary(true);
+	}
+
+	/**
+	 * A request submitted early, kept until the connect so it can be written then unless it
+	 * went out as early data the server took.
+	 */
+	struct EarlyRequest {
+		memory::Heap frame;
+		Command request;
+		bool sentEarly;
+	};
+
+	// Writes the early requests the stream didn't get across, through the stream's write queue
+	void onConnected()
+	{
+		auto guard = m_lock.lock();
+		m_connected = true;
+		auto early = std::move(m_early);
+		m_early.clear();
+		guard.unlock();
+
+		auto accepted = m_stream->earlyDataAccepted();
+		for (auto &entry : early) {
+			if (entry.sentEarly && accepted)
+				continue;
+			writeFrame(std::move(entry.frame), std::move(entry.request));
+		}
+	}
+
+	void writeFrame(memory::Heap frame, Command cmd)
+	{
+		m_stream->write(std::move(frame), [this, cmd = std::make_shared<Command>(std::move(cmd))]() {
+			WriteSig(thisPtr(), *cmd);
+		});
 	}
 
 	void enqueueRead()
 	{
-		m_stream->read(Size(), [session = getThisPtr()](memory::HeapView data) {
+		// Only ever one read in flight, the stream doesn't allow overlapping them
+		if (m_readPending.exchange(true))
+			return;
+
+		if (m_framer.type() == Framer::TYPE::None) {
+			m_stream->read(Size(), [session = getThisPtr()](memory::HeapView data) {
+				session->onIncoming(std::move(data));
+			});
+			return;
+		}
+
+		// Take whatever has arrived and let the framer cut it up
+		m_stream->readSome(std::numeric_limits<Size>::max(), [session = getThisPtr()](memory::HeapView data) {
 			session->onIncoming(std::move(data));
 		});
 	}
@@ -159,6 +590,9 @@ protected:
 
 		guard.unlock();
 
+		if (auto router = std::atomic_load(&m_router); router && router->dispatch(thisPtr(), request))
+			return;
+
 		IncomingSig(thisPtr(), std::move(request));
 	}
 
@@ -171,21 +605,48 @@ protected:
 	{
 		LOG(SESSION, "Received incoming result:", result);
 
-		// We should have something in the outgoing queue matching its id
-		auto guard = m_lock.lock();
-		auto iter = m_outgoing.find(result.id());
-		if (iter == m_outgoing.end()) {
+		// We should have something in the outgoing table matching its id, take
+		// it out of there then dispatch the callback
+		auto context = takeOutgoing(result);
+		if (!context) {
 			LOG(ERROR, "Ignoring incoming result for invalid id:", result);
 			return;
 		}
 
-		// Ok move it out of there then dispatch the callback
-		auto context = std::move(iter->second);
-		m_outgoing.erase(iter);
-		guard.release();
+		if (context->deadline)
+			m_timers.cancel(context->deadline.value());
+
+		try {
+			context->replyHandler(std::move(result));
+		} catch (dictos::error::Exception &e) {
+			LOG(ERROR, "Result handler threw:", e);
+			dictos::error::block([&](){ ErrorSig(e, thisPtr()); });
+		}
+	}
+
+	/**
+	 * Called from the timing wheel when a request's deadline passes before its reply
+	 * arrived, fails it with a timeout error.
+	 */
+	template<class Key>
+	void onRequestTimeout(const Key &id)
+	{
+		Command result;
+		if constexpr (std::is_same_v<Key, uint64_t>)
+			result.setCompactId(id);
+		else
+			result.id() = id;
+
+		auto context = takeOutgoing(result);
+		if (!context)
+			return;
+
+		LOG(SESSION, "Request timed out:", id);
+
+		result.setError(json{{"code", -32000}, {"message", "Request timed out"}});
 
 		try {
-			context.replyHandler(std::move(result));
+			context->replyHandler(std::move(result));
 		} catch (dictos::error::Exception &e) {
 			LOG(ERROR, "Result handler threw:", e);
 			dictos::error::block([&](){ ErrorSig(e, thisPtr()); });
@@ -198,8 +659,21 @@ protected:
 
 	signals::scoped_connection m_errCon;
 	StreamPtr m_stream;
+	Framer m_framer;
+	std::atomic<bool> m_readPending = {false};
+	std::vector<Command::ENCODING> m_encodings;
+	std::atomic<Command::ENCODING> m_encoding = {Command::ENCODING::Json};
+	std::atomic<bool> m_negotiated = {false};
 	async::SpinLock m_lock;
-	std::map<Uuid, RequestCtx> m_outgoing, m_incoming;
+	OutgoingTable m_outgoing;
+	CompactTable m_compactOutgoing;
+	std::atomic<ID_MODE> m_idMode = {ID_MODE::Uuid};
+	std::atomic<uint64_t> m_nextId = {1};
+	RouterPtr m_router;
+	TimingWheel &m_timers;
+	std::map<Uuid, RequestCtx> m_incoming;
+	std::vector<EarlyRequest> m_early;
+	bool m_connected = false;
 };
 
 }
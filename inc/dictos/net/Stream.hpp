@@ -20,10 +20,23 @@ public:
 	// Define the well known op callback signatures
 	typedef std::function<void(StreamPtr)> AcceptCallback;
 	using ReadCallback = protocol::AbstractProtocol::ReadCallback;
+	using PooledReadCallback = protocol::AbstractProtocol::PooledReadCallback;
+	using MessageCallback = protocol::AbstractProtocol::MessageCallback;
 	using ConnectCallback = protocol::AbstractProtocol::ConnectCallback;
 	using WriteCallback = protocol::AbstractProtocol::WriteCallback;
 	using ErrorCallback = protocol::AbstractProtocol::ErrorCallback;
 
+	/**
+	 * Counts how well the write queue coalesces, the fewer protocol writes per queued
+	 * write the better.
+	 */
+	struct WriteStats
+	{
+		std::atomic<uint64_t> queued = {0};		// Writes handed to the stream
+		std::atomic<uint64_t> batches = {0};	// Writes issued to the protocol
+		std::atomic<uint64_t> dropped = {0};	// Queued writes abandoned after a failed write
+	};
+
 	Stream(Address addr, EventMachine &em, config::Options options = config::Options()) :
 		Context(getSection(), std::move(options)),
 		m_protocol(protocol::allocateProtocol(std::move(addr), *this,
@@ -45,8 +58,9 @@ public:
 		try {
 			LOGT(stream, "Accepting new connections");
 
-			// Create a new blank stream from our target address and options
-			auto newStream = std::make_shared<Stream>(getLocalAddress(), getOptions());
+			// Create a new blank stream from our target address and options, it gets placed on
+			// a shard of our event machine like any other stream would
+			auto newStream = std::make_shared<Stream>(getLocalAddress(), eventMachine(), getOptions());
 			auto &protocol = newStream->m_protocol;
 
 			// Now transfer that stream through the callback, and hand the accept call the protocol
@@ -88,6 +102,81 @@ public:
 		}
 	}
 
+	/**
+	 * Like read but the buffer is drawn from the pool, the callback owns it and it goes
+	 * back to the pool once destroyed.
+	 */
+	void readPooled(Size size, PooledReadCallback cb) const
+	{
+		try {
+			LOGT(stream, "Reading pooled:", size);
+
+			m_protocol->readPooled(size,
+				[this,stream = getThisPtr(),cb = std::move(cb)](buffer::PoolBuffer data) {
+
+				// Now that we've received it report our rate
+				RecvRate.report(data.size());
+
+				cb(std::move(data));
+			});
+		} catch (dictos::error::Exception &e) {
+			LOG(stream, __FUNCTION__, "error re-raise", e);
+			throw;
+		} catch (std::exception &e) {
+			DCORE_ERR_THROW(net::error::NetException, "Failed to read:", e);
+		}
+	}
+
+	/**
+	 * Like read but completes with whatever has arrived, up to maxSize bytes, so one receive
+	 * can drain several small messages. The view is only valid until the callback returns.
+	 */
+	void readSome(Size maxSize, ReadCallback cb) const
+	{
+		try {
+			LOGT(stream, "Reading some:", maxSize);
+
+			m_protocol->readSome(maxSize,
+				[this,stream = getThisPtr(),cb = std::move(cb)](memory::HeapView data) {
+
+				// Now that we've received it report our rate
+				RecvRate.report(data.size());
+
+				cb(std::move(data));
+			});
+		} catch (dictos::error::Exception &e) {
+			LOG(stream, __FUNCTION__, "error re-raise", e);
+			throw;
+		} catch (std::exception &e) {
+			DCORE_ERR_THROW(net::error::NetException, "Failed to read:", e);
+		}
+	}
+
+	/**
+	 * Reads the next whole message on a message oriented transport (websockets), the
+	 * callback owns the message buffer and may hold on to it past the callback.
+	 */
+	void readMessage(MessageCallback cb) const
+	{
+		try {
+			LOGT(stream, "Reading message");
+
+			m_protocol->readMessage(
+				[this,stream = getThisPtr(),cb = std::move(cb)](buffer::Message message) {
+
+				// Now that we've received it report our rate
+				RecvRate.report(message.size());
+
+				cb(std::move(message));
+			});
+		} catch (dictos::error::Exception &e) {
+			LOG(stream, __FUNCTION__, "error re-raise", e);
+			throw;
+		} catch (std::exception &e) {
+			DCORE_ERR_THROW(net::error::NetException, "Failed to read:", e);
+		}
+	}
+
 	void connect(ConnectCallback cb)
 	{
 		try {
@@ -104,23 +193,31 @@ public:
 
 	void write(memory::Heap payload, WriteCallback cb = WriteCallback())
 	{
-		try {
-			LOGT(stream, "Writing:", payload.size());
+		buffer::Segments segments;
+		segments.emplace_back(std::move(payload));
+		write(std::move(segments), std::move(cb));
+	}
 
-			auto size = payload.size();
+	/**
+	 * Writes the segments back to back as one payload without copying them together first.
+	 * Writes are queued and go out one at a time, on byte stream transports everything that
+	 * queued up while the previous write was in flight goes out together in one gathered write.
+	 */
+	void write(buffer::Segments segments, WriteCallback cb = WriteCallback())
+	{
+		try {
+			LOGT(stream, "Writing:", buffer::totalSize(segments), "in", segments.size(), "segments");
 
-			m_protocol->write(std::move(payload),
-				[this,size,stream = getThisPtr(),cb = std::move(cb)]() {
+			m_writeStats.queued.fetch_add(1, std::memory_order_relaxed);
 
-					// Now that we've sent it report it to stats
-					SendRate.report(size);
+			auto guard = m_writeLock.lock();
+			m_writeQueue.push_back({std::move(segments), std::move(cb)});
+			if (m_writing)
+				return;
+			m_writing = true;
+			guard.unlock();
 
-					// Write callbacks are optional
-					if (cb) {
-						cb();
-					}
-				}
-			);
+			flushWrites();
 		} catch (dictos::error::Exception &e) {
 			LOG(stream, __FUNCTION__, "error re-raise", e);
 			throw;
@@ -177,7 +274,18 @@ public:
 			std::rethrow_exception(m_lastError);
 	}
 
+	bool messageOriented() const noexcept { return m_protocol->messageOriented(); }
+
+	// Sends messages as binary frames on transports that distinguish them (websockets)
+	void binary(bool enable) { m_protocol->binary(enable); }
+
+	// Offers a replay safe payload as early data for the connect, see AbstractProtocol::writeEarly
+	bool writeEarly(memory::HeapView payload) { return m_protocol->writeEarly(payload); }
+	bool earlyDataAccepted() const noexcept { return m_protocol->earlyDataAccepted(); }
+
 	EventMachine &eventMachine() { return m_protocol->eventMachine(); }
+	boost::asio::io_context & ioContext() const noexcept { return m_protocol->ioContext(); }
+	uint32_t shard() const noexcept { return m_protocol->shard(); }
 
 	// Error handling is centralized to this public signal for
 	// clients to handle errors centrally as well
@@ -188,12 +296,110 @@ public:
 	mutable util::Throughput SendRate;
 	mutable util::Throughput RecvRate;
 
+	const WriteStats & writeStats() const noexcept { return m_writeStats; }
+
 protected:
 	StreamPtr getThisPtr() const
 	{
 		return const_cast<Stream *>(this)->enable_shared_from_this<Stream>::shared_from_this();
 	}
 
+	struct PendingWrite
+	{
+		buffer::Segments segments;
+		WriteCallback cb;
+	};
+
+	/**
+	 * Sends the next batch from the write queue, re-armed from each write completion
+	 * until the queue drains. Message oriented transports take one write per batch
+	 * so message boundaries are kept.
+	 */
+	void flushWrites()
+	{
+		auto guard = m_writeLock.lock();
+		if (m_writeQueue.empty()) {
+			m_writing = false;
+			return;
+		}
+
+		auto limit = messageOriented() ? 1 : std::max(getOption<uint32_t>("max_coalesced_writes"), 1u);
+
+		buffer::Segments batch;
+		std::vector<WriteCallback> callbacks;
+		while (!m_writeQueue.empty() && callbacks.size() < limit) {
+			auto &pending = m_writeQueue.front();
+			std::move(pending.segments.begin(), pending.segments.end(), std::back_inserter(batch));
+			callbacks.push_back(std::move(pending.cb));
+			m_writeQueue.pop_front();
+		}
+		guard.unlock();
+
+		auto size = buffer::totalSize(batch);
+		auto onWrite = [this,size,stream = getThisPtr(),callbacks = std::move(callbacks)]() {
+			// Now that we've sent it report it to stats
+			SendRate.report(size);
+
+			completeWrites(callbacks);
+			flushWrites();
+		};
+
+		m_writeStats.batches.fetch_add(1, std::memory_order_relaxed);
+		try {
+			if (batch.size() == 1)
+				m_protocol->write(std::move(batch.front()), std::move(onWrite));
+			else
+				m_protocol->write(std::move(batch), std::move(onWrite));
+		} catch (...) {
+			// Let the next write try again rather than wedging the queue
+			abortWrites();
+			throw;
+		}
+	}
+
+	/**
+	 * Runs write callbacks, one that throws gets reported on the error signal and
+	 * doesn't keep the rest, or the queue behind them, from going.
+	 */
+	void completeWrites(std::vector<WriteCallback> &callbacks)
+	{
+		// Write callbacks are optional
+		for (auto &cb : callbacks) {
+			if (!cb)
+				continue;
+
+			try {
+				cb();
+			} catch (dictos::error::Exception &e) {
+				LOG(stream, "Write callback threw:", e);
+				dictos::error::block([&](){ ErrorSig(e, OP::Write, getThisPtr()); });
+			} catch (std::exception &e) {
+				LOG(stream, "Write callback threw:", e);
+			}
+		}
+	}
+
+	/**
+	 * A failed write never completes, so nothing would re-arm the queue. Drops whatever
+	 * is still queued behind it and lets the next write start over. Like the failed
+	 * batch's, the dropped writes' callbacks never run, the failure is what the error
+	 * signal (or the throw) reported and writeStats counts what went down with it.
+	 */
+	void abortWrites()
+	{
+		auto guard = m_writeLock.lock();
+		auto dropped = std::move(m_writeQueue);
+		m_writeQueue.clear();
+		m_writing = false;
+		guard.unlock();
+
+		if (dropped.empty())
+			return;
+
+		LOG(stream, "Dropped", dropped.size(), "queued writes after a failed write");
+		m_writeStats.dropped.fetch_add(dropped.size(), std::memory_order_relaxed);
+	}
+
 	/**
 	 * Called by the protocol on an error.
 	 */
@@ -203,6 +409,9 @@ protected:
 		m_lastError = std::make_exception_ptr(e);
 		guard.release();
 
+		if (operation == OP::Write)
+			abortWrites();
+
 		// Pass it along and grab a strong ref to ourselves along the way
 		LOGT(net, "Protocol reported error:", e, "For operation:", operation);
 		ErrorSig(e, operation, shared_from_this());
@@ -217,7 +426,16 @@ protected:
 				{"private_key_path", file::path(), "Path to client private ke (for client based auth)y"},
 				{"client_cert_file", file::path(), "Path to client cert file key (for client based auth)"},
 				{"cert_chain_file", file::path(), "Path to cert chain file (for peer certificate validation)"},
-				{"verify_peer", true, "Whether to verify the peer" }
+				{"verify_peer", true, "Whether to verify the peer" },
+				{"recv_buffer_size", 65536u, "Size of the receive ring readSome drains the socket into"},
+				{"max_coalesced_writes", 64u, "Most queued writes to gather into a single write on byte stream transports"},
+				{"connect_stagger_ms", 250u, "Head start each connect attempt gets before the next resolved address is tried as well"},
+				{"deflate", false, "Negotiate permessage-deflate on websocket transports"},
+				{"deflate_level", 8u, "Deflate compression level (0-9)"},
+				{"deflate_window_bits", 15u, "Deflate window bits to offer (9-15)"},
+				{"deflate_mem_level", 4u, "Deflate memory level (1-9)"},
+				{"deflate_context_takeover", true, "Keep the compression context between messages"},
+				{"deflate_threshold", 0u, "Messages smaller than this are sent uncompressed (needs boost 1.81+)"}
 			}
 		);
 
@@ -227,6 +445,11 @@ protected:
 	mutable async::MutexLock m_lock;
 	std::exception_ptr m_lastError;
 
+	async::SpinLock m_writeLock;
+	std::deque<PendingWrite> m_writeQueue;
+	bool m_writing = false;
+	WriteStats m_writeStats;
+
 	protocol::ProtocolUPtr m_protocol;
 };
 
@@ -0,0 +1,297 @@
+#pragma once
+
+namespace dictos::net {
+
+/**
+ * The timing wheel runs large numbers of coarse timers (e.g. request deadlines) off a single
+ * asio timer per io context, so scheduling and cancelling one is O(1) with no per timer kernel
+ * or allocator work. Being an execution context service there is one wheel per io context,
+ * which in sharded mode means one per event machine thread.
+ *
+ * It is hierarchical, four levels of 64 slots each. Level 0 slots are one tick wide, each
+ * level up is 64 times coarser, and timers cascade down a level as their time gets close, so
+ * with the default 1ms tick anything up to ~4.6 hours out is tracked exactly. Timers further
+ * out than that are parked in the last level and re-cascade until they are in range.
+ */
+class TimingWheel :
+	public boost::asio::execution_context::service,
+	public config::Context
+{
+public:
+	typedef std::function<void()> Callback;
+	typedef uint64_t TimerId;
+
+	static inline boost::asio::execution_context::id id;
+
+	explicit TimingWheel(boost::asio::io_context &context) :
+		service(context),
+		Context(getSection(), config::Options()),
+		m_timer(context),
+		m_tick(std::chrono::milliseconds(std::max(getOption<uint32_t>("tick_ms"), 1u))),
+		m_start(clock::now())
+	{
+		for (auto &level : m_slots)
+			level.fill(Nil);
+	}
+
+	/**
+	 * Calls cb on the wheel's io context once timeout has passed (rounded up to the
+	 * next tick), the returned id can be used to cancel it until then.
+	 */
+	TimerId schedule(std::chrono::steady_clock::duration timeout, Callback cb)
+	{
+		auto guard = m_lock.lock();
+
+		// An idle wheel has nothing to catch up on, skip straight to now
+		if (!m_count)
+			m_now = currentTick();
+
+		auto ticks = (timeout + m_tick - std::chrono::steady_clock::duration(1)) / m_tick;
+		auto expiry = currentTick() + static_cast<uint64_t>(std::max<int64_t>(ticks, 1));
+
+		uint32_t index;
+		if (!m_freeEntries.empty()) {
+			index = m_freeEntries.back();
+			m_freeEntries.pop_back();
+		} else {
+			index = static_cast<uint32_t>(m_entries.size());
+			m_entries.emplace_back();
+		}
+
+		auto &entry = m_entries[index];
+		entry.expiry = expiry;
+		entry.cb = std::move(cb);
+		link(index);
+		m_count++;
+
+		armLocked(guard);
+		return (static_cast<uint64_t>(entry.generation) << 32) | index;
+	}
+
+	/**
+	 * Cancels a pending timer, returns false if it already fired or was cancelled.
+	 */
+	bool cancel(TimerId timerId)
+	{
+		auto index = static_cast<uint32_t>(timerId);
+		auto generation = static_cast<uint32_t>(timerId >> 32);
+
+		auto guard = m_lock.lock();
+		if (index >= m_entries.size() || m_entries[index].generation != generation || !m_entries[index].cb)
+			return false;
+
+		unlink(index);
+		release(index);
+		return true;
+	}
+
+	// Number of timers currently pending
+	size_t size() const
+	{
+		auto guard = m_lock.lock();
+		return m_count;
+	}
+
+	std::chrono::steady_clock::duration tick() const noexcept { return m_tick; }
+
+protected:
+	using clock = std::chrono::steady_clock;
+
+	static constexpr uint32_t Levels = 4;
+	static constexpr uint32_t SlotBits = 6;
+	static constexpr uint32_t Slots = 1u << SlotBits;
+	static constexpr uint32_t Nil = std::numeric_limits<uint32_t>::max();
+
+	/**
+	 * Timers live in a slab and are chained into their slot through indices,
+	 * the generation tells a recycled entry apart from the one an id was for.
+	 */
+	struct Entry
+	{
+		uint64_t expiry = 0;
+		uint32_t prev = Nil, next = Nil;
+		uint32_t generation = 0;
+		uint8_t level = 0, slot = 0;
+		Callback cb;
+	};
+
+	void shutdown() override
+	{
+		auto guard = m_lock.lock();
+		m_entries.clear();
+		m_freeEntries.clear();
+		for (auto &level : m_slots)
+			level.fill(Nil);
+		m_count = 0;
+	}
+
+	uint64_t currentTick() const
+	{
+		return static_cast<uint64_t>((clock::now() - m_start) / m_tick);
+	}
+
+	void link(uint32_t index)
+	{
+		auto &entry = m_entries[index];
+		auto delta = entry.expiry > m_now ? entry.expiry - m_now : 0;
+
+		// Find the finest level whose span covers the delta, clamping to the last level
+		uint32_t level = 0;
+		while (level < Levels - 1 && delta >= (uint64_t(1) << (SlotBits * (level + 1))))
+			level++;
+
+		auto expiry = std::min(entry.expiry, m_now + (uint64_t(1) << (SlotBits * Levels)) - 1);
+		entry.level = static_cast<uint8_t>(level);
+		entry.slot = static_cast<uint8_t>((expiry >> (SlotBits * level)) & (Slots - 1));
+
+		auto &head = m_slots[entry.level][entry.slot];
+		entry.prev = Nil;
+		entry.next = head;
+		if (head != Nil)
+			m_entries[head].prev = index;
+		head = index;
+	}
+
+	void unlink(uint32_t index)
+	{
+		auto &entry = m_entries[index];
+		if (entry.prev != Nil)
+			m_entries[entry.prev].next = entry.next;
+		else
+			m_slots[entry.level][entry.slot] = entry.next;
+		if (entry.next != Nil)
+			m_entries[entry.next].prev = entry.prev;
+		entry.prev = entry.next = Nil;
+	}
+
+	void release(uint32_t index)
+	{
+		auto &entry = m_entries[index];
+		entry.cb = nullptr;
+		entry.generation++;
+		m_freeEntries.push_back(index);
+		m_count--;
+	}
+
+	// Detaches a whole slot, returning the head of its chain
+	uint32_t detach(uint32_t level, uint32_t slot)
+	{
+		auto head = m_slots[level][slot];
+		m_slots[level][slot] = Nil;
+		return head;
+	}
+
+	/**
+	 * Moves the wheel up to the current tick, cascading coarser slots down as their
+	 * turn comes, and hands back the callbacks of everything that expired.
+	 */
+	std::vector<Callback> advance()
+	{
+		std::vector<Callback> expired;
+
+		auto target = currentTick();
+		while (m_now < target) {
+			m_now++;
+
+			for (uint32_t level = 1; level < Levels; level++) {
+				if (m_now & ((uint64_t(1) << (SlotBits * level)) - 1))
+					break;
+
+				for (auto index = detach(level, (m_now >> (SlotBits * level)) & (Slots - 1)); index != Nil; ) {
+					auto next = m_entries[index].next;
+					link(index);
+					index = next;
+				}
+			}
+
+			for (auto index = detach(0, m_now & (Slots - 1)); index != Nil; ) {
+				auto next = m_entries[index].next;
+				if (m_entries[index].expiry <= m_now) {
+					expired.push_back(std::move(m_entries[index].cb));
+					release(index);
+				} else {
+					link(index);
+				}
+				index = next;
+			}
+		}
+
+		return expired;
+	}
+
+	/**
+	 * The next tick worth waking up for, the closest busy level 0 slot or
+	 * otherwise the next cascade.
+	 */
+	uint64_t nextWake() const
+	{
+		for (uint64_t tick = m_now + 1; ; tick++) {
+			if (m_slots[0][tick & (Slots - 1)] != Nil || !(tick & (Slots - 1)))
+				return tick;
+		}
+	}
+
+	template<class Guard>
+	void armLocked(Guard &guard)
+	{
+		if (!m_count)
+			return;
+
+		auto wake = nextWake();
+		if (m_armed && m_wake <= wake)
+			return;
+
+		m_armed = true;
+		m_wake = wake;
+		m_timer.expires_at(m_start + m_tick * wake);
+		m_timer.async_wait([this](boost::system::error_code ec) {
+			if (ec == boost::asio::error::operation_aborted)
+				return;
+			onTick();
+		});
+	}
+
+	void onTick()
+	{
+		auto guard = m_lock.lock();
+		m_armed = false;
+		auto expired = advance();
+		armLocked(guard);
+		guard.unlock();
+
+		for (auto &cb : expired) {
+			try {
+				cb();
+			} catch (dictos::error::Exception &e) {
+				LOG(ERROR, "Timer callback threw:", e);
+			}
+		}
+	}
+
+	static const config::Section & getSection()
+	{
+		if (auto section = config::Sections::find("net_timing_wheel"))
+			return *section;
+
+		static config::Section section("net_timing_wheel", {
+				{"tick_ms", 1u, "Resolution of the timing wheel, timers fire on the first tick after they are due"},
+			}
+		);
+
+		return section;
+	}
+
+	mutable async::SpinLock m_lock;
+	boost::asio::steady_timer m_timer;
+	clock::duration m_tick;
+	clock::time_point m_start;
+	uint64_t m_now = 0;
+	uint64_t m_wake = 0;
+	bool m_armed = false;
+	size_t m_count = 0;
+	std::array<std::array<uint32_t, Slots>, Levels> m_slots;
+	std::vector<Entry> m_entries;
+	std::vector<uint32_t> m_freeEntries;
+};
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+namespace dictos::net::affinity {
+
+/**
+ * Parses a linux style cpu list (e.g. "0-3,8,10-11") into the individual
+ * cpu indexes it names, in the order they were listed.
+ */
+inline std::vector<uint32_t> parseCpuList(const std::string_view &list)
+{
+	std::vector<uint32_t> cpus;
+
+	std::string_view remaining = list;
+	while (!remaining.empty()) {
+		auto comma = remaining.find(',');
+		auto range = remaining.substr(0, comma);
+		remaining = comma == std::string_view::npos ? std::string_view() : remaining.substr(comma + 1);
+
+		// Tolerate whitespace and trailing newlines (sysfs files have them)
+		while (!range.empty() && std::isspace(static_cast<unsigned char>(range.front())))
+			range.remove_prefix(1);
+		while (!range.empty() && std::isspace(static_cast<unsigned char>(range.back())))
+			range.remove_suffix(1);
+		if (range.empty())
+			continue;
+
+		auto dash = range.find('-');
+		auto first = string::toNumber<uint32_t>(std::string(range.substr(0, dash)));
+		auto last = dash == std::string_view::npos ? first : string::toNumber<uint32_t>(std::string(range.substr(dash + 1)));
+		if (last < first)
+			DCORE_THROW(InvalidArgument, "Invalid cpu range:", range);
+
+		for (auto cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+
+	return cpus;
+}
+
+/**
+ * Returns the cpus which belong to the given numa node, or an empty list
+ * if the node does not exist (or the platform has no notion of nodes).
+ */
+inline std::vector<uint32_t> nodeCpus(int32_t node)
+{
+#if defined(__linux__)
+	std::ifstream file(string::toString("/sys/devices/system/node/node", node, "/cpulist"));
+	std::string list;
+	if (file && std::getline(file, list))
+		return parseCpuList(list);
+#endif
+	return {};
+}
+
+/**
+ * Pins the calling thread to a single cpu, returns false if the
+ * platform refused.
+ */
+inline bool pinThread(uint32_t cpu)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Sets the calling threads memory policy to prefer the given numa node, from
+ * here on out pages this thread first touches (its buffers) come from node
+ * local memory whenever the node has any to spare.
+ */
+inline bool bindMemory(int32_t node)
+{
+#if defined(__linux__)
+	if (node < 0 || node >= static_cast<int32_t>(sizeof(unsigned long) * 8))
+		return false;
+
+	// The kernel drops the last bit of maxnode (libnuma passes one extra as well), without
+	// the + 1 the highest node in the mask would be ignored
+	unsigned long nodeMask = 1ul << node;
+	return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8 + 1) == 0;
+#else
+	return false;
+#endif
+}
+
+}
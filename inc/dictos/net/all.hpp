@@ -12,8 +12,11 @@ namespace dictos::net {
 #include "dictos/net/uuid_json.hpp"
 #include "dictos/net/throughput_json.hpp"
 #include "dictos/net/buffer/all.hpp"
+#include "dictos/net/JsonScanner.hpp"
 #include "dictos/net/Command.hpp"
+#include "dictos/net/affinity.hpp"
 #include "dictos/net/EventMachine.hpp"
+#include "dictos/net/TimingWheel.hpp"
 #include "dictos/net/api.hpp"
 #include "dictos/net/types.hpp"
 #include "dictos/net/error/all.hpp"
@@ -26,8 +29,12 @@ namespace dictos::net {
 }
 
 #include "dictos/net/Address.h"
+#include "dictos/net/Resolver.hpp"
 #include "dictos/net/protocol/all2.hpp"
 #include "dictos/net/Address.hpp"
 #include "dictos/net/Stream.hpp"
+#include "dictos/net/Framer.hpp"
+#include "dictos/net/InflightTable.hpp"
+#include "dictos/net/Router.hpp"
 #include "dictos/net/Session.hpp"
 #include "dictos/net/allocate.hpp"
@@ -0,0 +1,76 @@
+#pragma once
+
+namespace dictos::net::buffer {
+
+/**
+ * Owns one complete received message (e.g. a websocket message), handed to the reader
+ * as is instead of being copied out or viewed in place. The storage is a beast flat buffer
+ * whose memory comes from the pool, and once the message is destroyed the buffer goes back
+ * on a per thread free list with its capacity intact for the next read to fill. Buffers one
+ * outsized message grew past MaxRetained are freed instead, so a burst of big messages
+ * doesn't stay pinned in every thread's free list.
+ */
+class Message
+{
+public:
+	using Storage = boost::beast::basic_flat_buffer<PoolAllocator<char>>;
+
+	Message() = default;
+	Message(Message &&) = default;
+	Message & operator = (Message &&) = default;
+
+	~Message()
+	{
+		if (!m_storage)
+			return;
+
+		auto &freeList = cache();
+		if (freeList.size() < MaxCached && m_storage->capacity() <= MaxRetained) {
+			m_storage->clear();
+			freeList.push_back(std::move(m_storage));
+		}
+	}
+
+	/**
+	 * Returns an empty message to read into, recycled if this thread has one spare.
+	 */
+	static Message acquire()
+	{
+		Message message;
+		auto &freeList = cache();
+		if (!freeList.empty()) {
+			message.m_storage = std::move(freeList.back());
+			freeList.pop_back();
+		} else {
+			message.m_storage = std::make_unique<Storage>();
+		}
+		return message;
+	}
+
+	// The flat buffer the protocol reads into
+	Storage & storage() { return *m_storage; }
+
+	Size size() const noexcept { return m_storage ? m_storage->size() : 0; }
+
+	const std::byte *begin() const { return m_storage ? static_cast<const std::byte *>(m_storage->data().data()) : nullptr; }
+	const std::byte *end() const { return begin() + size(); }
+
+	memory::HeapView view() const { return memory::HeapView(begin(), size()); }
+	operator memory::HeapView () const { return view(); }
+
+protected:
+	static constexpr size_t MaxCached = 64;
+	static constexpr size_t MaxRetained = 1024 * 1024;
+
+	static std::vector<std::unique_ptr<Storage>> & cache()
+	{
+		// Our storage goes back to the pool as we get destroyed at thread exit
+		Pool::initThread();
+		static thread_local std::vector<std::unique_ptr<Storage>> cache;
+		return cache;
+	}
+
+	std::unique_ptr<Storage> m_storage;
+};
+
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+namespace dictos::net::buffer {
+
+/**
+ * The pool recycles i/o buffers so the hot read/write paths stop going through malloc and free
+ * on every operation. Requests are rounded up to a power of two size class and served from a
+ * per thread free list for that class, returned blocks go back on the free list of whichever
+ * thread releases them, up to a cap per class after which they are actually freed. Requests
+ * above the largest class bypass the pool entirely.
+ *
+ * With huge_pages enabled, blocks of 64kb and up are backed by huge pages (explicit hugetlb
+ * pages if the system has any reserved, transparent ones otherwise). Size classes below 2mb are
+ * carved out of shared 2mb arenas, a hugetlb mapping can only be unmapped in whole huge pages
+ * and transparent huge pages only ever back an aligned 2mb range, so mapping them one by one
+ * would either leak on free or silently fall back to small pages.
+ */
+class Pool
+{
+public:
+	struct Stats
+	{
+		std::atomic<uint64_t> hits = {0};		// Served from a free list
+		std::atomic<uint64_t> misses = {0};		// Had to allocate a new block
+		std::atomic<uint64_t> oversize = {0};	// Too large for any size class
+		std::atomic<uint64_t> recycled = {0};	// Returned to a free list
+		std::atomic<uint64_t> dropped = {0};	// Returned while the free list was full, so freed
+		std::atomic<uint64_t> arenas = {0};		// Huge page arenas carved into blocks
+	};
+
+	static void * allocate(size_t size)
+	{
+		if (!size)
+			return nullptr;
+
+		auto sizeClass = classOf(size);
+		if (sizeClass < 0) {
+			stats().oversize.fetch_add(1, std::memory_order_relaxed);
+			return allocateBlock(size);
+		}
+
+		auto &freeList = cache().freeLists[sizeClass];
+		if (!freeList.empty()) {
+			auto block = freeList.back();
+			freeList.pop_back();
+			stats().hits.fetch_add(1, std::memory_order_relaxed);
+			return block;
+		}
+
+		stats().misses.fetch_add(1, std::memory_order_relaxed);
+		return allocateBlock(classSize(sizeClass));
+	}
+
+	static void release(void *block, size_t size) noexcept
+	{
+		if (!block)
+			return;
+
+		auto sizeClass = classOf(size);
+		if (sizeClass < 0)
+			return freeBlock(block, size);
+
+		auto &freeList = cache().freeLists[sizeClass];
+		if (freeList.size() < settings().cachedPerClass) {
+			freeList.push_back(block);
+			stats().recycled.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		stats().dropped.fetch_add(1, std::memory_order_relaxed);
+		freeBlock(block, classSize(sizeClass));
+	}
+
+	static Stats & stats() noexcept
+	{
+		static Stats stats;
+		return stats;
+	}
+
+	/**
+	 * Sets up the calling thread's free lists. Thread locals are destroyed in the reverse
+	 * order they were constructed in, so a thread local that holds on to pooled memory has
+	 * to call this before constructing itself for the free lists to still be around when
+	 * it hands that memory back.
+	 */
+	static void initThread() { cache(); }
+
+protected:
+	static constexpr uint32_t MaxClasses = 32;
+	static constexpr size_t HugePageThreshold = 64 * 1024;
+	static constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+	struct Settings
+	{
+		uint32_t minShift;
+		uint32_t classCount;
+		size_t cachedPerClass;
+		bool hugePages;
+	};
+
+	/**
+	 * The free lists for one thread, anything still cached when the
+	 * thread exits gets freed with it.
+	 */
+	struct Cache
+	{
+		~Cache()
+		{
+			for (uint32_t sizeClass = 0; sizeClass < settings().classCount; sizeClass++) {
+				for (auto block : freeLists[sizeClass])
+					freeBlock(block, classSize(sizeClass));
+			}
+		}
+
+		std::array<std::vector<void *>, MaxClasses> freeLists;
+	};
+
+	static Cache & cache()
+	{
+		static thread_local Cache cache;
+		return cache;
+	}
+
+	/**
+	 * Blocks carved out of huge page arenas, keyed by block size. Arenas live as long as the
+	 * process, blocks freed back to them wait here for the next thread that needs one.
+	 */
+	struct Arenas
+	{
+		async::SpinLock lock;
+		std::map<size_t, std::vector<void *>> spare;
+	};
+
+	static Arenas & arenas()
+	{
+		static Arenas arenas;
+		return arenas;
+	}
+
+	static int32_t classOf(size_t size) noexcept
+	{
+		auto &config = settings();
+
+		uint32_t shift = config.minShift;
+		while (shift < 63 && (size_t(1) << shift) < size)
+			shift++;
+
+		auto sizeClass = shift - config.minShift;
+		return sizeClass < config.classCount ? static_cast<int32_t>(sizeClass) : -1;
+	}
+
+	static size_t classSize(int32_t sizeClass) noexcept
+	{
+		return size_t(1) << (settings().minShift + sizeClass);
+	}
+
+	static void * allocateBlock(size_t size)
+	{
+#if defined(__linux__)
+		if (settings().hugePages && size >= HugePageThreshold) {
+			if (carved(size))
+				return allocateCarved(size);
+			return mapHuge(hugeLength(size));
+		}
+#endif
+		if (auto block = std::malloc(size))
+			return block;
+		throw std::bad_alloc();
+	}
+
+	static void freeBlock(void *block, size_t size) noexcept
+	{
+#if defined(__linux__)
+		if (settings().hugePages && size >= HugePageThreshold) {
+			if (carved(size))
+				return freeCarved(block, size);
+			::munmap(block, hugeLength(size));
+			return;
+		}
+#endif
+		std::free(block);
+	}
+
+#if defined(__linux__)
+	// Sizes that tile a huge page exactly, the power of two classes below 2mb all do
+	static bool carved(size_t size) noexcept { return size < HugePageSize && HugePageSize % size == 0; }
+
+	static size_t hugeLength(size_t size) noexcept { return (size + HugePageSize - 1) & ~(HugePageSize - 1); }
+
+	static void * allocateCarved(size_t size)
+	{
+		auto &shared = arenas();
+		{
+			auto guard = shared.lock.lock();
+			auto &spare = shared.spare[size];
+			if (!spare.empty()) {
+				auto block = spare.back();
+				spare.pop_back();
+				return block;
+			}
+		}
+
+		// Keep the first block for the caller and put the rest of a fresh arena up for grabs
+		auto arena = static_cast<std::byte *>(mapHuge(HugePageSize));
+		stats().arenas.fetch_add(1, std::memory_order_relaxed);
+
+		auto guard = shared.lock.lock();
+		auto &spare = shared.spare[size];
+		for (auto offset = size; offset < HugePageSize; offset += size)
+			spare.push_back(arena + offset);
+		return arena;
+	}
+
+	static void freeCarved(void *block, size_t size) noexcept
+	{
+		try {
+			auto &shared = arenas();
+			auto guard = shared.lock.lock();
+			shared.spare[size].push_back(block);
+		} catch (std::exception &e) {
+			LOG(net, "Failed to return a block to its huge page arena:", e);
+		}
+	}
+
+	/**
+	 * Maps length bytes, a multiple of the huge page size, backed by hugetlb pages if any
+	 * are reserved. Otherwise the mapping is over sized by a page so it can be trimmed down
+	 * to an aligned range transparent huge pages can back. Either way it is unmapped with
+	 * the same length.
+	 */
+	static void * mapHuge(size_t length)
+	{
+		auto block = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (block != MAP_FAILED)
+			return block;
+
+		auto raw = ::mmap(nullptr, length + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED)
+			throw std::bad_alloc();
+
+		auto start = reinterpret_cast<uintptr_t>(raw);
+		auto aligned = (start + HugePageSize - 1) & ~uintptr_t(HugePageSize - 1);
+		if (auto head = aligned - start)
+			::munmap(raw, head);
+		if (auto tail = start + HugePageSize - aligned)
+			::munmap(reinterpret_cast<void *>(aligned + length), tail);
+
+		block = reinterpret_cast<void *>(aligned);
+		::madvise(block, length, MADV_HUGEPAGE);
+		return block;
+	}
+#endif
+
+	static const Settings & settings()
+	{
+		static const Settings settings = []() {
+			config::Context context(getSection(), config::Options());
+
+			auto minClass = context.getOption<uint32_t>("min_class");
+			auto maxClass = context.getOption<uint32_t>("max_class");
+
+			Settings result;
+			result.minShift = 0;
+			while ((1u << result.minShift) < minClass)
+				result.minShift++;
+
+			auto maxShift = result.minShift;
+			while ((1u << maxShift) < maxClass)
+				maxShift++;
+
+			result.classCount = std::min(maxShift - result.minShift + 1, MaxClasses);
+			result.cachedPerClass = context.getOption<uint32_t>("cached_per_class");
+			result.hugePages = context.getOption<bool>("huge_pages");
+			return result;
+		}();
+
+		return settings;
+	}
+
+	static const config::Section & getSection()
+	{
+		if (auto section = config::Sections::find("net_buffer_pool"))
+			return *section;
+
+		static config::Section section("net_buffer_pool", {
+				{"min_class", 256u, "Smallest size class, smaller requests are rounded up to it"},
+				{"max_class", 1048576u, "Largest size class, larger requests bypass the pool"},
+				{"cached_per_class", 64u, "Number of free blocks each thread keeps per size class"},
+				{"huge_pages", false, "Back blocks of 64kb and up with huge pages"},
+			}
+		);
+
+		return section;
+	}
+};
+
+/**
+ * A buffer drawn from the pool, it goes back to the pool when it is destroyed.
+ *
+ * Ownership is unique rather than reference counted, pooled reads (readPooled) move the
+ * buffer into their callback which can keep it, or move it on, for as long as it likes.
+ */
+class PoolBuffer
+{
+public:
+	PoolBuffer() = default;
+
+	explicit PoolBuffer(size_t size) :
+		m_data(static_cast<std::byte *>(Pool::allocate(size))), m_size(size)
+	{
+	}
+
+	PoolBuffer(const PoolBuffer &) = delete;
+	PoolBuffer & operator = (const PoolBuffer &) = delete;
+
+	PoolBuffer(PoolBuffer &&buff) noexcept
+	{
+		operator = (std::move(buff));
+	}
+
+	PoolBuffer & operator = (PoolBuffer &&buff) noexcept
+	{
+		if (this == &buff)
+			return *this;
+
+		Pool::release(m_data, m_size);
+		m_data = buff.m_data;
+		m_size = buff.m_size;
+		buff.m_data = nullptr;
+		buff.m_size = 0;
+		return *this;
+	}
+
+	~PoolBuffer()
+	{
+		Pool::release(m_data, m_size);
+	}
+
+	Size size() const noexcept { return m_size; }
+
+	template<class T>
+	T cast() const { return reinterpret_cast<T>(m_data); }
+
+	const std::byte *begin() const { return m_data; }
+	const std::byte *end() const { return m_data + m_size; }
+
+	std::byte *begin() { return m_data; }
+	std::byte *end() { return m_data + m_size; }
+
+	operator memory::HeapView () const { return memory::HeapView(m_data, m_size); }
+
+protected:
+	std::byte *m_data = nullptr;
+	size_t m_size = 0;
+};
+
+/**
+ * Std allocator adapter so control blocks (e.g. from allocate_shared) come from the pool too.
+ */
+template<class T>
+class PoolAllocator
+{
+public:
+	typedef T value_type;
+
+	PoolAllocator() = default;
+
+	template<class U>
+	PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+	T * allocate(size_t count) { return static_cast<T *>(Pool::allocate(count * sizeof(T))); }
+	void deallocate(T *ptr, size_t count) noexcept { Pool::release(ptr, count * sizeof(T)); }
+
+	template<class U>
+	bool operator == (const PoolAllocator<U> &) const noexcept { return true; }
+
+	template<class U>
+	bool operator != (const PoolAllocator<U> &) const noexcept { return false; }
+};
+
+}
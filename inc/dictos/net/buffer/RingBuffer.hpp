@@ -0,0 +1,100 @@
+#pragma once
+
+namespace dictos::net::buffer {
+
+/**
+ * A fixed capacity byte ring, used by the protocols to receive whatever the kernel has
+ * and hand it out in pieces. The storage is drawn from the pool on first use, capacity
+ * is rounded up to a power of two so positions wrap with a mask. Once drained the ring
+ * rewinds to the start so the next receive gets the whole capacity in one piece.
+ */
+class RingBuffer
+{
+public:
+	RingBuffer() = default;
+
+	explicit RingBuffer(size_t capacity)
+	{
+		reserve(capacity);
+	}
+
+	/**
+	 * Sizes the storage, only takes effect while the ring is still unallocated.
+	 */
+	void reserve(size_t capacity)
+	{
+		if (m_storage.size())
+			return;
+
+		size_t rounded = 1;
+		while (rounded < capacity)
+			rounded <<= 1;
+
+		m_storage = PoolBuffer(rounded);
+		m_mask = rounded - 1;
+	}
+
+	size_t capacity() const noexcept { return m_storage.size(); }
+	size_t size() const noexcept { return m_tail - m_head; }
+	bool empty() const noexcept { return m_tail == m_head; }
+
+	/**
+	 * Returns the contiguous run of buffered bytes at the head, at most maxSize
+	 * of them, a wrapped ring returns the rest on the next call.
+	 */
+	memory::HeapView readable(size_t maxSize = std::numeric_limits<size_t>::max()) const noexcept
+	{
+		auto offset = m_head & m_mask;
+		auto run = std::min({size(), capacity() - offset, maxSize});
+		return memory::HeapView(m_storage.begin() + offset, run);
+	}
+
+	/**
+	 * Returns the contiguous free space at the tail for the next receive to land in.
+	 */
+	boost::asio::mutable_buffer writable() noexcept
+	{
+		auto offset = m_tail & m_mask;
+		auto run = std::min(capacity() - size(), capacity() - offset);
+		return boost::asio::mutable_buffer(m_storage.begin() + offset, run);
+	}
+
+	// Marks count bytes written to the writable region as buffered
+	void commit(size_t count) noexcept
+	{
+		DCORE_ASSERT(size() + count <= capacity());
+		m_tail += count;
+	}
+
+	// Drops count bytes from the head
+	void consume(size_t count) noexcept
+	{
+		DCORE_ASSERT(count <= size());
+		m_head += count;
+		if (m_head == m_tail)
+			m_head = m_tail = 0;
+	}
+
+	/**
+	 * Copies up to size buffered bytes out to dest and consumes them,
+	 * returns how many were copied.
+	 */
+	size_t read(std::byte *dest, size_t size) noexcept
+	{
+		size_t copied = 0;
+		while (copied < size && !empty()) {
+			auto run = readable(size - copied);
+			std::memcpy(dest + copied, run.begin(), run.size());
+			consume(run.size());
+			copied += run.size();
+		}
+		return copied;
+	}
+
+protected:
+	PoolBuffer m_storage;
+	size_t m_mask = 0;
+	size_t m_head = 0, m_tail = 0;
+};
+
+}
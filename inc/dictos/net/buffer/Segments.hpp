@@ -0,0 +1,31 @@
+#pragma once
+
+namespace dictos::net::buffer {
+
+/**
+ * A payload made of several separately allocated pieces (e.g. a header and a body),
+ * written out in order as one buffer sequence without flattening them first.
+ */
+using Segments = std::vector<memory::Heap>;
+
+inline Size totalSize(const Segments &segments) noexcept
+{
+	Size size = 0;
+	for (auto &segment : segments)
+		size += segment.size();
+	return size;
+}
+
+/**
+ * Describes the segments as an asio buffer sequence, the segments must outlive it.
+ */
+inline std::vector<boost::asio::const_buffer> toBuffers(const Segments &segments)
+{
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(segments.size());
+	for (auto &segment : segments)
+		buffers.emplace_back(segment.begin(), segment.size());
+	return buffers;
+}
+
+}
@@ -2,12 +2,16 @@
 
 namespace dictos::net::buffer {
 
+/**
+ * Shares ownership of a buffer across async operations, the shared state
+ * itself is allocated from the buffer pool.
+ */
 template<class BufferType>
 class SharedBuffer
 {
 public:
 	SharedBuffer(BufferType buff) :
-		m_buff(std::make_shared<BufferType>(std::move(buff)))
+		m_buff(std::allocate_shared<BufferType>(PoolAllocator<BufferType>(), std::move(buff)))
 	{
 	}
 
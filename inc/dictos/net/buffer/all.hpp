@@ -1 +1,5 @@
+#include "dictos/net/buffer/Pool.hpp"
+#include "dictos/net/buffer/RingBuffer.hpp"
+#include "dictos/net/buffer/Message.hpp"
 #include "dictos/net/buffer/SharedBuffer.hpp"
+#include "dictos/net/buffer/Segments.hpp"
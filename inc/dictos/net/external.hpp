@@ -1,3 +1,22 @@
 #include <boost/asio.hpp>
 #include <nlohmann/json.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/beast/core.hpp>
+#include <fstream>
+#include <filesystem>
+#include <charconv>
+#include <numeric>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/mempolicy.h>
+#endif
@@ -16,7 +16,15 @@ public:
 	// Define the well known op callback signatures, they are slightly different then
 	// what the stream wrapper exposes
 	typedef std::function<void()> AcceptCallback;
+
+	// An exact size read hands over an owned heap, partial reads (readSome) a view that is
+	// only valid for the duration of the callback
 	typedef std::function<void(memory::HeapView)> ReadCallback;
+
+	// An exact size read into a block drawn from the pool, the callback owns it and the block
+	// goes back to the pool once the callback (or whoever it moves it on to) destroys it
+	typedef std::function<void(buffer::PoolBuffer)> PooledReadCallback;
+	typedef std::function<void(buffer::Message)> MessageCallback;
 	typedef std::function<void()> ConnectCallback;
 	typedef std::function<void()> WriteCallback;
 	typedef std::function<void(const dictos::error::Exception &, OP)> ErrorCallback;
@@ -25,11 +33,15 @@ public:
 		m_config(config),
 	   	m_localAddress(std::move(addr)),
 	   	m_ecb(std::move(ecb)),
-		m_em(em)
+		m_em(em),
+		m_shard(em.acquireShard())
 	{
 	}
 
-	virtual ~AbstractProtocol() = default;
+	virtual ~AbstractProtocol()
+	{
+		m_em.releaseShard(m_shard);
+	}
 
 	// Server accept/listen/bind
 	virtual void accept(ProtocolUPtr &newProtocol, AcceptCallback cb) = 0;
@@ -44,10 +56,80 @@ public:
 	virtual void read(Size size, ReadCallback cb) const = 0;
 	virtual void write(memory::Heap payload, WriteCallback cb) = 0;
 
+	/**
+	 * Writes the segments in order as a single payload. Protocols that can hand a buffer
+	 * sequence to the socket override this, by default the segments get flattened.
+	 */
+	virtual void write(buffer::Segments segments, WriteCallback cb)
+	{
+		memory::Heap payload(buffer::totalSize(segments));
+		Size offset = 0;
+		for (auto &segment : segments) {
+			std::memcpy(payload.begin() + offset, segment.begin(), segment.size());
+			offset += segment.size();
+		}
+		write(std::move(payload), std::move(cb));
+	}
+
+	/**
+	 * Completes with whatever has arrived, at most maxSize bytes, the view is only valid
+	 * for the duration of the callback. Message based protocols already hand out a whole
+	 * message per read so by default this is just a read.
+	 */
+	virtual void readSome(Size maxSize, ReadCallback cb) const
+	{
+		read(maxSize, std::move(cb));
+	}
+
+	/**
+	 * Like read but the buffer comes from the pool, protocols that read straight into
+	 * the socket override this, by default the read gets copied into a pooled block.
+	 */
+	virtual void readPooled(Size size, PooledReadCallback cb) const
+	{
+		read(size, [cb = std::move(cb)](memory::HeapView data) {
+			buffer::PoolBuffer result(data.size());
+			std::memcpy(result.begin(), data.begin(), data.size());
+			cb(std::move(result));
+		});
+	}
+
+	/**
+	 * Reads the next whole message and hands ownership of it to the callback,
+	 * only message oriented protocols support this.
+	 */
+	virtual void readMessage(MessageCallback cb) const
+	{
+		DCORE_THROW(RuntimeError, "Message reads are not supported on a byte stream protocol");
+	}
+
+	// Whether messages are sent as binary rather than text, for transports that tell the two apart
+	virtual void binary(bool enable) {}
+
+	// True if the transport delimits messages itself, so each read is one whole message
+	virtual bool messageOriented() const noexcept { return false; }
+
+	/**
+	 * Hands over (a copy of) a payload to try sending as tls 1.3 early data with the upcoming
+	 * connect, where the resumed session allows it. Returns false if the protocol doesn't do
+	 * early data or already holds some. Nothing is sent otherwise, once connected the caller
+	 * writes the payload itself unless earlyDataAccepted. The payload must be safe to replay,
+	 * i.e. idempotent.
+	 */
+	virtual bool writeEarly(memory::HeapView payload) { return false; }
+
+	// Whether the server took the early data handed to writeEarly, known once connected
+	virtual bool earlyDataAccepted() const noexcept { return false; }
+
 	Address getLocalAddress() const { return m_localAddress; }
 	Address getRemoteAddress() const { return m_localAddress; }
 
 	EventMachine & eventMachine() { return m_em; }
+
+	// The shard (and thus the io context) this protocol is pinned to for its lifetime
+	uint32_t shard() const noexcept { return m_shard; }
+	boost::asio::io_context & ioContext() const noexcept { return m_em.context(m_shard); }
+
 protected:
 
 	/**
@@ -69,6 +151,125 @@ protected:
 		return false;
 	}
 
+	/**
+	 * The endpoint to listen on. A host name gets resolved right here (blocking) as binding
+	 * only happens when a listener is set up, the first address it resolves to is used.
+	 */
+	boost::asio::ip::tcp::endpoint listenEndpoint() const
+	{
+		if (!m_localAddress.named())
+			return {m_localAddress.ipAddress(), m_localAddress.port()};
+
+		boost::system::error_code ec;
+		boost::asio::ip::tcp::resolver resolver(ioContext());
+		auto results = resolver.resolve(m_localAddress.host(), string::toString(m_localAddress.port()),
+			boost::asio::ip::resolver_base::passive, ec);
+		if (ec || results.empty())
+			DCORE_THROW(RuntimeError, "Failed to resolve listen address:", m_localAddress, ec ? ec.message() : "no addresses");
+		return results.begin()->endpoint();
+	}
+
+	/**
+	 * Connects the socket to our address, resolving it through the shared resolver first if
+	 * it is a host name (reporting resolve failures here), then racing the endpoints it
+	 * resolved to (see HappyEyeballs). Literal ips go straight to the connect. Calls back
+	 * with the outcome of the connect, unless closing called it off (see cancelConnect).
+	 */
+	template<class Socket, class Callback>
+	void connectSocket(Socket &socket, Callback cb)
+	{
+		{
+			auto guard = m_raceLock.lock();
+			m_raceCancelled = false;
+			m_race.reset();
+		}
+
+		if (!m_localAddress.named()) {
+			socket.async_connect(
+				boost::asio::ip::tcp::endpoint(m_localAddress.ipAddress(), m_localAddress.port()),
+				std::move(cb)
+			);
+			return;
+		}
+
+		Resolver::instance().resolve(ioContext(), m_localAddress.host(), m_localAddress.port(),
+			[this,&socket,cb = std::move(cb)](boost::system::error_code ec, Resolver::Endpoints endpoints) mutable {
+				if (errorCheck<OP::Resolve>(ec))
+					return;
+
+				// First one that connects wins, unless we got closed while resolving
+				auto guard = m_raceLock.lock();
+				if (m_raceCancelled)
+					return;
+
+				m_race = HappyEyeballs::connect(socket, endpoints,
+					std::chrono::milliseconds(getOption<uint32_t>("connect_stagger_ms")), std::move(cb));
+			}
+		);
+	}
+
+	/**
+	 * The shared readSome logic for byte stream protocols. The receive callable issues one
+	 * receive into the buffer it is given and calls back with (error_code, size), whatever it
+	 * lands in the receive ring gets handed out in pieces of at most maxSize before the next
+	 * receive is issued.
+	 */
+	template<class Receive>
+	void readSomeVia(Size maxSize, ReadCallback cb, Receive receive) const
+	{
+		// Leftovers go out first, and a caller reading again from within its callback must
+		// not refill the ring under the view it is still holding, both get posted
+		if (m_delivering || !m_recvBuffer.empty()) {
+			boost::asio::post(ioContext(), [this,maxSize,cb = std::move(cb),receive = std::move(receive)]() mutable {
+				if (m_recvBuffer.empty())
+					return readSomeVia(maxSize, std::move(cb), std::move(receive));
+				deliverSome(maxSize, cb);
+			});
+			return;
+		}
+
+		m_recvBuffer.reserve(getOption<uint32_t>("recv_buffer_size"));
+		receive(m_recvBuffer.writable(),
+			[this,maxSize,cb = std::move(cb)](boost::system::error_code ec, size_t sizeRead) {
+				if (errorCheck<OP::Read>(ec))
+					return;
+
+				m_recvBuffer.commit(sizeRead);
+				deliverSome(maxSize, cb);
+			}
+		);
+	}
+
+	void deliverSome(Size maxSize, const ReadCallback &cb) const
+	{
+		auto view = m_recvBuffer.readable(maxSize);
+		m_recvBuffer.consume(view.size());
+
+		m_delivering = true;
+		try {
+			cb(view);
+		} catch (...) {
+			m_delivering = false;
+			throw;
+		}
+		m_delivering = false;
+	}
+
+	// Copies out anything a previous readSome left buffered so exact reads see it first
+	Size drainReceived(std::byte *dest, Size size) const { return m_recvBuffer.read(dest, size); }
+
+	// Calls off a connect that is still resolving or racing the resolved addresses, for close
+	void cancelConnect() noexcept
+	{
+		auto guard = m_raceLock.lock();
+		m_raceCancelled = true;
+		auto race = std::move(m_race);
+		guard.unlock();
+
+		if (race)
+			dictos::error::block([&]{ race->cancel(); });
+	}
+
 	template<class Type>
 	Type getOption(const std::string_view &key) const { return m_config.getOption<Type>(key); }
 
@@ -81,7 +282,16 @@ protected:
 	ErrorCallback m_ecb;
 
 	EventMachine &m_em;
+	uint32_t m_shard;
 	Address m_localAddress, m_remoteAddress;
+
+	mutable buffer::RingBuffer m_recvBuffer;
+	mutable bool m_delivering = false;
+
+	// The connect racing a host name's addresses (if any), and whether close called it off
+	async::SpinLock m_raceLock;
+	std::shared_ptr<HappyEyeballs> m_race;
+	bool m_raceCancelled = false;
 };
 
 }
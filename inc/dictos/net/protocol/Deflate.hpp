@@ -0,0 +1,226 @@
+#pragma once
+
+namespace dictos::net::protocol {
+
+namespace websocket = boost::beast::websocket;
+
+/**
+ * Wraps a write handler to add up what got written before passing the completion on,
+ * its associated executor and allocator are those of the wrapped handler.
+ */
+template<class Handler>
+struct CountedHandler
+{
+	Handler handler;
+	std::atomic<uint64_t> &written;
+
+	void operator () (boost::system::error_code ec, size_t size)
+	{
+		written.fetch_add(size, std::memory_order_relaxed);
+		handler(ec, size);
+	}
+};
+
+/**
+ * Sits between a websocket stream and its transport counting the bytes that actually get
+ * written, which with permessage-deflate negotiated is the compressed size of what the
+ * websocket was handed. Everything else passes straight through.
+ */
+template<class NextLayer>
+class CountingStream
+{
+public:
+	using next_layer_type = std::remove_reference_t<NextLayer>;
+	using executor_type = typename next_layer_type::executor_type;
+
+	template<class ...Args>
+	explicit CountingStream(Args &&...args) :
+		m_next(std::forward<Args>(args)...)
+	{
+	}
+
+	next_layer_type & next_layer() { return m_next; }
+	const next_layer_type & next_layer() const { return m_next; }
+
+	executor_type get_executor() { return m_next.get_executor(); }
+
+	uint64_t bytesWritten() const noexcept { return m_written.load(std::memory_order_relaxed); }
+
+	template<class MutableBufferSequence>
+	size_t read_some(const MutableBufferSequence &buffers) { return m_next.read_some(buffers); }
+
+	template<class MutableBufferSequence>
+	size_t read_some(const MutableBufferSequence &buffers, boost::system::error_code &ec) { return m_next.read_some(buffers, ec); }
+
+	template<class ConstBufferSequence>
+	size_t write_some(const ConstBufferSequence &buffers)
+	{
+		return count(m_next.write_some(buffers));
+	}
+
+	template<class ConstBufferSequence>
+	size_t write_some(const ConstBufferSequence &buffers, boost::system::error_code &ec)
+	{
+		return count(m_next.write_some(buffers, ec));
+	}
+
+	template<class MutableBufferSequence, class ReadHandler>
+	auto async_read_some(const MutableBufferSequence &buffers, ReadHandler &&handler)
+	{
+		return m_next.async_read_some(buffers, std::forward<ReadHandler>(handler));
+	}
+
+	template<class ConstBufferSequence, class WriteHandler>
+	auto async_write_some(const ConstBufferSequence &buffers, WriteHandler &&handler)
+	{
+		return m_next.async_write_some(buffers,
+			CountedHandler<std::decay_t<WriteHandler>>{std::forward<WriteHandler>(handler), m_written});
+	}
+
+protected:
+	size_t count(size_t size) noexcept
+	{
+		m_written.fetch_add(size, std::memory_order_relaxed);
+		return size;
+	}
+
+	NextLayer m_next;
+	std::atomic<uint64_t> m_written = {0};
+};
+
+// Beast closes the websocket's transport through these, found by lookup on the stream type
+template<class NextLayer>
+void teardown(websocket::role_type role, CountingStream<NextLayer> &stream, boost::system::error_code &ec)
+{
+	using websocket::teardown;
+	teardown(role, stream.next_layer(), ec);
+}
+
+template<class NextLayer, class TeardownHandler>
+void async_teardown(websocket::role_type role, CountingStream<NextLayer> &stream, TeardownHandler &&handler)
+{
+	using websocket::async_teardown;
+	async_teardown(role, stream.next_layer(), std::forward<TeardownHandler>(handler));
+}
+
+/**
+ * The permessage-deflate settings and counters shared by the websocket protocols. Settings
+ * come from the net_stream section of the stream the protocol belongs to, the counters are
+ * process wide.
+ */
+class Deflate
+{
+public:
+	struct Stats
+	{
+		std::atomic<uint64_t> messages = {0};		// Messages written with deflate enabled
+		std::atomic<uint64_t> payloadBytes = {0};	// What those messages added up to before compression
+		std::atomic<uint64_t> wireBytes = {0};		// What went out on the transport for them (frames included)
+		std::atomic<uint64_t> cpuNanos = {0};		// Thread cpu time spent starting those writes
+
+		int64_t bytesSaved() const noexcept
+		{
+			return static_cast<int64_t>(payloadBytes.load()) - static_cast<int64_t>(wireBytes.load());
+		}
+	};
+
+	static Stats & stats() noexcept
+	{
+		static Stats stats;
+		return stats;
+	}
+
+	static websocket::permessage_deflate options(config::Context &config)
+	{
+		websocket::permessage_deflate options;
+		options.client_enable = options.server_enable = config.getOption<bool>("deflate");
+
+		auto windowBits = static_cast<int>(config.getOption<uint32_t>("deflate_window_bits"));
+		options.client_max_window_bits = options.server_max_window_bits = windowBits;
+
+		auto takeover = config.getOption<bool>("deflate_context_takeover");
+		options.client_no_context_takeover = options.server_no_context_takeover = !takeover;
+
+		options.compLevel = static_cast<int>(config.getOption<uint32_t>("deflate_level"));
+		options.memLevel = static_cast<int>(config.getOption<uint32_t>("deflate_mem_level"));
+
+#if BOOST_VERSION >= 108100
+		options.msg_size_threshold = config.getOption<uint32_t>("deflate_threshold");
+#endif
+		return options;
+	}
+
+	/**
+	 * Per protocol bookkeeping that feeds the counters, does nothing unless deflate was
+	 * enabled for the stream. The wire totals come from the protocol's CountingStream.
+	 */
+	class Meter
+	{
+	public:
+		explicit Meter(bool enabled) noexcept : m_enabled(enabled) {}
+
+		bool enabled() const noexcept { return m_enabled; }
+
+		// Brackets the write initiation, which is where beast compresses the message
+		uint64_t begin() const noexcept { return m_enabled ? threadCpuNanos() : 0; }
+		void end(uint64_t cpuStart) const noexcept
+		{
+			if (m_enabled)
+				stats().cpuNanos.fetch_add(threadCpuNanos() - cpuStart, std::memory_order_relaxed);
+		}
+
+		// Sets the wire total to count from, e.g. once the handshake is done
+		void reset(uint64_t wireTotal) noexcept { m_lastWireTotal = wireTotal; }
+
+		void written(Size payloadSize, uint64_t wireTotal) noexcept
+		{
+			if (!m_enabled)
+				return;
+
+			auto &counters = stats();
+			counters.messages.fetch_add(1, std::memory_order_relaxed);
+			counters.payloadBytes.fetch_add(payloadSize, std::memory_order_relaxed);
+			counters.wireBytes.fetch_add(wireTotal - m_lastWireTotal, std::memory_order_relaxed);
+			m_lastWireTotal = wireTotal;
+		}
+
+	protected:
+		bool m_enabled;
+		uint64_t m_lastWireTotal = 0;
+	};
+
+	static uint64_t threadCpuNanos() noexcept
+	{
+		timespec now = {};
+		::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+	}
+};
+
+}
+
+namespace boost::asio {
+
+template<class Handler, class Executor>
+struct associated_executor<::dictos::net::protocol::CountedHandler<Handler>, Executor>
+{
+	using type = associated_executor_t<Handler, Executor>;
+
+	static type get(const ::dictos::net::protocol::CountedHandler<Handler> &handler, const Executor &executor = Executor()) noexcept
+	{
+		return get_associated_executor(handler.handler, executor);
+	}
+};
+
+template<class Handler, class Allocator>
+struct associated_allocator<::dictos::net::protocol::CountedHandler<Handler>, Allocator>
+{
+	using type = associated_allocator_t<Handler, Allocator>;
+
+	static type get(const ::dictos::net::protocol::CountedHandler<Handler> &handler, const Allocator &allocator = Allocator()) noexcept
+	{
+		return get_associated_allocator(handler.handler, allocator);
+	}
+};
+
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+namespace dictos::net::protocol {
+
+/**
+ * The handshake pool keeps tls handshakes (and the key exchange math that comes with them)
+ * off the event machine threads serving established streams. With threads configured each
+ * handshake runs asynchronously on a strand of the pool, so every handshake step (the
+ * crypto included) runs on a pool thread while the socket waits on the stream's own io
+ * context as always, and its completion is posted back to that context where the stream
+ * then carries on as usual. A pool thread is only busy while there is work to do, one
+ * waiting on its peer doesn't hold it. Without threads (the default) handshakes run
+ * asynchronously on the stream's thread as before.
+ *
+ * Handshakes get a deadline (timeout_ms), a peer that doesn't finish in time has the socket
+ * closed on it and the handshake fails with timed_out. While the handshake runs the pool
+ * owns the stream, nothing else may use or close it until the handler is called.
+ *
+ * Either way handshake counts and timings are tracked, and in pool mode how many
+ * handshakes are queued and how long they waited.
+ */
+class HandshakePool : public config::Context
+{
+public:
+	struct Stats
+	{
+		std::atomic<uint64_t> queued = {0};			// Handshakes waiting for a pool thread right now
+		std::atomic<uint64_t> maxQueued = {0};		// The most that were ever waiting at once
+		std::atomic<uint64_t> handshakes = {0};		// Completed handshakes, failed ones included
+		std::atomic<uint64_t> failures = {0};		// Handshakes that failed
+		std::atomic<uint64_t> timeouts = {0};		// Of those, ones that ran out of time
+		std::atomic<uint64_t> queueNanos = {0};		// Time spent waiting for a pool thread over all handshakes
+		std::atomic<uint64_t> totalNanos = {0};		// Time spent handshaking over all handshakes
+		std::atomic<uint64_t> maxNanos = {0};		// Slowest handshake
+
+		double meanNanos() const noexcept
+		{
+			auto count = handshakes.load();
+			return count ? double(totalNanos.load()) / count : 0;
+		}
+	};
+
+	// The process wide pool protocols hand their handshakes to, sized from net_ssl_handshake
+	static HandshakePool & instance()
+	{
+		static HandshakePool pool;
+		return pool;
+	}
+
+	HandshakePool(config::Options options = config::Options()) :
+		Context(getSection(), std::move(options)),
+		m_timeout(getOption<uint32_t>("timeout_ms"))
+	{
+		start(getOption<uint32_t>("thread_count"));
+	}
+
+	HandshakePool(uint32_t threadCount, config::Options options = config::Options()) :
+		Context(getSection(), std::move(options)),
+		m_timeout(getOption<uint32_t>("timeout_ms"))
+	{
+		start(threadCount);
+	}
+
+	HandshakePool(uint32_t threadCount, std::chrono::milliseconds timeout, config::Options options = config::Options()) :
+		Context(getSection(), std::move(options)),
+		m_timeout(timeout)
+	{
+		start(threadCount);
+	}
+
+	HandshakePool(const HandshakePool &pool) = delete;
+	HandshakePool & operator = (const HandshakePool &pool) = delete;
+
+	~HandshakePool() noexcept
+	{
+		for (auto &thread : m_threads)
+			thread->cancel();
+		m_work.reset();
+		m_context.stop();
+		m_threads.clear();
+	}
+
+	/**
+	 * Runs the handshake on stream, calling back with its outcome on the home context
+	 * (the one the stream's socket belongs to).
+	 */
+	template<class SslStream, class Handler>
+	void handshake(SslStream &stream, boost::asio::ssl::stream_base::handshake_type type,
+		boost::asio::io_context &home, Handler handler)
+	{
+		auto start = clock::now();
+		auto offload = offloading();
+
+		if (offload) {
+			auto queued = m_stats.queued.fetch_add(1, std::memory_order_relaxed) + 1;
+			auto peak = m_stats.maxQueued.load(std::memory_order_relaxed);
+			while (queued > peak && !m_stats.maxQueued.compare_exchange_weak(peak, queued, std::memory_order_relaxed))
+				;
+		}
+
+		// Everything about this handshake, the deadline included, runs on its own strand
+		Strand strand(offload ? m_context.get_executor() : home.get_executor());
+		auto pending = std::make_shared<Pending>(strand);
+
+		boost::asio::post(strand, [this,&stream,type,&home,start,offload,strand,pending,handler = std::move(handler)]() mutable {
+			auto begin = start;
+			if (offload) {
+				m_stats.queued.fetch_sub(1, std::memory_order_relaxed);
+				begin = clock::now();
+				m_stats.queueNanos.fetch_add(nanos(begin - start), std::memory_order_relaxed);
+			}
+
+			// A peer that goes quiet fails the handshake by losing its socket
+			if (m_timeout.count()) {
+				pending->deadline.expires_after(m_timeout);
+				pending->deadline.async_wait([&stream,pending](boost::system::error_code ec) {
+					if (ec || pending->done)
+						return;
+
+					pending->timedOut = true;
+					boost::system::error_code ignored;
+					boost::beast::get_lowest_layer(stream).close(ignored);
+				});
+			}
+
+			stream.async_handshake(type, boost::asio::bind_executor(strand,
+				[this,&home,begin,offload,pending,handler = std::move(handler)](boost::system::error_code ec) mutable {
+					pending->done = true;
+					pending->deadline.cancel();
+					if (pending->timedOut) {
+						ec = boost::asio::error::timed_out;
+						m_stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+					}
+					record(begin, ec);
+
+					if (!offload)
+						return handler(ec);
+
+					// Back to the stream's own thread for everything after the handshake
+					boost::asio::post(home, [ec,handler = std::move(handler)]() mutable { handler(ec); });
+				}
+			));
+		});
+	}
+
+	bool offloading() const noexcept { return !m_threads.empty(); }
+	uint32_t threadCount() const noexcept { return static_cast<uint32_t>(m_threads.size()); }
+
+	const Stats & stats() const noexcept { return m_stats; }
+
+protected:
+	using clock = std::chrono::steady_clock;
+	using Strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+	// A running handshake's deadline, and how far it got
+	struct Pending
+	{
+		Pending(Strand strand) : deadline(strand) {}
+
+		boost::asio::steady_timer deadline;
+		bool done = false, timedOut = false;
+	};
+
+	static uint64_t nanos(clock::duration elapsed) noexcept
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+
+	void start(uint32_t threadCount)
+	{
+		if (!threadCount)
+			return;
+
+		m_work.emplace(m_context.get_executor());
+		for (uint32_t threadIdx = 0; threadIdx < threadCount; threadIdx++) {
+			m_threads.push_back(std::make_unique<async::Thread>(
+				string::toString("Handshake thread:", threadIdx),
+				[this]() { m_context.run(); }
+			));
+		}
+	}
+
+	void record(clock::time_point start, boost::system::error_code ec)
+	{
+		auto elapsed = nanos(clock::now() - start);
+
+		m_stats.handshakes.fetch_add(1, std::memory_order_relaxed);
+		if (ec)
+			m_stats.failures.fetch_add(1, std::memory_order_relaxed);
+		m_stats.totalNanos.fetch_add(elapsed, std::memory_order_relaxed);
+
+		auto slowest = m_stats.maxNanos.load(std::memory_order_relaxed);
+		while (elapsed > slowest && !m_stats.maxNanos.compare_exchange_weak(slowest, elapsed, std::memory_order_relaxed))
+			;
+	}
+
+	static const config::Section & getSection()
+	{
+		if (auto section = config::Sections::find("net_ssl_handshake"))
+			return *section;
+
+		static config::Section section("net_ssl_handshake", {
+				{"thread_count", 0u, "Dedicated tls handshake threads (0 runs handshakes on the stream's own thread)"},
+				{"timeout_ms", 10000u, "Milliseconds a handshake gets before the socket is closed on it (0 to wait forever)"},
+			}
+		);
+
+		return section;
+	}
+
+	boost::asio::io_context m_context;
+	std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> m_work;
+	std::vector<std::unique_ptr<async::Thread>> m_threads;
+	std::chrono::milliseconds m_timeout;
+	Stats m_stats;
+};
+
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+namespace dictos::net::protocol {
+
+/**
+ * Happy eyeballs (rfc 8305) connect racing. Rather than trying a host's addresses one after
+ * the other, each waiting out a full connect timeout on an address that doesn't answer, the
+ * addresses are tried in parallel with a staggered start: alternating between ipv6 and ipv4
+ * (starting with whichever family the resolver prefers), the next attempt starts once the
+ * previous one had its head start or failed, whichever comes first. The first attempt to
+ * connect wins and gets moved into the caller's socket, the others get cancelled.
+ *
+ * A race can be called off (see cancel) by whoever owns the socket, e.g. when closing it
+ * while the race is still on.
+ */
+class HappyEyeballs :
+	public std::enable_shared_from_this<HappyEyeballs>
+{
+public:
+	using tcp = boost::asio::ip::tcp;
+	typedef std::function<void(boost::system::error_code ec)> Callback;
+
+	/**
+	 * Connects socket to the first of the endpoints to answer, calls back (on the socket's
+	 * io context) with success or, if none of them connected, the last error. Returns the
+	 * race if there is one, null if there was nothing to race (closing the socket calls
+	 * that connect off).
+	 */
+	template<class Endpoints>
+	static std::shared_ptr<HappyEyeballs> connect(tcp::socket &socket, const Endpoints &endpoints,
+		std::chrono::milliseconds stagger, Callback cb)
+	{
+		auto order = interleave(endpoints);
+
+		// Nothing to race
+		if (order.size() == 1) {
+			socket.async_connect(order.front(), std::move(cb));
+			return {};
+		}
+
+		if (order.empty()) {
+			auto executor = socket.get_executor();
+			boost::asio::post(executor, [cb = std::move(cb)]() { cb(boost::asio::error::host_not_found); });
+			return {};
+		}
+
+		auto race = std::shared_ptr<HappyEyeballs>(new HappyEyeballs(socket, std::move(order), stagger, std::move(cb)));
+		boost::asio::dispatch(race->m_strand, [race]() { race->next(); });
+		return race;
+	}
+
+	/**
+	 * Calls off the race. The socket and the callback are let go of right away, so their
+	 * owner may go away once this returns, the callback is never called. The attempts still
+	 * in flight get closed on the race's strand.
+	 */
+	void cancel()
+	{
+		auto guard = m_lock.lock();
+		if (!m_socket)
+			return;
+
+		m_socket = nullptr;
+		auto cb = std::move(m_cb);
+		guard.unlock();
+
+		boost::asio::dispatch(m_strand, [race = shared_from_this()]() { race->abort(); });
+	}
+
+	/**
+	 * Orders the endpoints for racing, alternating address families starting with the
+	 * family of the first (most preferred) one, each family keeping its own order.
+	 */
+	template<class Endpoints>
+	static std::vector<tcp::endpoint> interleave(const Endpoints &endpoints)
+	{
+		std::vector<tcp::endpoint> first, second;
+		for (const auto &entry : endpoints) {
+			tcp::endpoint endpoint = entry;
+			if (first.empty() || endpoint.protocol() == first.front().protocol())
+				first.push_back(endpoint);
+			else
+				second.push_back(endpoint);
+		}
+
+		std::vector<tcp::endpoint> order;
+		order.reserve(first.size() + second.size());
+		for (size_t index = 0; index < std::max(first.size(), second.size()); index++) {
+			if (index < first.size())
+				order.push_back(first[index]);
+			if (index < second.size())
+				order.push_back(second[index]);
+		}
+		return order;
+	}
+
+protected:
+	using Strand = boost::asio::strand<tcp::socket::executor_type>;
+
+	HappyEyeballs(tcp::socket &socket, std::vector<tcp::endpoint> order, std::chrono::milliseconds stagger, Callback cb) :
+		m_socket(&socket),
+		m_strand(socket.get_executor()),
+		m_timer(socket.get_executor()),
+		m_order(std::move(order)),
+		m_stagger(stagger),
+		m_cb(std::move(cb))
+	{
+	}
+
+	// Starts the next attempt, and arms the head start timer for the one after it
+	void next()
+	{
+		if (m_done || m_next == m_order.size())
+			return;
+
+		auto index = m_next++;
+		m_attempts.push_back(std::make_unique<tcp::socket>(m_strand.get_inner_executor()));
+		auto &attempt = *m_attempts.back();
+		m_active++;
+
+		LOGT(stream, "Connect attempt:", index, "to:", m_order[index].address().to_string());
+		attempt.async_connect(m_order[index], boost::asio::bind_executor(m_strand,
+			[race = shared_from_this(),&attempt](boost::system::error_code ec) {
+				race->onConnect(attempt, ec);
+			}
+		));
+
+		if (m_next == m_order.size())
+			return;
+
+		m_timer.expires_after(m_stagger);
+		m_timer.async_wait(boost::asio::bind_executor(m_strand,
+			[race = shared_from_this(),attempts = m_next](boost::system::error_code ec) {
+				// Only the timer for the latest attempt counts, a failure may have moved us on already
+				if (!ec && race->m_next == attempts)
+					race->next();
+			}
+		));
+	}
+
+	void onConnect(tcp::socket &attempt, boost::system::error_code ec)
+	{
+		m_active--;
+		if (m_done)
+			return;
+
+		if (ec) {
+			m_lastError = ec;
+
+			// Don't wait out the head start of an attempt that already failed
+			if (m_next < m_order.size()) {
+				m_timer.cancel();
+				return next();
+			}
+
+			if (!m_active)
+				finish(m_lastError);
+			return;
+		}
+
+		// We have a winner, call off everyone else
+		abort(&attempt);
+		finish(boost::system::error_code(), &attempt);
+	}
+
+	// Stops the race, closing every attempt but the winner (if any)
+	void abort(tcp::socket *winner = nullptr)
+	{
+		m_done = true;
+		m_timer.cancel();
+		for (auto &other : m_attempts) {
+			if (other.get() != winner) {
+				boost::system::error_code ignored;
+				other->close(ignored);
+			}
+		}
+	}
+
+	// Hands the winner (if any) over and calls back, unless the race was called off
+	void finish(boost::system::error_code ec, tcp::socket *winner = nullptr)
+	{
+		m_done = true;
+
+		auto guard = m_lock.lock();
+		if (!m_socket) {
+			guard.unlock();
+			if (winner) {
+				boost::system::error_code ignored;
+				winner->close(ignored);
+			}
+			return;
+		}
+
+		if (winner)
+			*m_socket = std::move(*winner);
+		m_socket = nullptr;
+		auto cb = std::move(m_cb);
+		guard.unlock();
+
+		cb(ec);
+	}
+
+	// The caller's socket, let go of (along with the callback) once the race is finished or called off
+	async::SpinLock m_lock;
+	tcp::socket *m_socket;
+	Strand m_strand;
+	boost::asio::steady_timer m_timer;
+	std::vector<tcp::endpoint> m_order;
+	std::chrono::milliseconds m_stagger;
+	Callback m_cb;
+
+	std::vector<std::unique_ptr<tcp::socket>> m_attempts;
+	size_t m_next = 0, m_active = 0;
+	bool m_done = false;
+	boost::system::error_code m_lastError;
+};
+
+}
@@ -6,13 +6,31 @@ using tcp = boost::asio::ip::tcp;
 namespace ssl = boost::asio::ssl;
 
 /**
+ * The Ssl protocol is a plain tls byte stream.
+ *
+ * With ktls enabled (see SslContext) a connection runs its own openssl connection directly
+ * on the socket instead of through asio's ssl engine, with SSL_OP_ENABLE_KTLS set, so once
+ * the handshake is done openssl installs the negotiated keys in the kernel. Writes then go
+ * out as plain (gathered) socket writes and reads are plain socket reads underneath openssl,
+ * the kernel does the record encryption. Whatever direction the kernel or the negotiated
+ * cipher can't do openssl keeps doing in user space, so the connection works either way.
  */
 class Ssl : public AbstractProtocol
 {
 public:
+	/**
+	 * How ktls connections fared, counted over the whole process.
+	 */
+	struct KtlsStats
+	{
+		std::atomic<uint64_t> connections = {0};	// Connections that asked for ktls
+		std::atomic<uint64_t> send = {0};			// Of those, ones the kernel encrypts the sends of
+		std::atomic<uint64_t> recv = {0};			// Of those, ones the kernel decrypts the receives of
+	};
+
 	Ssl(Address addr, EventMachine &em, config::Context &config, ErrorCallback ecb, SslContext sslContext) :
 		AbstractProtocol(std::move(addr), em, config, std::move(ecb)),
-		m_socket(m_em, sslContext), m_sslContext(std::move(sslContext))
+		m_socket(ioContext(), sslContext), m_sslContext(std::move(sslContext))
 	{
 		// @@ TODO
 	}
@@ -23,8 +41,15 @@ public:
 		// @@ TODO
 	}
 
+	static KtlsStats & ktlsStats() noexcept
+	{
+		static KtlsStats stats;
+		return stats;
+	}
+
 	void close() noexcept override
 	{
+		cancelConnect();
 		//m_socket.close(websocket::close_code::normal);
 	}
 
@@ -36,54 +61,77 @@ public:
 	void read(Size size, ReadCallback cb) const override
 	{
 		// Allocate the buffer to read into for the caller
-		memory::Heap result(size);
-
-		// Construct an asio buffer before we move the result into the closure, due to
-		// parameter initialization order this prevents a crash since result will
-		// get moved before it gets passed into the async_read call.
-		boost::asio::mutable_buffer buf(result.cast<void *>(), result.size());
+		readInto(memory::Heap(size),
+			[cb = std::move(cb)](memory::Heap &result) {
+				cb(std::move(result));
+			}
+		);
+	}
 
-		// Submit the read to the service and bootstrap the callbacks
-		boost::asio::async_read(m_socket.next_layer(), buf,
-			[this,result = std::move(result), cb = std::move(cb)](boost::system::error_code ec, size_t sizeRead)
-			{
-				if (errorCheck<OP::Read>(ec))
-					return;
+	void readPooled(Size size, PooledReadCallback cb) const override
+	{
+		// Draw the buffer to read into for the caller from the pool
+		readInto(buffer::PoolBuffer(size),
+			[cb = std::move(cb)](buffer::PoolBuffer &result) {
+				cb(std::move(result));
+			}
+		);
+	}
 
-				DCORE_ASSERT(sizeRead == result.size());
-				cb(std::move(*const_cast<memory::Heap *>(&result)));
+	void readSome(Size maxSize, ReadCallback cb) const override
+	{
+		readSomeVia(maxSize, std::move(cb),
+			[this](boost::asio::mutable_buffer buf, auto handler) {
+				receiveSome(buf, std::move(handler));
 			}
 		);
 	}
 
+	bool writeEarly(memory::HeapView payload) override
+	{
+		auto guard = m_earlyLock.lock();
+		if (m_earlyData || !m_sslContext.maxEarlyData())
+			return false;
+
+		m_earlyData.emplace(payload.size());
+		std::memcpy(m_earlyData->begin(), payload.begin(), payload.size());
+		return true;
+	}
+
+	bool earlyDataAccepted() const noexcept override { return m_earlyAccepted; }
+
 	void connect(ConnectCallback cb) override
 	{
-		// First we go through a few hoops to resolve the address
-		m_resolver = std::make_unique<tcp::resolver>(m_em);
-		m_resolver->async_resolve(tcp::v4(), m_localAddress.ip(), string::toString(m_localAddress.port()),
-			[this,cb = std::move(cb)](boost::system::error_code ec, tcp::resolver::iterator results)
+		// Resolve the address if need be and connect to it
+		connectSocket(m_socket.next_layer(),
+			[this,cb = std::move(cb)](boost::system::error_code ec)
 			{
-				if (errorCheck<OP::Resolve>(ec))
+				if (errorCheck<OP::Accept>(ec))
 					return;
 
-				// Ok connect for each resolved entry, first one that connects ok will stop the enum
-				boost::asio::async_connect(m_socket.next_layer(), results,
-					[this,cb = std::move(cb)](boost::system::error_code ec, tcp::resolver::iterator _iter)
+				if (m_sslContext.ktls())
+					return handshakeKtls(std::move(cb));
+
+				// Successfully connected, resume our last session with the peer if we
+				// have one (and send the early data along with it) then do the handshake
+				if (m_localAddress.named())
+					SSL_set_tlsext_host_name(m_socket.native_handle(), m_localAddress.host().c_str());
+
+				m_sessionKey = m_sslContext.sessionKey(m_localAddress);
+				SslSessionCache::resumeWith(m_socket.native_handle(), m_sessionKey);
+
+				auto sentEarly = sendEarly(m_socket.native_handle());
+
+				HandshakePool::instance().handshake(m_socket, ssl::stream_base::client, ioContext(),
+					[this,sentEarly,cb = std::move(cb)](boost::system::error_code ec)
 					{
-						if (errorCheck<OP::Accept>(ec))
+						if (errorCheck<OP::SslHandshake>(ec))
 							return;
 
-						// Successfully connected, do handshake
-						m_socket.async_handshake(ssl::stream_base::client,
-							[this,cb = std::move(cb)](boost::system::error_code ec)
-							{
-								if (errorCheck<OP::SslHandshake>(ec))
-									return;
-
-								// Phew finally, call the callers cb
-								cb();
-							}
-						);
+						handshaken(m_socket.native_handle(), sentEarly);
+
+						// Phew finally, call the callers cb
+						cb();
 					}
 				);
 			}
@@ -93,8 +141,8 @@ public:
 	void write(memory::Heap payload, WriteCallback cb) override
 	{
 		// Submit the write to the service and bootstrap the callbacks
-		boost::asio::mutable_buffer buf(payload.cast<void *>(), payload.size());
-		boost::asio::async_write(m_socket.next_layer(), buf,
+		std::vector<boost::asio::const_buffer> buffers = {boost::asio::const_buffer(payload.cast<void *>(), payload.size())};
+		send(std::move(buffers),
 			[this,payload = std::move(payload), cb = std::move(cb)](boost::system::error_code ec, size_t sizeWritten)
 			{
 				if (errorCheck<OP::Write>(ec))
@@ -106,13 +154,244 @@ public:
 		);
 	}
 
-	// We lazily instantiate these as the class is used as a server or a resolving connector
+	void write(buffer::Segments segments, WriteCallback cb) override
+	{
+		// The buffer sequence points into the segments, which keep their storage when
+		// moved into the closure, so the whole thing goes out in one gathered write
+		auto buffers = buffer::toBuffers(segments);
+		auto size = buffer::totalSize(segments);
+		send(std::move(buffers),
+			[this,size,segments = std::move(segments), cb = std::move(cb)](boost::system::error_code ec, size_t sizeWritten)
+			{
+				if (errorCheck<OP::Write>(ec))
+					return;
+
+				DCORE_ASSERT(sizeWritten == size);
+				cb();
+			}
+		);
+	}
+
+	// True if the kernel does the record encryption for sends, respectively receives
+	bool ktlsSend() const noexcept { return m_ktlsSend; }
+	bool ktlsRecv() const noexcept { return m_ktlsRecv; }
+
+	// We lazily instantiate this as the class is used as a server
 	std::unique_ptr<tcp::acceptor> m_acceptor;
-	std::unique_ptr<tcp::resolver> m_resolver;
 
 	mutable ssl::stream<tcp::socket> m_socket;
 
 	SslContext m_sslContext;
+
+	// The session cache key for the peer, what to send as early data on connect and whether it was
+	// taken, the early data is handed over by whichever thread submits it so it goes under a lock
+	std::string m_sessionKey;
+	async::SpinLock m_earlyLock;
+	std::optional<memory::Heap> m_earlyData;
+	std::atomic<bool> m_earlyAccepted = {false};
+
+	// The connection running straight on the socket in ktls mode, and what the kernel took over
+	std::unique_ptr<SSL, decltype(&SSL_free)> m_ktls = {nullptr, &SSL_free};
+	bool m_ktlsSend = false, m_ktlsRecv = false;
+
+protected:
+	// Sends the early data handed to writeEarly (if any) along with the resumed session
+	bool sendEarly(SSL *ssl)
+	{
+		auto guard = m_earlyLock.lock();
+		return m_earlyData &&
+			writeEarlyData(ssl, memory::HeapView(m_earlyData->begin(), m_earlyData->size()), m_sslContext.maxEarlyData());
+	}
+
+	// Accounts for a finished handshake, the early data is done with either way
+	void handshaken(SSL *ssl, bool sentEarly)
+	{
+		SslSessionCache::handshaken(ssl);
+
+		auto guard = m_earlyLock.lock();
+		m_earlyAccepted = m_earlyData && sentEarly && protocol::earlyDataAccepted(ssl);
+		m_earlyData.reset();
+	}
+
+	/**
+	 * The ktls flavour of the handshake, on an openssl connection of our own reading and
+	 * writing the socket directly, which is what lets openssl hand the keys to the kernel.
+	 * It is driven by socket readiness on the stream's own thread.
+	 */
+	void handshakeKtls(ConnectCallback cb)
+	{
+#if defined(SSL_OP_ENABLE_KTLS)
+		auto &socket = m_socket.next_layer();
+
+		m_ktls.reset(SSL_new(m_sslContext.nativeContext()));
+		if (!m_ktls || SSL_set_fd(m_ktls.get(), socket.native_handle()) != 1) {
+			errorCheck<OP::SslHandshake>(translate(SSL_ERROR_SSL));
+			return;
+		}
+
+		socket.non_blocking(true);
+		SSL_set_options(m_ktls.get(), SSL_OP_ENABLE_KTLS);
+		SSL_set_connect_state(m_ktls.get());
+		if (m_localAddress.named())
+			SSL_set_tlsext_host_name(m_ktls.get(), m_localAddress.host().c_str());
+
+		m_sessionKey = m_sslContext.sessionKey(m_localAddress);
+		SslSessionCache::resumeWith(m_ktls.get(), m_sessionKey);
+
+		auto sentEarly = sendEarly(m_ktls.get());
+
+		drive([ssl = m_ktls.get()](size_t &done) { done = 0; return SSL_do_handshake(ssl); },
+			[this,sentEarly,cb = std::move(cb)](boost::system::error_code ec, size_t) {
+				if (errorCheck<OP::SslHandshake>(ec))
+					return;
+
+				m_ktlsSend = BIO_get_ktls_send(SSL_get_wbio(m_ktls.get())) > 0;
+				m_ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(m_ktls.get())) > 0;
+
+				auto &stats = ktlsStats();
+				stats.connections.fetch_add(1, std::memory_order_relaxed);
+				stats.send.fetch_add(m_ktlsSend, std::memory_order_relaxed);
+				stats.recv.fetch_add(m_ktlsRecv, std::memory_order_relaxed);
+				LOGT(net, "Ktls connection up, kernel send:", m_ktlsSend, "kernel receive:", m_ktlsRecv);
+
+				handshaken(m_ktls.get(), sentEarly);
+				cb();
+			}
+		);
+#endif
+	}
+
+	/**
+	 * Runs an openssl call on the ktls connection, waiting for the socket and calling it
+	 * again for as long as it wants to read or write more, then calls back with the outcome
+	 * and whatever size the call reported.
+	 */
+	template<class Call, class Handler>
+	void drive(Call call, Handler handler) const
+	{
+		ERR_clear_error();
+
+		size_t done = 0;
+		auto result = call(done);
+		if (result > 0)
+			return handler(boost::system::error_code(), done);
+
+		auto error = SSL_get_error(m_ktls.get(), result);
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+			m_socket.next_layer().async_wait(error == SSL_ERROR_WANT_READ ? tcp::socket::wait_read : tcp::socket::wait_write,
+				[this,call = std::move(call),handler = std::move(handler)](boost::system::error_code ec) mutable {
+					if (ec)
+						return handler(ec, 0);
+					drive(std::move(call), std::move(handler));
+				}
+			);
+			return;
+		}
+
+		handler(translate(error), 0);
+	}
+
+	static boost::system::error_code translate(int error)
+	{
+		switch (error) {
+			case SSL_ERROR_ZERO_RETURN:
+				return boost::asio::error::eof;
+			case SSL_ERROR_SYSCALL:
+				if (auto code = ERR_get_error())
+					return boost::system::error_code(code, boost::asio::error::get_ssl_category());
+				return errno ? boost::system::error_code(errno, boost::system::system_category()) : boost::asio::error::eof;
+			default:
+				if (auto code = ERR_get_error())
+					return boost::system::error_code(code, boost::asio::error::get_ssl_category());
+				return boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+		}
+	}
+
+	// Reads whatever is there (at least a byte) into buf
+	template<class Handler>
+	void receiveSome(boost::asio::mutable_buffer buf, Handler handler) const
+	{
+		if (!m_ktls)
+			return m_socket.async_read_some(buf, std::move(handler));
+
+		drive([ssl = m_ktls.get(),buf](size_t &done) { return SSL_read_ex(ssl, buf.data(), buf.size(), &done); },
+			std::move(handler));
+	}
+
+	/**
+	 * Fills result completely, anything a previous readSome left buffered first, then
+	 * hands it to deliver which is free to move it out.
+	 */
+	template<class Buffer, class Deliver>
+	void readInto(Buffer result, Deliver deliver) const
+	{
+		auto data = result.template cast<std::byte *>();
+		auto buffered = drainReceived(data, result.size());
+
+		// Construct an asio buffer before we move the result into the closure, due to
+		// parameter initialization order this prevents a crash since result will
+		// get moved before it gets passed into the async_read call.
+		boost::asio::mutable_buffer buf(data + buffered, result.size() - buffered);
+
+		// Submit the read to the service and bootstrap the callbacks
+		receive(buf,
+			[this,buffered,result = std::move(result), deliver = std::move(deliver)](boost::system::error_code ec, size_t sizeRead) mutable
+			{
+				if (errorCheck<OP::Read>(ec))
+					return;
+
+				DCORE_ASSERT(buffered + sizeRead == result.size());
+				deliver(result);
+			}
+		);
+	}
+
+	// Fills buf entirely
+	template<class Handler>
+	void receive(boost::asio::mutable_buffer buf, Handler handler, size_t received = 0) const
+	{
+		if (!m_ktls)
+			return boost::asio::async_read(m_socket, buf, std::move(handler));
+
+		if (received == buf.size())
+			return handler(boost::system::error_code(), received);
+
+		receiveSome(buf + received,
+			[this,buf,received,handler = std::move(handler)](boost::system::error_code ec, size_t sizeRead) mutable {
+				if (ec)
+					return handler(ec, received);
+				receive(buf, std::move(handler), received + sizeRead);
+			}
+		);
+	}
+
+	/**
+	 * Writes the buffers out whole. Once the kernel encrypts our sends that is one gathered
+	 * socket write, otherwise each buffer goes through openssl in turn.
+	 */
+	template<class Handler>
+	void send(std::vector<boost::asio::const_buffer> buffers, Handler handler, size_t index = 0, size_t sent = 0)
+	{
+		if (!m_ktls)
+			return boost::asio::async_write(m_socket, std::move(buffers), std::move(handler));
+
+		if (m_ktlsSend)
+			return boost::asio::async_write(m_socket.next_layer(), std::move(buffers), std::move(handler));
+
+		while (index < buffers.size() && !buffers[index].size())
+			index++;
+		if (index == buffers.size())
+			return handler(boost::system::error_code(), sent);
+
+		auto buf = buffers[index];
+		drive([ssl = m_ktls.get(),buf](size_t &done) { return SSL_write_ex(ssl, buf.data(), buf.size(), &done); },
+			[this,index,sent,buffers = std::move(buffers),handler = std::move(handler)](boost::system::error_code ec, size_t sizeWritten) mutable {
+				if (ec)
+					return handler(ec, sent);
+				send(std::move(buffers), std::move(handler), index + 1, sent + sizeWritten);
+			}
+		);
+	}
 };
 
 }
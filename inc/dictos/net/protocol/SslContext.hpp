@@ -4,36 +4,187 @@ namespace dictos::net::protocol {
 
 /**
  * The ssl context class helps setup the boost asio ssl context.
+ *
+ * Set up contexts are cached process wide, keyed by the options that go into them, and
+ * shared by every stream using the same options, so the cert chain, cert and key are read
+ * and parsed once rather than per connection. A shared context is never changed after it
+ * was set up. The files are still stat'ed per lookup, a rotated cert gets picked up by the
+ * next stream while streams already open keep the context they started with.
+ *
+ * Contexts also set up session resumption, clients cache the sessions they get per peer
+ * address and servers issue session tickets under regularly rotated keys. Tls 1.3 early
+ * data is opt in (early_data), see writeEarlyData.
  */
 class SslContext : public config::Context
 {
 public:
+	struct Stats
+	{
+		std::atomic<uint64_t> hits = {0};		// Streams that got an already set up context
+		std::atomic<uint64_t> misses = {0};		// Contexts set up from scratch
+	};
+
 	SslContext(config::Options options, bool server = false) :
-		Context(getSection(), std::move(options)), m_server(server),
-		m_context(std::make_unique<boost::asio::ssl::context>(boost::asio::ssl::context::tls_client))
+		Context(getSection(), std::move(options)), m_server(server)
 	{
-		setup();
+		m_context = lookup();
 	}
 
 	SslContext(SslContext &&context) :
+		Context(std::move(context)),
 		m_context(std::move(context.m_context)),
-		Context(std::move(context))
+		m_key(std::move(context.m_key)),
+		m_server(context.m_server)
 	{
 	}
 
 	SslContext & operator = (SslContext &&context)
 	{
 		m_context = std::move(context.m_context);
+		m_key = std::move(context.m_key);
+		m_server = context.m_server;
 		return *this;
 	}
 
+	static Stats & stats() noexcept
+	{
+		static Stats stats;
+		return stats;
+	}
+
 	SSL_CTX * nativeContext() { return m_context->native_handle(); }
 
+	/**
+	 * What to cache a peer's sessions under (see SslSessionCache). Sessions only get offered
+	 * to a peer by streams set up with the same options as the one that got them, so e.g. a
+	 * session from a stream not verifying its peer never skips the verification of another.
+	 */
+	std::string sessionKey(const Address &peer) const { return m_key + '\0' + peer.__toString(); }
+
+	// Most bytes to send as early data on a resumed connection, 0 if disabled
+	size_t maxEarlyData() { return getOption<uint32_t>("early_data"); }
+
+	// Whether connections should try to hand record encryption to the kernel, only ever
+	// true where openssl knows how to
+	bool ktls()
+	{
+#if defined(SSL_OP_ENABLE_KTLS)
+		return getOption<bool>("ktls");
+#else
+		return false;
+#endif
+	}
+
 	operator boost::asio::ssl::context &() { return *m_context; }
 	operator const boost::asio::ssl::context &() const { return *m_context; }
 
 protected:
-	void setup()
+	using SharedContext = std::shared_ptr<boost::asio::ssl::context>;
+
+	/**
+	 * What a cached context was set up from on disk, a change in any of the files
+	 * means it gets set up again.
+	 */
+	struct FileStamp
+	{
+		int64_t mtime = 0, mtimeNanos = 0;
+		uint64_t size = 0, inode = 0;
+
+		bool operator == (const FileStamp &stamp) const noexcept
+		{
+			return mtime == stamp.mtime && mtimeNanos == stamp.mtimeNanos && size == stamp.size && inode == stamp.inode;
+		}
+	};
+
+	struct CacheEntry
+	{
+		std::array<FileStamp, 3> stamps;
+		SharedContext context;
+	};
+
+	static FileStamp stampOf(const file::path &path) noexcept
+	{
+		FileStamp stamp;
+		struct stat info = {};
+		if (path.empty() || ::stat(path.string().c_str(), &info))
+			return stamp;
+
+		stamp.mtime = info.st_mtim.tv_sec;
+		stamp.mtimeNanos = info.st_mtim.tv_nsec;
+		stamp.size = static_cast<uint64_t>(info.st_size);
+		stamp.inode = static_cast<uint64_t>(info.st_ino);
+		return stamp;
+	}
+
+	/**
+	 * Finds the shared context for our options, setting one up if there is none yet or
+	 * the files it came from changed since.
+	 */
+	SharedContext lookup()
+	{
+		auto client_cert_file = getOption<file::path>("client_cert_file");
+		auto private_key_file = getOption<file::path>("private_key_file");
+		auto cert_chain_file = getOption<file::path>("cert_chain_file");
+
+		std::string key;
+		for (auto &part : {client_cert_file.string(), private_key_file.string(), cert_chain_file.string(),
+				getOption<std::string>("cipher_list")}) {
+			key += part;
+			key += '\0';
+		}
+		key += getOption<bool>("verify_peer") ? '1' : '0';
+		key += m_server ? 's' : 'c';
+		key += getOption<bool>("session_cache") ? '1' : '0';
+		key += getOption<bool>("session_tickets") ? '1' : '0';
+		key += '\0' + std::to_string(getOption<uint32_t>("session_cache_size"));
+		key += '\0' + std::to_string(getOption<uint32_t>("ticket_rotation_s"));
+		key += '\0' + std::to_string(getOption<uint32_t>("early_data"));
+		m_key = key;
+
+		return cached(key, {client_cert_file, private_key_file, cert_chain_file},
+			[this](boost::asio::ssl::context &context) { setup(context); });
+	}
+
+	/**
+	 * Hands out the context cached under key if it was set up from the files as they are
+	 * now, otherwise sets up a new one with setup and caches that instead.
+	 */
+	template<class Setup>
+	static SharedContext cached(const std::string &key, const std::array<file::path, 3> &files, Setup &&setup)
+	{
+		std::array<FileStamp, 3> stamps = {stampOf(files[0]), stampOf(files[1]), stampOf(files[2])};
+
+		auto &cache = contextCache();
+		auto guard = cacheLock().lock();
+		if (auto entry = cache.find(key); entry != cache.end() && entry->second.stamps == stamps) {
+			stats().hits.fetch_add(1, std::memory_order_relaxed);
+			return entry->second.context;
+		}
+		guard.unlock();
+
+		// Set up outside the lock, if another stream raced us here the last one in wins
+		auto context = std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tls);
+		setup(*context);
+		stats().misses.fetch_add(1, std::memory_order_relaxed);
+
+		auto relock = cacheLock().lock();
+		cache[key] = CacheEntry{stamps, context};
+		return context;
+	}
+
+	static std::unordered_map<std::string, CacheEntry> & contextCache()
+	{
+		static std::unordered_map<std::string, CacheEntry> cache;
+		return cache;
+	}
+
+	static async::SpinLock & cacheLock()
+	{
+		static async::SpinLock lock;
+		return lock;
+	}
+
+	void setup(boost::asio::ssl::context &context)
 	{
 		auto client_cert_file = getOption<file::path>("client_cert_file");
 		auto private_key_file = getOption<file::path>("private_key_file");
@@ -47,7 +198,7 @@ protected:
 		LOGT(CRITICAL, "Verify peer:", verify_peer);
 		LOGT(CRITICAL, "Cipher list:", cipher_list);
 
-		m_context->set_options(
+		context.set_options(
 			boost::asio::ssl::context::no_sslv2		|
 			boost::asio::ssl::context::no_sslv3		|
 			boost::asio::ssl::context::no_tlsv1		|
@@ -55,20 +206,53 @@ protected:
 			boost::asio::ssl::context::no_compression
 		);
 
-		m_context->use_certificate_chain_file(cert_chain_file.string());
-		m_context->load_verify_file(cert_chain_file.string());
+		// Only what is configured gets loaded, e.g. a client not doing client auth has no cert
+		if (!cert_chain_file.empty()) {
+			context.use_certificate_chain_file(cert_chain_file.string());
+			context.load_verify_file(cert_chain_file.string());
+		}
 
-		m_context->use_certificate_file(client_cert_file.string(), boost::asio::ssl::context::file_format::pem);
-		m_context->use_private_key_file(private_key_file.string(), boost::asio::ssl::context::file_format::pem);
+		if (!client_cert_file.empty())
+			context.use_certificate_file(client_cert_file.string(), boost::asio::ssl::context::file_format::pem);
+		if (!private_key_file.empty())
+			context.use_private_key_file(private_key_file.string(), boost::asio::ssl::context::file_format::pem);
 
 		if (verify_peer) {
 			if (m_server)
-				m_context->set_verify_mode(boost::asio::ssl::verify_peer|boost::asio::ssl::verify_fail_if_no_peer_cert);
+				context.set_verify_mode(boost::asio::ssl::verify_peer|boost::asio::ssl::verify_fail_if_no_peer_cert);
 			else
-				m_context->set_verify_mode(boost::asio::ssl::verify_peer);
+				context.set_verify_mode(boost::asio::ssl::verify_peer);
 		}
 
-		SSL_CTX_set_cipher_list(m_context->native_handle(), cipher_list.c_str());
+		SSL_CTX_set_cipher_list(context.native_handle(), cipher_list.c_str());
+
+		// Session resumption, the client half caches sessions per peer, the server
+		// half issues tickets (the id context lets verified clients resume too)
+		auto native = context.native_handle();
+		static const unsigned char sessionIdContext[] = "dictos-net";
+		SSL_CTX_set_session_id_context(native, sessionIdContext, sizeof(sessionIdContext) - 1);
+
+		// Servers keep openssl's own cache, clients get one per context caching by peer
+		auto sessionCache = getOption<bool>("session_cache");
+		if (m_server) {
+			SSL_CTX_set_session_cache_mode(native, sessionCache ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+			SSL_CTX_sess_set_cache_size(native, getOption<uint32_t>("session_cache_size"));
+		} else if (sessionCache)
+			SslSessionCache::enable(native, getOption<uint32_t>("session_cache_size"));
+
+		if (getOption<bool>("session_tickets"))
+			SslTicketKeys::enable(native, std::chrono::seconds(getOption<uint32_t>("ticket_rotation_s")));
+		else
+			SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+
+		// A server only takes early data with its session cache on, that is where openssl
+		// remembers which tickets were used already so early data can't be replayed
+		if (auto earlyData = getOption<uint32_t>("early_data")) {
+			if (m_server && !sessionCache)
+				LOG(net, "Not accepting early data, it needs the session cache for replay protection");
+			else
+				SSL_CTX_set_max_early_data(native, earlyData);
+		}
 	}
 
 	static const config::Section & getSection()
@@ -82,13 +266,20 @@ protected:
 				{"cert_chain_file", file::path(), "Path to cert chain file (for peer certificate validation)"},
 				{"verify_peer", true, "Whether to verify the peer" },
 				{"cipher_list", "HIGH:!DSS:!aNULL@STRENGTH"s, "The ssl cipher list to control cipher selection"},
+				{"session_cache", true, "Cache sessions per peer address and resume them on reconnect"},
+				{"session_cache_size", 1024u, "Most peers to keep a cached session for"},
+				{"session_tickets", true, "Issue session tickets when accepting"},
+				{"ticket_rotation_s", 3600u, "Seconds before the session ticket key gets replaced"},
+				{"early_data", 0u, "Most bytes of tls 1.3 early data to send or accept, 0 to disable (idempotent requests only)"},
+				{"ktls", false, "Hand record encryption to the kernel (linux ktls) after the handshake where supported"},
 			}
 		);
 
 		return section;
 	}
 
-	std::unique_ptr<boost::asio::ssl::context> m_context;
+	SharedContext m_context;
+	std::string m_key;	// What the options came down to, the context's cache key
 	bool m_server;	// Indicates whether we'll be used as a client or a server so we can set options appropriately 
 };
 
@@ -0,0 +1,361 @@
+#pragma once
+
+namespace dictos::net::protocol {
+
+/**
+ * The client side tls session cache, so reconnecting to an address resumes the last
+ * session with it instead of running a full handshake. Each client context gets a cache
+ * of its own (see enable), keyed by the peer along with the context options (see
+ * SslContext::sessionKey), sessions are handed to us by openssl as they arrive, which on
+ * tls 1.3 is after the handshake through session tickets.
+ *
+ * Tls 1.3 tickets are single use, those get taken out of the cache when offered and the
+ * resumed connection's own new ticket replaces them.
+ */
+class SslSessionCache
+{
+public:
+	struct Stats
+	{
+		std::atomic<uint64_t> stored = {0};		// Sessions received from servers
+		std::atomic<uint64_t> offered = {0};	// Connects that offered a cached session
+		std::atomic<uint64_t> resumed = {0};	// Handshakes that actually resumed
+	};
+
+	explicit SslSessionCache(size_t maxEntries = 1024) : m_maxEntries(std::max<size_t>(maxEntries, 1)) {}
+
+	SslSessionCache(const SslSessionCache &) = delete;
+	SslSessionCache & operator = (const SslSessionCache &) = delete;
+
+	// The cache the context hands its sessions to, null if it has none
+	static SslSessionCache * of(SSL_CTX *context) noexcept
+	{
+		return static_cast<SslSessionCache *>(SSL_CTX_get_ex_data(context, contextIndex()));
+	}
+
+	static Stats & stats() noexcept
+	{
+		static Stats stats;
+		return stats;
+	}
+
+	~SslSessionCache()
+	{
+		for (auto &entry : m_sessions)
+			SSL_SESSION_free(entry.second);
+	}
+
+	/**
+	 * Gives a client context a cache of its own, which lives as long as the context does.
+	 * Server contexts keep openssl's own server side cache, which the early data replay
+	 * protection relies on, so this is for client contexts only.
+	 */
+	static void enable(SSL_CTX *context, size_t maxEntries)
+	{
+		delete of(context);
+		SSL_CTX_set_ex_data(context, contextIndex(), new SslSessionCache(maxEntries));
+		SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(context, &SslSessionCache::onNewSession);
+	}
+
+	// Offers a cached session on the connection through its context's cache, if it has one
+	static bool resumeWith(SSL *ssl, const std::string &key)
+	{
+		auto cache = of(SSL_get_SSL_CTX(ssl));
+		return cache && cache->resume(ssl, key);
+	}
+
+	/**
+	 * Offers the session cached under key (if any) on the connection, and has sessions the
+	 * connection receives stored under key. The key has to outlive the connection.
+	 */
+	bool resume(SSL *ssl, const std::string &key)
+	{
+		SSL_set_ex_data(ssl, cacheIndex(), this);
+		SSL_set_ex_data(ssl, exIndex(), const_cast<std::string *>(&key));
+
+		auto guard = m_lock.lock();
+		auto entry = m_sessions.find(key);
+		if (entry == m_sessions.end())
+			return false;
+
+		auto session = entry->second;
+		if (SSL_SESSION_get_protocol_version(session) == TLS1_3_VERSION)
+			m_sessions.erase(entry);
+		else
+			SSL_SESSION_up_ref(session);
+		guard.unlock();
+
+		// The connection takes its own reference
+		auto offered = SSL_set_session(ssl, session) == 1;
+		SSL_SESSION_free(session);
+
+		if (offered)
+			stats().offered.fetch_add(1, std::memory_order_relaxed);
+		return offered;
+	}
+
+	// Accounts for a finished handshake
+	static void handshaken(SSL *ssl) noexcept
+	{
+		if (SSL_session_reused(ssl))
+			stats().resumed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	size_t size() const
+	{
+		auto guard = m_lock.lock();
+		return m_sessions.size();
+	}
+
+protected:
+	static int exIndex()
+	{
+		static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return index;
+	}
+
+	// Where a context keeps its cache, the cache goes with the context
+	static int contextIndex()
+	{
+		static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr,
+			[](void *, void *cache, CRYPTO_EX_DATA *, int, long, void *) {
+				delete static_cast<SslSessionCache *>(cache);
+			}
+		);
+		return index;
+	}
+
+	// The cache a connection's sessions go to
+	static int cacheIndex()
+	{
+		static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+		return index;
+	}
+
+	static int onNewSession(SSL *ssl, SSL_SESSION *session)
+	{
+		auto key = static_cast<const std::string *>(SSL_get_ex_data(ssl, exIndex()));
+		auto cache = static_cast<SslSessionCache *>(SSL_get_ex_data(ssl, cacheIndex()));
+		if (!key || !cache || !SSL_SESSION_is_resumable(session))
+			return 0;
+
+		// Cache a copy, openssl marks the connection's own session as not resumable when
+		// the connection goes away without a tls shutdown, the cached one would go with it
+		if (auto copy = SSL_SESSION_dup(session))
+			cache->store(*key, copy);
+		return 0;
+	}
+
+	// Takes over the reference to the session
+	void store(const std::string &key, SSL_SESSION *session)
+	{
+		auto guard = m_lock.lock();
+
+		auto entry = m_sessions.find(key);
+		if (entry != m_sessions.end()) {
+			SSL_SESSION_free(entry->second);
+			entry->second = session;
+		} else {
+			// Full up, make room by dropping whichever comes first
+			if (m_sessions.size() >= m_maxEntries) {
+				SSL_SESSION_free(m_sessions.begin()->second);
+				m_sessions.erase(m_sessions.begin());
+			}
+			m_sessions.emplace(key, session);
+		}
+
+		stats().stored.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	mutable async::SpinLock m_lock;
+	std::unordered_map<std::string, SSL_SESSION *> m_sessions;
+	const size_t m_maxEntries;
+};
+
+/**
+ * The server side session ticket keys. Tickets are encrypted (aes-256-cbc) and signed
+ * (hmac-sha256) with the current key, which gets replaced once it is older than the
+ * rotation interval. The last few keys are kept around to decrypt tickets issued before
+ * a rotation, clients presenting one of those get a fresh ticket. Each server context
+ * has keys of its own, they only ever live in this process' memory.
+ */
+class SslTicketKeys
+{
+public:
+	explicit SslTicketKeys(std::chrono::seconds rotation = std::chrono::hours(1)) : m_rotation(rotation) {}
+
+	SslTicketKeys(const SslTicketKeys &) = delete;
+	SslTicketKeys & operator = (const SslTicketKeys &) = delete;
+
+	// The keys the context issues tickets with, null if it has none
+	static SslTicketKeys * of(SSL_CTX *context) noexcept
+	{
+		return static_cast<SslTicketKeys *>(SSL_CTX_get_ex_data(context, contextIndex()));
+	}
+
+	// Gives the context keys of its own, which live as long as the context does
+	static void enable(SSL_CTX *context, std::chrono::seconds rotation)
+	{
+		delete of(context);
+		SSL_CTX_set_ex_data(context, contextIndex(), new SslTicketKeys(std::max(rotation, std::chrono::seconds(1))));
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(context, &SslTicketKeys::onTicket);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(context, &SslTicketKeys::onTicket);
+#endif
+	}
+
+	// Starts a new current key now, regardless of the rotation interval
+	void rotate()
+	{
+		auto guard = m_lock.lock();
+		rotateLocked();
+	}
+
+protected:
+	static constexpr size_t KeysKept = 3;
+
+	struct Key
+	{
+		unsigned char name[16];
+		unsigned char aes[32];
+		unsigned char hmac[32];
+		std::chrono::steady_clock::time_point created;
+	};
+
+	static int contextIndex()
+	{
+		static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr,
+			[](void *, void *keys, CRYPTO_EX_DATA *, int, long, void *) {
+				delete static_cast<SslTicketKeys *>(keys);
+			}
+		);
+		return index;
+	}
+
+	void rotateLocked()
+	{
+		Key key;
+		if (RAND_bytes(key.name, sizeof(key.name)) != 1 || RAND_bytes(key.aes, sizeof(key.aes)) != 1 ||
+				RAND_bytes(key.hmac, sizeof(key.hmac)) != 1)
+			DCORE_THROW(RuntimeError, "Failed to generate a session ticket key");
+
+		key.created = std::chrono::steady_clock::now();
+		m_keys.push_front(key);
+		if (m_keys.size() > KeysKept)
+			m_keys.pop_back();
+	}
+
+	// The key to issue tickets with, rotated first if it is due
+	Key current()
+	{
+		auto guard = m_lock.lock();
+		if (m_keys.empty() || std::chrono::steady_clock::now() - m_keys.front().created >= m_rotation)
+			rotateLocked();
+		return m_keys.front();
+	}
+
+	// The key a ticket was issued with, and whether it is still the current one
+	std::optional<std::pair<Key, bool>> find(const unsigned char *name)
+	{
+		auto guard = m_lock.lock();
+		for (size_t index = 0; index < m_keys.size(); index++) {
+			if (!std::memcmp(m_keys[index].name, name, sizeof(Key::name)))
+				return std::make_pair(m_keys[index], index == 0);
+		}
+		return {};
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	using MacContext = EVP_MAC_CTX;
+
+	static bool initMac(MacContext *mac, Key &key)
+	{
+		char digest[] = "SHA256";
+		OSSL_PARAM params[] = {
+			OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac, sizeof(key.hmac)),
+			OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+			OSSL_PARAM_construct_end()
+		};
+		return EVP_MAC_CTX_set_params(mac, params) == 1;
+	}
+#else
+	using MacContext = HMAC_CTX;
+
+	static bool initMac(MacContext *mac, Key &key)
+	{
+		return HMAC_Init_ex(mac, key.hmac, sizeof(key.hmac), EVP_sha256(), nullptr) == 1;
+	}
+#endif
+
+	/**
+	 * Openssl's ticket key callback, returns 1 to use the key as is, 2 to accept the ticket
+	 * but issue a new one, 0 to turn the ticket down (full handshake) and -1 on errors.
+	 */
+	static int onTicket(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipher, MacContext *mac, int encrypt)
+	{
+		try {
+			auto keys = of(SSL_get_SSL_CTX(ssl));
+			if (!keys)
+				return -1;
+
+			if (encrypt) {
+				auto key = keys->current();
+				std::memcpy(name, key.name, sizeof(key.name));
+				if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+					return -1;
+				if (EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes, iv) != 1 || !initMac(mac, key))
+					return -1;
+				return 1;
+			}
+
+			auto found = keys->find(name);
+			if (!found)
+				return 0;
+
+			auto &[key, current] = found.value();
+			if (EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes, iv) != 1 || !initMac(mac, key))
+				return -1;
+
+			// Tls 1.3 clients use a ticket only once, without a fresh one the next
+			// connection would be back to a full handshake
+			return current && SSL_version(ssl) != TLS1_3_VERSION ? 1 : 2;
+		} catch (dictos::error::Exception &e) {
+			LOG(ERROR, "Session ticket callback failed:", e);
+			return -1;
+		}
+	}
+
+	async::SpinLock m_lock;
+	std::deque<Key> m_keys;
+	const std::chrono::steady_clock::duration m_rotation;
+};
+
+/**
+ * Sends a payload as tls 1.3 early data on a connection about to resume a session, if
+ * the session allows that much early data. Returns whether it went out that way, after
+ * the handshake earlyDataAccepted tells whether the server took it.
+ *
+ * Early data can be replayed by an attacker, only ever send idempotent requests this way.
+ */
+inline bool writeEarlyData(SSL *ssl, memory::HeapView payload, size_t maxSize)
+{
+	auto session = SSL_get0_session(ssl);
+	if (!session || !payload.size() || payload.size() > std::min<size_t>(maxSize, SSL_SESSION_get_max_early_data(session)))
+		return false;
+
+	size_t written = 0;
+	if (SSL_write_early_data(ssl, payload.begin(), payload.size(), &written) != 1 || written != payload.size()) {
+		ERR_clear_error();
+		return false;
+	}
+	return true;
+}
+
+inline bool earlyDataAccepted(SSL *ssl) noexcept
+{
+	return SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED;
+}
+
+}
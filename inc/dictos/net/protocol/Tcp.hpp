@@ -13,7 +13,7 @@ class Tcp : public AbstractProtocol
 public:
 	Tcp(Address addr, EventMachine &em, config::Context &config, ErrorCallback ecb) :
 		AbstractProtocol(std::move(addr), em, config, std::move(ecb)),
-		m_socket(em)
+		m_socket(ioContext())
 	{
 	}
 
@@ -24,20 +24,13 @@ public:
 
 	void close() noexcept override
 	{
+		cancelConnect();
 		m_socket.close();
 	}
 
 	void accept(ProtocolUPtr &newProtocol, AcceptCallback cb) override
 	{
-		m_acceptor = std::make_unique<tcp::acceptor>(
-			m_em,
-			tcp::endpoint(
-				Address::IpAddress::from_string(
-					m_localAddress.ip()
-				),
-				m_localAddress.port()
-			)
-		);
+		m_acceptor = std::make_unique<tcp::acceptor>(ioContext(), listenEndpoint());
 
 		// Now issue the accept and bind the lambda to the new protocol
 		m_acceptor->async_accept(
@@ -57,47 +50,43 @@ public:
 	void read(Size size, ReadCallback cb) const override
 	{
 		// Allocate the buffer to read into for the caller
-		memory::Heap result(size);
-
-		// Construct an asio buffer before we move the result into the closure, due to
-		// parameter initialization order this prevents a crash since result will
-		// get moved before it gets passed into the async_read call.
-		boost::asio::mutable_buffer buf(result.cast<void *>(), result.size());
+		readInto(memory::Heap(size),
+			[cb = std::move(cb)](memory::Heap &result) {
+				cb(std::move(result));
+			}
+		);
+	}
 
-		// Submit the read to the service and bootstrap the callbacks
-		boost::asio::async_read(m_socket, buf,
-			[this,result = std::move(result), cb = std::move(cb)](boost::system::error_code ec, size_t sizeRead)
-			{
-				if (errorCheck<OP::Read>(ec))
-					return;
+	void readPooled(Size size, PooledReadCallback cb) const override
+	{
+		// Draw the buffer to read into for the caller from the pool
+		readInto(buffer::PoolBuffer(size),
+			[cb = std::move(cb)](buffer::PoolBuffer &result) {
+				cb(std::move(result));
+			}
+		);
+	}
 
-				DCORE_ASSERT(sizeRead == result.size());
-				cb(std::move(*const_cast<memory::Heap *>(&result)));
+	void readSome(Size maxSize, ReadCallback cb) const override
+	{
+		readSomeVia(maxSize, std::move(cb),
+			[this](boost::asio::mutable_buffer buf, auto handler) {
+				m_socket.async_read_some(buf, std::move(handler));
 			}
 		);
 	}
 
 	void connect(ConnectCallback cb) override
 	{
-		// First we go through a few hoops to resolve the address
-		m_resolver = std::make_unique<tcp::resolver>(m_em);
-		m_resolver->async_resolve(tcp::v4(), m_localAddress.ip(), string::toString(m_localAddress.port()),
-			[this,cb = std::move(cb)](boost::system::error_code ec, tcp::resolver::iterator results)
+		// Resolve the address if need be and connect to it
+		connectSocket(m_socket,
+			[this,cb = std::move(cb)](boost::system::error_code ec)
 			{
-				if (errorCheck<OP::Resolve>(ec))
+				if (errorCheck<OP::Accept>(ec))
 					return;
 
-				// Ok connect for each resolved entry, first one that connects ok will stop the enum
-				boost::asio::async_connect(m_socket, results,
-					[this,cb = std::move(cb)](boost::system::error_code ec, tcp::resolver::iterator _iter)
-					{
-						if (errorCheck<OP::Accept>(ec))
-							return;
-
-						// Successfully connected
-						cb();
-					}
-				);
+				// Successfully connected
+				cb();
 			}
 		);
 	}
@@ -118,9 +107,54 @@ public:
 		);
 	}
 
-	// We lazily instantiate these as the class is used as a server or a resolving connector
+	void write(buffer::Segments segments, WriteCallback cb) override
+	{
+		// The buffer sequence points into the segments, which keep their storage when
+		// moved into the closure, so the whole thing goes out in one gathered write
+		auto buffers = buffer::toBuffers(segments);
+		auto size = buffer::totalSize(segments);
+		boost::asio::async_write(m_socket, std::move(buffers),
+			[this,size,segments = std::move(segments), cb = std::move(cb)](boost::system::error_code ec, size_t sizeWritten)
+			{
+				if (errorCheck<OP::Write>(ec))
+					return;
+
+				DCORE_ASSERT(sizeWritten == size);
+				cb();
+			}
+		);
+	}
+
+	/**
+	 * Fills result completely, anything a previous readSome left buffered first, then
+	 * hands it to deliver which is free to move it out.
+	 */
+	template<class Buffer, class Deliver>
+	void readInto(Buffer result, Deliver deliver) const
+	{
+		auto data = result.template cast<std::byte *>();
+		auto buffered = drainReceived(data, result.size());
+
+		// Construct an asio buffer before we move the result into the closure, due to
+		// parameter initialization order this prevents a crash since result will
+		// get moved before it gets passed into the async_read call.
+		boost::asio::mutable_buffer buf(data + buffered, result.size() - buffered);
+
+		// Submit the read to the service and bootstrap the callbacks
+		boost::asio::async_read(m_socket, buf,
+			[this,buffered,result = std::move(result), deliver = std::move(deliver)](boost::system::error_code ec, size_t sizeRead) mutable
+			{
+				if (errorCheck<OP::Read>(ec))
+					return;
+
+				DCORE_ASSERT(buffered + sizeRead == result.size());
+				deliver(result);
+			}
+		);
+	}
+
+	// We lazily instantiate this as the class is used as a server
 	std::unique_ptr<tcp::acceptor> m_acceptor;
-	std::unique_ptr<tcp::resolver> m_resolver;
 
 	mutable tcp::socket m_socket;
 };
@@ -0,0 +1,303 @@
+#pragma once
+
+#if defined(DICTOS_NET_HAS_IO_URING)
+
+namespace dictos::net::protocol {
+
+/**
+ * The TcpUring protocol is a Tcp protocol whose reads and writes are submitted through
+ * the io_uring of the shard it is pinned to instead of the epoll reactor. Accept and connect
+ * are inherited as is, only the data path moves to the ring. Selected with the tcp+uring://
+ * address prefix.
+ *
+ * Ops in the ring hold their own reference to the socket, so close cancels every op still
+ * outstanding before closing the descriptor. The buffers an op reads into or writes from
+ * belong to its completion, which only runs once the kernel is done with them.
+ */
+class TcpUring : public Tcp
+{
+public:
+	TcpUring(Address addr, EventMachine &em, config::Context &config, ErrorCallback ecb) :
+		Tcp(std::move(addr), em, config, std::move(ecb)),
+		m_ring(boost::asio::use_service<UringService>(ioContext()))
+	{
+	}
+
+	TcpUring(Address addr, config::Context &config, ErrorCallback ecb) :
+		TcpUring(std::move(addr), GlobalEventMachine(), config, std::move(ecb))
+	{
+	}
+
+	void close() noexcept override
+	{
+		try {
+			auto guard = m_opsLock.lock();
+			for (auto &[id, token] : m_ops)
+				m_ring.cancel(token);
+		} catch (std::exception &e) {
+			LOG(net, "Failed to cancel outstanding io_uring ops:", e);
+		}
+
+		Tcp::close();
+	}
+
+	void read(Size size, ReadCallback cb) const override
+	{
+		// Like async_read an empty read completes right away
+		if (!size) {
+			boost::asio::post(ioContext(), [cb = std::move(cb)]() { cb(memory::HeapView()); });
+			return;
+		}
+
+		auto op = std::make_shared<ReadOp>(m_ring, size, std::move(cb));
+
+		// Anything a previous readSome left buffered comes first
+		op->offset = drainReceived(op->data(), size);
+		if (op->offset == size) {
+			boost::asio::post(ioContext(), [op = std::move(op)]() { op->cb(memory::HeapView(op->data(), op->size)); });
+			return;
+		}
+
+		readNext(std::move(op));
+	}
+
+	// Reads land in registered buffers where it can, not the pool, so skip the tcp
+	// version and copy out like any other protocol
+	void readPooled(Size size, PooledReadCallback cb) const override
+	{
+		AbstractProtocol::readPooled(size, std::move(cb));
+	}
+
+	void readSome(Size maxSize, ReadCallback cb) const override
+	{
+		readSomeVia(maxSize, std::move(cb),
+			[this](boost::asio::mutable_buffer buf, auto handler) {
+				auto fd = m_socket.native_handle();
+				submit(
+					[fd,buf](io_uring_sqe *sqe) {
+						io_uring_prep_recv(sqe, fd, buf.data(), static_cast<unsigned>(buf.size()), 0);
+					},
+					[handler = std::move(handler)](int res) {
+						handler(toErrorCode(res), res > 0 ? static_cast<size_t>(res) : 0);
+					}
+				);
+			}
+		);
+	}
+
+	void write(memory::Heap payload, WriteCallback cb) override
+	{
+		if (!payload.size()) {
+			boost::asio::post(ioContext(), std::move(cb));
+			return;
+		}
+
+		auto op = std::make_shared<WriteOp>(WriteOp{std::move(payload), 0, std::move(cb)});
+		writeNext(std::move(op));
+	}
+
+	void write(buffer::Segments segments, WriteCallback cb) override
+	{
+		auto op = std::make_shared<GatherOp>();
+		for (auto &segment : segments) {
+			if (segment.size())
+				op->iovecs.push_back({segment.begin(), segment.size()});
+		}
+		op->segments = std::move(segments);
+		op->cb = std::move(cb);
+
+		if (op->iovecs.empty()) {
+			boost::asio::post(ioContext(), std::move(op->cb));
+			return;
+		}
+
+		gatherNext(std::move(op));
+	}
+
+protected:
+	/**
+	 * An exact size read in progress, lands in a registered buffer if one is free
+	 * and big enough, otherwise in a heap allocated for it.
+	 */
+	struct ReadOp
+	{
+		ReadOp(UringService &ring, Size size, ReadCallback cb) :
+			ring(ring), size(size), cb(std::move(cb))
+		{
+			if (size <= ring.bufferSize())
+				fixed = ring.acquireBuffer();
+			if (fixed < 0)
+				heap = memory::Heap(size);
+		}
+
+		~ReadOp()
+		{
+			if (fixed >= 0)
+				ring.releaseBuffer(fixed);
+		}
+
+		std::byte *data() { return fixed >= 0 ? ring.buffer(fixed) : heap.begin(); }
+
+		UringService &ring;
+		size_t size, offset = 0;
+		int32_t fixed = -1;
+		memory::Heap heap;
+		ReadCallback cb;
+	};
+
+	struct WriteOp
+	{
+		memory::Heap payload;
+		size_t offset;
+		WriteCallback cb;
+	};
+
+	/**
+	 * A gathered write in progress, sent with one sendmsg per submission. The iovecs
+	 * point into the segments, a short send trims them down to what is left.
+	 */
+	struct GatherOp
+	{
+		buffer::Segments segments;
+		std::vector<iovec> iovecs;
+		size_t first = 0;
+		msghdr msg = {};
+		WriteCallback cb;
+	};
+
+	void readNext(std::shared_ptr<ReadOp> op) const
+	{
+		auto fd = m_socket.native_handle();
+		auto data = op->data() + op->offset;
+		auto remaining = static_cast<unsigned>(op->size - op->offset);
+		auto fixed = op->fixed;
+
+		submit(
+			[fd,data,remaining,fixed](io_uring_sqe *sqe) {
+				if (fixed >= 0)
+					io_uring_prep_read_fixed(sqe, fd, data, remaining, 0, fixed);
+				else
+					io_uring_prep_recv(sqe, fd, data, remaining, 0);
+			},
+			[this,op = std::move(op)](int res) {
+				// A cancelled op (we got closed) isn't an error, but it's done all the same
+				if (auto ec = toErrorCode(res)) {
+					errorCheck<OP::Read>(ec);
+					return;
+				}
+
+				op->offset += res;
+				if (op->offset < op->size)
+					return readNext(op);
+
+				op->cb(memory::HeapView(op->data(), op->size));
+			}
+		);
+	}
+
+	void writeNext(std::shared_ptr<WriteOp> op)
+	{
+		auto fd = m_socket.native_handle();
+		auto data = op->payload.begin() + op->offset;
+		auto remaining = op->payload.size() - op->offset;
+
+		submit(
+			[fd,data,remaining](io_uring_sqe *sqe) {
+				io_uring_prep_send(sqe, fd, data, remaining, MSG_NOSIGNAL);
+			},
+			[this,op = std::move(op)](int res) {
+				// A cancelled op (we got closed) isn't an error, but it's done all the same
+				if (auto ec = toErrorCode(res)) {
+					errorCheck<OP::Write>(ec);
+					return;
+				}
+
+				op->offset += res;
+				if (op->offset < op->payload.size())
+					return writeNext(op);
+
+				if (op->cb) op->cb();
+			}
+		);
+	}
+
+	void gatherNext(std::shared_ptr<GatherOp> op)
+	{
+		auto fd = m_socket.native_handle();
+		op->msg.msg_iov = op->iovecs.data() + op->first;
+		op->msg.msg_iovlen = op->iovecs.size() - op->first;
+		auto msg = &op->msg;
+
+		submit(
+			[fd,msg](io_uring_sqe *sqe) {
+				io_uring_prep_sendmsg(sqe, fd, msg, MSG_NOSIGNAL);
+			},
+			[this,op = std::move(op)](int res) {
+				// A cancelled op (we got closed) isn't an error, but it's done all the same
+				if (auto ec = toErrorCode(res)) {
+					errorCheck<OP::Write>(ec);
+					return;
+				}
+
+				// Skip what went out, the kernel may stop partway into a segment
+				size_t sent = res;
+				while (op->first < op->iovecs.size() && sent >= op->iovecs[op->first].iov_len)
+					sent -= op->iovecs[op->first++].iov_len;
+
+				if (op->first < op->iovecs.size()) {
+					auto &partial = op->iovecs[op->first];
+					partial.iov_base = static_cast<std::byte *>(partial.iov_base) + sent;
+					partial.iov_len -= sent;
+					return gatherNext(op);
+				}
+
+				if (op->cb) op->cb();
+			}
+		);
+	}
+
+	/**
+	 * Submits an op to the ring, keeping track of it until it completes so close can
+	 * call it off.
+	 */
+	template<class Prep>
+	void submit(Prep &&prep, UringService::Completion completion) const
+	{
+		// Held across the submit so the completion can't get to the erase before we insert
+		auto guard = m_opsLock.lock();
+		auto id = m_nextOp++;
+		m_ops[id] = m_ring.submit(std::forward<Prep>(prep),
+			[this,id,completion = std::move(completion)](int res) {
+				{
+					auto guard = m_opsLock.lock();
+					m_ops.erase(id);
+				}
+				completion(res);
+			}
+		);
+	}
+
+	/**
+	 * Maps a cqe result onto the error codes the asio paths would have produced,
+	 * a zero byte completion means the peer shut the connection.
+	 */
+	static boost::system::error_code toErrorCode(int res)
+	{
+		if (res < 0)
+			return boost::system::error_code(-res, boost::system::system_category());
+		if (res == 0)
+			return boost::asio::error::eof;
+		return {};
+	}
+
+	UringService &m_ring;
+
+	// Ops in the ring, by our id, along with the token to cancel them with
+	mutable async::SpinLock m_opsLock;
+	mutable std::unordered_map<uint64_t, uint64_t> m_ops;
+	mutable uint64_t m_nextOp = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,264 @@
+#pragma once
+
+#if defined(DICTOS_NET_HAS_IO_URING)
+
+namespace dictos::net::protocol {
+
+/**
+ * The uring service owns one io_uring instance per io context, which in a sharded event
+ * machine means one ring per service thread. Operations submitted while a handler runs are
+ * queued in the submission ring and handed to the kernel with a single io_uring_submit once
+ * the handler returns, so every stream on a shard shares one syscall per loop iteration.
+ * Completions are reaped when the ring signals its registered eventfd, which the io context
+ * watches like any other descriptor.
+ *
+ * A set of fixed buffers is also registered with the ring, reads that fit in one are done
+ * with read_fixed so the kernel skips pinning the user pages on every call.
+ */
+class UringService :
+	public boost::asio::execution_context::service,
+	public config::Context
+{
+public:
+	typedef std::function<void(int result)> Completion;
+
+	static inline boost::asio::execution_context::id id;
+
+	explicit UringService(boost::asio::io_context &context) :
+		service(context),
+		Context(getSection(), config::Options()),
+		m_context(context),
+		m_eventFd(context)
+	{
+		if (auto res = io_uring_queue_init(getOption<uint32_t>("entries"), &m_ring, 0); res < 0)
+			DCORE_THROW(RuntimeError, "Failed to initialize io_uring:", std::strerror(-res));
+
+		auto fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0 || io_uring_register_eventfd(&m_ring, fd) < 0) {
+			if (fd >= 0)
+				::close(fd);
+			io_uring_queue_exit(&m_ring);
+			DCORE_THROW(RuntimeError, "Failed to register io_uring completion eventfd");
+		}
+		m_eventFd.assign(fd);
+
+		registerBuffers();
+		armCompletions();
+	}
+
+	~UringService()
+	{
+		io_uring_queue_exit(&m_ring);
+	}
+
+	/**
+	 * Queues an operation on the ring. The prep callable is handed the submission entry
+	 * to fill in and the completion gets called with the cqe result (negative errno on
+	 * failure) on whichever thread reaps it. Returns a token for cancel().
+	 */
+	template<class Prep>
+	uint64_t submit(Prep &&prep, Completion completion)
+	{
+		auto guard = m_lock.lock();
+
+		auto sqe = io_uring_get_sqe(&m_ring);
+		if (!sqe) {
+			// Submission ring is full, hand what we have to the kernel to make room
+			io_uring_submit(&m_ring);
+			m_submits++;
+			sqe = io_uring_get_sqe(&m_ring);
+			if (!sqe)
+				DCORE_THROW(RuntimeError, "The io_uring submission ring is exhausted");
+		}
+
+		prep(sqe);
+
+		uint32_t slot;
+		if (!m_freeSlots.empty()) {
+			slot = m_freeSlots.back();
+			m_freeSlots.pop_back();
+			m_completions[slot] = std::move(completion);
+			m_generations[slot]++;
+		} else {
+			slot = static_cast<uint32_t>(m_completions.size());
+			m_completions.push_back(std::move(completion));
+			m_generations.push_back(0);
+		}
+
+		// The generation keeps a token from matching whatever reuses its slot later on
+		auto token = (static_cast<uint64_t>(m_generations[slot]) << 32) | slot;
+		io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(static_cast<uintptr_t>(token)));
+		m_operations++;
+
+		// One flush per handler batch regardless of how many streams queued ops in it
+		if (!m_flushPending) {
+			m_flushPending = true;
+			guard.unlock();
+			boost::asio::post(m_context, [this]() { flush(); });
+		}
+		return token;
+	}
+
+	/**
+	 * Asks the kernel to call off an operation submitted earlier. Its completion still
+	 * runs, with -ECANCELED unless it finished first, which is the point at which the
+	 * kernel is done with its buffers. Cancelling a finished operation does nothing.
+	 */
+	void cancel(uint64_t token)
+	{
+		submit(
+			[token](io_uring_sqe *sqe) {
+				io_uring_prep_cancel(sqe, reinterpret_cast<void *>(static_cast<uintptr_t>(token)), 0);
+			},
+			[](int res) {}
+		);
+	}
+
+	/**
+	 * Hands out the index of a free registered buffer, or -1 if there are
+	 * none left (or the kernel refused to register any).
+	 */
+	int32_t acquireBuffer()
+	{
+		auto guard = m_lock.lock();
+		if (m_freeBuffers.empty())
+			return -1;
+		auto index = m_freeBuffers.back();
+		m_freeBuffers.pop_back();
+		return index;
+	}
+
+	void releaseBuffer(int32_t index)
+	{
+		auto guard = m_lock.lock();
+		m_freeBuffers.push_back(index);
+	}
+
+	std::byte * buffer(int32_t index) const noexcept { return m_bufferStorage.get() + m_bufferSize * index; }
+	size_t bufferSize() const noexcept { return m_bufferSize; }
+
+	// Number of ops queued vs number of io_uring_submit calls it took to queue them
+	uint64_t operations() const noexcept { return m_operations; }
+	uint64_t submits() const noexcept { return m_submits; }
+
+protected:
+	void shutdown() override
+	{
+		boost::system::error_code ec;
+		m_eventFd.close(ec);
+
+		auto guard = m_lock.lock();
+		m_completions.clear();
+		m_generations.clear();
+		m_freeSlots.clear();
+	}
+
+	void flush()
+	{
+		auto guard = m_lock.lock();
+		m_flushPending = false;
+		io_uring_submit(&m_ring);
+		m_submits++;
+	}
+
+	void armCompletions()
+	{
+		m_eventFd.async_wait(boost::asio::posix::descriptor_base::wait_read,
+			[this](boost::system::error_code ec) {
+				if (ec)
+					return;
+
+				// Drain the eventfd counter, then everything sitting in the completion ring
+				uint64_t count;
+				while (::read(m_eventFd.native_handle(), &count, sizeof(count)) > 0);
+
+				reap();
+				armCompletions();
+			}
+		);
+	}
+
+	void reap()
+	{
+		while (true) {
+			auto guard = m_lock.lock();
+
+			io_uring_cqe *cqe = nullptr;
+			if (io_uring_peek_cqe(&m_ring, &cqe) != 0 || !cqe)
+				return;
+
+			auto slot = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+			auto res = cqe->res;
+			io_uring_cqe_seen(&m_ring, cqe);
+
+			auto completion = std::move(m_completions[slot]);
+			m_freeSlots.push_back(slot);
+			guard.unlock();
+
+			completion(res);
+		}
+	}
+
+	void registerBuffers()
+	{
+		auto count = getOption<uint32_t>("registered_buffers");
+		m_bufferSize = getOption<uint32_t>("registered_buffer_size");
+		if (!count || !m_bufferSize)
+			return;
+
+		m_bufferStorage = std::make_unique<std::byte[]>(m_bufferSize * count);
+
+		std::vector<iovec> iovecs(count);
+		for (uint32_t index = 0; index < count; index++) {
+			iovecs[index].iov_base = buffer(index);
+			iovecs[index].iov_len = m_bufferSize;
+		}
+
+		// Usually fails on a tight RLIMIT_MEMLOCK, plain recv still works so just go without
+		if (auto res = io_uring_register_buffers(&m_ring, iovecs.data(), count); res < 0) {
+			LOG(net, "Failed to register io_uring buffers, continuing without:", std::strerror(-res));
+			m_bufferStorage.reset();
+			return;
+		}
+
+		for (uint32_t index = 0; index < count; index++)
+			m_freeBuffers.push_back(index);
+	}
+
+	static const config::Section & getSection()
+	{
+		if (auto section = config::Sections::find("net_uring"))
+			return *section;
+
+		static config::Section section("net_uring", {
+				{"entries", 256u, "Size of the submission ring for each io context"},
+				{"registered_buffers", 64u, "Number of fixed buffers registered with each ring (0 to disable)"},
+				{"registered_buffer_size", 16384u, "Size of each registered buffer"},
+			}
+		);
+
+		return section;
+	}
+
+	boost::asio::io_context &m_context;
+	boost::asio::posix::stream_descriptor m_eventFd;
+
+	io_uring m_ring;
+	async::SpinLock m_lock;
+	bool m_flushPending = false;
+
+	std::vector<Completion> m_completions;
+	std::vector<uint32_t> m_generations;
+	std::vector<uint32_t> m_freeSlots;
+
+	std::unique_ptr<std::byte[]> m_bufferStorage;
+	size_t m_bufferSize = 0;
+	std::vector<int32_t> m_freeBuffers;
+
+	std::atomic<uint64_t> m_operations = {0};
+	std::atomic<uint64_t> m_submits = {0};
+};
+
+}
+
+#endif
@@ -14,10 +14,12 @@ class WebSocket : public AbstractProtocol
 public:
 	WebSocket(Address addr, EventMachine &em, config::Context &config, ErrorCallback ecb) :
 		AbstractProtocol(std::move(addr), em, config, std::move(ecb)),
-		m_socket(m_em),
-		m_strand(m_socket.get_executor())
+		m_socket(ioContext()),
+		m_strand(m_socket.get_executor()),
+		m_deflate(getOption<bool>("deflate"))
 	{
-		m_webSocket = std::make_unique<websocket::stream<tcp::socket&>>(m_socket);
+		m_webSocket = std::make_unique<WebSocketStream>(m_socket);
+		m_webSocket->set_option(Deflate::options(config));
 	}
 
 	WebSocket(Address addr, config::Context &config, ErrorCallback ecb) :
@@ -25,22 +27,23 @@ public:
 	{
 	}
 
+	bool messageOriented() const noexcept override { return true; }
+
+	void binary(bool enable) override
+	{
+		// Applies to writes started after this, queued ones are already on their way
+		boost::asio::dispatch(m_strand, [this,enable]() { m_webSocket->binary(enable); });
+	}
+
 	void close() noexcept override
 	{
+		cancelConnect();
 		dictos::error::block([this]{ m_webSocket->close(websocket::close_code::normal); });
 	}
 
 	void accept(ProtocolUPtr &newProtocol, AcceptCallback cb) override
 	{
-		m_acceptor = std::make_unique<tcp::acceptor>(
-			m_em,
-			tcp::endpoint(
-				Address::IpAddress::from_string(
-					m_localAddress.ip()
-				),
-				m_localAddress.port()
-			)
-		);
+		m_acceptor = std::make_unique<tcp::acceptor>(ioContext(), listenEndpoint());
 
 		// Now issue the accept and bind the lambda to the new protocol
 		m_acceptor->async_accept(
@@ -49,6 +52,10 @@ public:
 				if (errorCheck<OP::Accept>(ec))
 					return;
 
+				// The deflate counters start from what the new connection has written so far
+				auto &accepted = *staticUPtrCast<WebSocket>(newProtocol);
+				accepted.m_deflate.reset(accepted.m_webSocket->next_layer().bytesWritten());
+
 				// Successfully connected, call callers cb
 				cb();
 			}
@@ -57,22 +64,29 @@ public:
 
 	void read(Size size, ReadCallback cb) const override
 	{
+		// Whole messages only, the view stays valid for as long as the callback runs
+		readMessage([cb = std::move(cb)](buffer::Message message) { cb(message.view()); });
+	}
+
+	void readMessage(MessageCallback cb) const override
+	{
+		// Each read lands in its own (recycled) buffer which then belongs to the caller,
+		// the storage ref is taken before the message moves into the closure
+		auto message = buffer::Message::acquire();
+		auto &storage = message.storage();
+
 		// Submit the read to the service and bootstrap the callbacks
 		m_webSocket->async_read(
-			m_buffer,
+			storage,
 			boost::asio::bind_executor(
 				m_strand,
-				[this,cb = std::move(cb)](boost::system::error_code ec, size_t sizeRead) {
+				[this,message = std::move(message),cb = std::move(cb)](boost::system::error_code ec, size_t sizeRead) mutable {
 					boost::ignore_unused(sizeRead);
 
 					if (errorCheck<OP::Read>(ec))
 						return;
 
-					boost::asio::const_buffer const_buff = boost::beast::buffers_front(m_buffer.data());
-					auto chr = boost::asio::buffer_cast<const std::byte *>(const_buff);
-					auto view = memory::HeapView(chr, const_buff.size());
-					m_buffer.consume(const_buff.size());
-					cb(view);
+					cb(std::move(message));
 				}
 			)
 		);
@@ -80,24 +94,16 @@ public:
 
 	void connect(ConnectCallback cb) override
 	{
-		// First we go through a few hoops to resolve the address
-		m_resolver = std::make_unique<tcp::resolver>(m_em);
-		m_resolver->async_resolve(tcp::v4(), m_localAddress.ip(), string::toString(m_localAddress.port()),
-			[this,cb = std::move(cb)](boost::system::error_code ec, tcp::resolver::iterator results) {
-				if (errorCheck<OP::Resolve>(ec))
+		// Resolve the address if need be and connect to it
+		connectSocket(m_socket,
+			[this,cb = std::move(cb)](boost::system::error_code ec) {
+				if (errorCheck<OP::Accept>(ec))
 					return;
 
-				// Ok connect for each resolved entry, first one that connects ok will stop the enum
-				boost::asio::async_connect(m_webSocket->next_layer(), results,
-					[this,cb = std::move(cb)](boost::system::error_code ec, tcp::resolver::iterator _iter) {
-						if (errorCheck<OP::Accept>(ec))
-							return;
-
-						// Now handshake the websocket one
-						m_webSocket->handshake(m_localAddress.ip(), "/");
-						cb();
-					}
-				);
+				// Now handshake the websocket one, this is where deflate gets negotiated
+				m_webSocket->handshake(m_localAddress.host(), "/");
+				m_deflate.reset(m_webSocket->next_layer().bytesWritten());
+				cb();
 			}
 		);
 	}
@@ -108,6 +114,7 @@ public:
 
 		// Submit the write to the service and bootstrap the callbacks
 		boost::asio::const_buffer buf(payload.cast<void *>(), payload.size());
+		auto cpuStart = m_deflate.begin();
 		m_webSocket->async_write(
 			std::move(buf),
 			boost::asio::bind_executor(
@@ -117,21 +124,49 @@ public:
 						return;
 
 					DCORE_ASSERT(sizeWritten == payload.size());
+					m_deflate.written(sizeWritten, m_webSocket->next_layer().bytesWritten());
 					if (cb) cb();
 				}
 			)
 		);
+		m_deflate.end(cpuStart);
 	}
 
-	// We lazily instantiate these as the class is used as a server or a resolving connector
-	std::unique_ptr<tcp::acceptor> m_acceptor;
-	std::unique_ptr<tcp::resolver> m_resolver;
+	void write(buffer::Segments _segments, WriteCallback cb) override
+	{
+		// Beast frames the whole buffer sequence as one message
+		auto buffers = buffer::toBuffers(_segments);
+		auto size = buffer::totalSize(_segments);
+		buffer::SharedBuffer<buffer::Segments> segments(std::move(_segments));
 
-	mutable boost::beast::flat_buffer m_buffer;
+		// Submit the write to the service and bootstrap the callbacks
+		auto cpuStart = m_deflate.begin();
+		m_webSocket->async_write(
+			std::move(buffers),
+			boost::asio::bind_executor(
+				m_strand,
+				[this,size,segments = std::move(segments), cb = std::move(cb)](boost::system::error_code ec, size_t sizeWritten) {
+					if (errorCheck<OP::Write>(ec))
+						return;
+
+					DCORE_ASSERT(sizeWritten == size);
+					m_deflate.written(sizeWritten, m_webSocket->next_layer().bytesWritten());
+					if (cb) cb();
+				}
+			)
+		);
+		m_deflate.end(cpuStart);
+	}
+
+	// We lazily instantiate this as the class is used as a server
+	std::unique_ptr<tcp::acceptor> m_acceptor;
 
 	mutable tcp::socket m_socket;
-	mutable std::unique_ptr<websocket::stream<tcp::socket&>> m_webSocket;
+	using WebSocketStream = websocket::stream<CountingStream<tcp::socket&>>;
+
+	mutable std::unique_ptr<WebSocketStream> m_webSocket;
 	boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
+	Deflate::Meter m_deflate;
 };
 
 }
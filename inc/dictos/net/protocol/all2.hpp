@@ -1,6 +1,12 @@
+#include <dictos/net/protocol/HappyEyeballs.hpp>
 #include <dictos/net/protocol/AbstractProtocol.hpp>
 #include <dictos/net/protocol/Tcp.hpp>
+#include <dictos/net/protocol/UringService.hpp>
+#include <dictos/net/protocol/TcpUring.hpp>
+#include <dictos/net/protocol/Deflate.hpp>
 #include <dictos/net/protocol/WebSocket.hpp>
+#include <dictos/net/protocol/SslResumption.hpp>
+#include <dictos/net/protocol/HandshakePool.hpp>
 #include <dictos/net/protocol/SslContext.hpp>
 #include <dictos/net/protocol/Ssl.hpp>
 #include <dictos/net/protocol/SslWebSocket.hpp>
@@ -9,6 +9,13 @@ inline std::unique_ptr<class AbstractProtocol> allocateProtocol(Address addr, co
 		case TYPE::Tcp:
 			return std::make_unique<Tcp>(std::move(addr), em, std::forward<config::Context &>(context), std::move(ecb));
 
+		case TYPE::TcpUring:
+#if defined(DICTOS_NET_HAS_IO_URING)
+			return std::make_unique<TcpUring>(std::move(addr), em, std::forward<config::Context &>(context), std::move(ecb));
+#else
+			DCORE_THROW(InvalidArgument, "Protocol:", addr.protocol(), "requires building with DICTOS_NET_IO_URING (when constructing from address:", addr, ")");
+#endif
+
 		case TYPE::Ssl:
 			return std::make_unique<Ssl>(std::move(addr), em, std::forward<config::Context &>(context), std::move(ecb), SslContext(context.getOptions()));
 
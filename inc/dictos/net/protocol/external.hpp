@@ -1,7 +1,19 @@
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/ssl.hpp>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 #include <boost/beast/core.hpp>
 #include <boost/beast/experimental/core/ssl_stream.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/websocket/ssl.hpp>
 #include <boost/beast/websocket/option.hpp>
+
+#if defined(DICTOS_NET_HAS_IO_URING)
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#endif
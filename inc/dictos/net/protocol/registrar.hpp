@@ -9,6 +9,7 @@ std::map<std::string, TYPE> &PrefixMap() {
 		{"tcp", TYPE::Tcp},
 		{"tcpv4", TYPE::Tcp},
 		{"tcpv6", TYPE::Tcp},
+		{"tcp+uring", TYPE::TcpUring},
 		{"ssl", TYPE::Ssl},
 		{"tls", TYPE::Ssl},
 		{"ws", TYPE::WebSocket},
@@ -5,6 +5,7 @@ namespace dictos::net::protocol {
 	enum class TYPE {
 		Init,
 		Tcp,
+		TcpUring,
 		Ssl,
 		Udp,
 		UnixDomain,
@@ -24,6 +25,8 @@ inline std::ostream & operator << (std::ostream &stream, ::dictos::net::protocol
 			return stream << "init";
 		case TYPE::Tcp:
 			return stream << "tcp";
+		case TYPE::TcpUring:
+			return stream << "tcp+uring";
 		case TYPE::Ssl:
 			return stream << "ssl";
 		case TYPE::UnixDomain:
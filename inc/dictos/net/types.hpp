@@ -4,5 +4,6 @@ namespace dictos::net {
 
 typedef std::shared_ptr<class Stream> StreamPtr;
 typedef std::shared_ptr<class Session> SessionPtr;
+typedef std::shared_ptr<class Router> RouterPtr;
 
 }
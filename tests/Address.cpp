@@ -18,3 +18,19 @@ TEST_CASE("Address::Basic")
 	REQUIRE(address.protocol() == PROTOCOL_TYPE::SslWebSocket);
 	REQUIRE(address.port() == 555);
 }
+
+TEST_CASE("Address::Named")
+{
+	Address address("tcp://localhost:555");
+	REQUIRE(address.named());
+	REQUIRE(address.host() == "localhost");
+	REQUIRE(address.port() == 555);
+	REQUIRE_THROWS(address.ip());
+
+	address = Address("tcp://127.0.0.1:555");
+	REQUIRE(!address.named());
+	REQUIRE(address.host() == "127.0.0.1");
+
+	REQUIRE_THROWS(Address("tcp://bad..name:555"));
+	REQUIRE_THROWS(Address("tcp://bad name:555"));
+}
@@ -0,0 +1,190 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("Buffer::PoolRecycles")
+{
+	auto &stats = buffer::Pool::stats();
+
+	const std::byte *first = nullptr;
+	{
+		buffer::PoolBuffer buff(1000);
+		REQUIRE(buff.size() == 1000);
+		first = buff.begin();
+	}
+
+	// Same size class on the same thread should hand back the block we just released
+	auto hits = stats.hits.load();
+	buffer::PoolBuffer buff(1024);
+	REQUIRE(buff.begin() == first);
+	REQUIRE(stats.hits.load() == hits + 1);
+}
+
+TEST_CASE("Buffer::PoolOversize")
+{
+	auto &stats = buffer::Pool::stats();
+
+	auto oversize = stats.oversize.load();
+	buffer::PoolBuffer buff(8_mb);
+	REQUIRE(buff.size() == 8_mb);
+	REQUIRE(stats.oversize.load() == oversize + 1);
+}
+
+#if defined(__linux__)
+namespace {
+
+// Reaches the arena carving, the pool only uses it with huge_pages configured on
+struct HugePool : buffer::Pool
+{
+	using Pool::allocateCarved;
+	using Pool::freeCarved;
+	using Pool::HugePageSize;
+};
+
+}
+
+TEST_CASE("Buffer::PoolHugeArenas")
+{
+	auto &stats = buffer::Pool::stats();
+	auto arenas = stats.arenas.load();
+
+	// One arena tiles exactly into 64kb blocks, all of them usable
+	std::vector<std::byte *> blocks;
+	for (size_t i = 0; i < HugePool::HugePageSize / 64_kb; i++) {
+		blocks.push_back(static_cast<std::byte *>(HugePool::allocateCarved(64_kb)));
+		std::memset(blocks.back(), 'A', 64_kb);
+	}
+	REQUIRE(stats.arenas.load() == arenas + 1);
+
+	std::sort(blocks.begin(), blocks.end());
+	REQUIRE(blocks.back() - blocks.front() == HugePool::HugePageSize - 64_kb);
+	REQUIRE(reinterpret_cast<uintptr_t>(blocks.front()) % HugePool::HugePageSize == 0);
+
+	// Cycling blocks through far more times than an arena holds never maps another
+	for (auto block : blocks)
+		HugePool::freeCarved(block, 64_kb);
+	for (size_t i = 0; i < 1000; i++) {
+		auto block = HugePool::allocateCarved(64_kb);
+		std::memset(block, 'B', 64_kb);
+		HugePool::freeCarved(block, 64_kb);
+	}
+	REQUIRE(stats.arenas.load() == arenas + 1);
+
+	// A 1mb class gets an arena of its own, two blocks to a huge page
+	auto first = HugePool::allocateCarved(1_mb);
+	auto second = HugePool::allocateCarved(1_mb);
+	REQUIRE(stats.arenas.load() == arenas + 2);
+	HugePool::freeCarved(first, 1_mb);
+	HugePool::freeCarved(second, 1_mb);
+	for (size_t i = 0; i < 100; i++)
+		HugePool::freeCarved(HugePool::allocateCarved(1_mb), 1_mb);
+	REQUIRE(stats.arenas.load() == arenas + 2);
+}
+#endif
+
+TEST_CASE("Buffer::RingWraps")
+{
+	buffer::RingBuffer ring(100);
+	REQUIRE(ring.capacity() == 128);
+
+	// Fill most of it and drain part so the next receive wraps
+	auto space = ring.writable();
+	REQUIRE(space.size() == 128);
+	std::memset(space.data(), 'A', 100);
+	ring.commit(100);
+	ring.consume(90);
+
+	space = ring.writable();
+	REQUIRE(space.size() == 28);
+	std::memset(space.data(), 'B', 28);
+	ring.commit(28);
+
+	space = ring.writable();
+	REQUIRE(space.size() == 90);
+	std::memset(space.data(), 'C', 10);
+	ring.commit(10);
+	REQUIRE(ring.size() == 48);
+
+	// A wrapped ring hands out the run up to the end first
+	REQUIRE(ring.readable().size() == 38);
+	REQUIRE(ring.readable(5).size() == 5);
+
+	std::byte out[48];
+	REQUIRE(ring.read(out, sizeof(out)) == 48);
+	REQUIRE(out[0] == std::byte('A'));
+	REQUIRE(out[10] == std::byte('B'));
+	REQUIRE(out[47] == std::byte('C'));
+
+	// Drained rings rewind so the next receive gets the whole capacity
+	REQUIRE(ring.empty());
+	REQUIRE(ring.writable().size() == 128);
+}
+
+TEST_CASE("Buffer::Segments")
+{
+	buffer::Segments segments;
+	segments.emplace_back(4);
+	segments.emplace_back(10);
+	segments.emplace_back(0);
+
+	REQUIRE(buffer::totalSize(segments) == 14);
+
+	auto buffers = buffer::toBuffers(segments);
+	REQUIRE(buffers.size() == 3);
+	REQUIRE(buffers[0].data() == segments[0].begin());
+	REQUIRE(buffers[1].size() == 10);
+}
+
+TEST_CASE("Buffer::MessageRecycles")
+{
+	const void *storage = nullptr;
+	{
+		auto message = buffer::Message::acquire();
+		auto space = message.storage().prepare(100);
+		std::memset(space.data(), 'A', 100);
+		message.storage().commit(100);
+
+		REQUIRE(message.size() == 100);
+		REQUIRE(message.view().begin()[99] == std::byte('A'));
+		storage = &message.storage();
+	}
+
+	// The buffer comes back empty for the next read on this thread
+	auto message = buffer::Message::acquire();
+	REQUIRE(&message.storage() == storage);
+	REQUIRE(message.size() == 0);
+}
+
+TEST_CASE("Buffer::MessageRetainedCap")
+{
+	{
+		auto message = buffer::Message::acquire();
+		auto space = message.storage().prepare(4_mb);
+		std::memset(space.data(), 'A', 4_mb);
+		message.storage().commit(4_mb);
+	}
+
+	// The outsized buffer got freed rather than kept around for the next read
+	auto message = buffer::Message::acquire();
+	REQUIRE(message.storage().capacity() <= 1_mb);
+}
+
+TEST_CASE("Buffer::MessageThreadExit")
+{
+	// A thread whose first pooled allocation is for a message still has the pool's
+	// free lists around when its message cache hands the storage back on exit
+	std::thread thread([]() {
+		auto message = buffer::Message::acquire();
+		auto space = message.storage().prepare(1000);
+		std::memset(space.data(), 'A', 1000);
+		message.storage().commit(1000);
+	});
+	thread.join();
+
+	REQUIRE(buffer::Message::acquire().size() == 0);
+}
@@ -24,3 +24,157 @@ TEST_CASE("Command::Basic")
 	REQUIRE(request2.method() == "hello");
 	REQUIRE(request2.params()["param1"] == 1.5);
 }
+
+TEST_CASE("Command::BinaryEncodings")
+{
+	Command request("hello", json::object());
+	request.params()["param1"] = 1.5;
+	request.params()["param2"] = "two";
+
+	for (auto encoding : {Command::ENCODING::Json, Command::ENCODING::Cbor, Command::ENCODING::MsgPack}) {
+		auto payload = request.serialize(encoding);
+		memory::HeapView view(reinterpret_cast<const std::byte *>(payload.data()), payload.size());
+
+		// The encoding has to be recognizable from the payload alone
+		REQUIRE(Command::detectEncoding(view) == encoding);
+
+		Command decoded(view);
+		REQUIRE(decoded.type() == Command::TYPE::Request);
+		REQUIRE(decoded.method() == "hello");
+		REQUIRE(decoded.id() == request.id());
+		REQUIRE(decoded.params()["param1"] == 1.5);
+		REQUIRE(decoded.params()["param2"] == "two");
+	}
+}
+
+TEST_CASE("Command::Batch")
+{
+	Command first("first", json::object()), second("second", json::object());
+	first.params()["value"] = 1;
+	second.params()["value"] = 2;
+
+	for (auto encoding : {Command::ENCODING::Json, Command::ENCODING::Cbor, Command::ENCODING::MsgPack}) {
+		auto payload = Command::serialize(Command::batch(json::array({json(first), json(second)}), encoding), encoding);
+		memory::HeapView view(reinterpret_cast<const std::byte *>(payload.data()), payload.size());
+
+		// Json batches are plain arrays, binary ones still lead with a map
+		REQUIRE(Command::detectEncoding(view) == encoding);
+
+		auto j = Command::parse(view, encoding);
+		auto commands = Command::unbatch(j);
+		REQUIRE(commands);
+		REQUIRE(commands->size() == 2);
+
+		Command decodedFirst(std::move(commands->at(0))), decodedSecond(std::move(commands->at(1)));
+		REQUIRE(decodedFirst.method() == "first");
+		REQUIRE(decodedFirst.id() == first.id());
+		REQUIRE(decodedSecond.method() == "second");
+		REQUIRE(decodedSecond.params()["value"] == 2);
+	}
+
+	// A single command is not a batch
+	json single = first;
+	REQUIRE(!Command::unbatch(single));
+}
+
+TEST_CASE("Command::Scan")
+{
+	Command request("hello", json::object());
+	request.params()["text"] = "braces { [ and \"quotes\" } ]";
+	request.params()["nested"] = json{{"list", {1, 2, {{"deep", true}}}}, {"pad", std::string(100, 'x')}};
+
+	auto payload = request.serialize(Command::ENCODING::Json);
+	memory::HeapView view(reinterpret_cast<const std::byte *>(payload.data()), payload.size());
+
+	auto scanned = Command::scan(view);
+	REQUIRE(scanned.type() == Command::TYPE::Request);
+	REQUIRE(scanned.method() == "hello");
+	REQUIRE(scanned.id() == request.id());
+	REQUIRE(scanned.lazy());
+	REQUIRE(json::parse(scanned.rawParams().value()) == request.params());
+
+	// Untouched it goes back out as the same command
+	auto forwarded = scanned.serialize(Command::ENCODING::Json);
+	REQUIRE(json::parse(forwarded) == json::parse(payload));
+
+	// Accessing the params parses them
+	REQUIRE(scanned.params()["nested"]["list"][2]["deep"] == true);
+	REQUIRE(!scanned.rawParams());
+	REQUIRE(!scanned.lazy());
+
+	Command result;
+	result.id() = request.id();
+	result.setResult(json{{"value", 42}});
+	payload = result.serialize(Command::ENCODING::Json);
+	view = memory::HeapView(reinterpret_cast<const std::byte *>(payload.data()), payload.size());
+
+	auto scannedResult = Command::scan(view);
+	REQUIRE(scannedResult.type() == Command::TYPE::Result);
+	REQUIRE(scannedResult.id() == request.id());
+	REQUIRE(scannedResult.result()["value"] == 42);
+
+	// Parsed up front it can be shared, nothing is left for the accessors to parse
+	auto shared = Command::scan(view);
+	shared.materialize();
+	REQUIRE(!shared.lazy());
+	REQUIRE(std::as_const(shared).result()["value"] == 42);
+}
+
+TEST_CASE("Command::SerializeReusedBuffer")
+{
+	Command request("hello", json{{"name", "a name long enough to not fit in place"}, {"values", {1, 2, 3, 4}}});
+
+	for (auto encoding : {Command::ENCODING::Json, Command::ENCODING::Cbor, Command::ENCODING::MsgPack}) {
+		// Same size as going through a json tree (json key order differs, so not the same text)
+		auto tree = Command::serialize(json(request), encoding);
+
+		std::string buffer;
+		request.serializeTo(buffer, encoding);
+		REQUIRE(buffer.size() == tree.size());
+
+		// Once the buffer has grown to fit, serializing into it again never reallocates it
+		auto data = buffer.data();
+		auto capacity = buffer.capacity();
+		for (auto i = 0; i < 100; i++) {
+			buffer.clear();
+			request.serializeTo(buffer, encoding);
+			REQUIRE(buffer.data() == data);
+			REQUIRE(buffer.capacity() == capacity);
+			REQUIRE(buffer.size() == tree.size());
+		}
+
+		// And it decodes to the same command
+		memory::HeapView view(reinterpret_cast<const std::byte *>(buffer.data()), buffer.size());
+		Command decoded(view);
+		REQUIRE(decoded.id() == request.id());
+		REQUIRE(decoded.method() == "hello");
+		REQUIRE(decoded.params() == request.params());
+	}
+}
+
+TEST_CASE("Command::CompactIds")
+{
+	for (auto encoding : {Command::ENCODING::Json, Command::ENCODING::Cbor, Command::ENCODING::MsgPack}) {
+		for (uint64_t id : {1ull, 200ull, 70000ull, 5000000000ull}) {
+			Command request("hello", json::object());
+			request.setCompactId(id);
+
+			auto payload = request.serialize(encoding);
+			memory::HeapView view(reinterpret_cast<const std::byte *>(payload.data()), payload.size());
+
+			// Goes on the wire as a number, and comes back without growing a uuid
+			Command decoded(view);
+			REQUIRE(decoded.compactId() == id);
+			REQUIRE(decoded.id() == Uuid::nill());
+
+			auto scanned = Command::scan(view);
+			REQUIRE(scanned.compactId() == id);
+			REQUIRE(scanned.id() == Uuid::nill());
+
+			Command result;
+			result.replyTo(decoded);
+			result.setResult(json::object());
+			REQUIRE(Command(json(result)).compactId() == id);
+		}
+	}
+}
@@ -0,0 +1,142 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("Deflate::Options")
+{
+	// The net_stream defaults, mapped onto both the client and server side
+	auto stream = allocateStream(Address("ws://127.0.0.1:5140"));
+	auto options = protocol::Deflate::options(*stream);
+
+	REQUIRE(options.client_enable == false);
+	REQUIRE(options.server_enable == false);
+	REQUIRE(options.client_max_window_bits == 15);
+	REQUIRE(options.server_max_window_bits == 15);
+	REQUIRE(options.client_no_context_takeover == false);
+	REQUIRE(options.server_no_context_takeover == false);
+	REQUIRE(options.compLevel == 8);
+	REQUIRE(options.memLevel == 4);
+}
+
+TEST_CASE("Deflate::Meter")
+{
+	auto &stats = protocol::Deflate::stats();
+	uint64_t messages = stats.messages, payloadBytes = stats.payloadBytes, wireBytes = stats.wireBytes;
+
+	// Only what went out since the reset (e.g. the handshake) counts
+	protocol::Deflate::Meter meter(true);
+	meter.reset(100);
+	meter.written(50, 130);
+	meter.written(1000, 230);
+
+	REQUIRE(stats.messages - messages == 2);
+	REQUIRE(stats.payloadBytes - payloadBytes == 1050);
+	REQUIRE(stats.wireBytes - wireBytes == 130);
+
+	// A stream without deflate leaves the counters alone
+	protocol::Deflate::Meter disabled(false);
+	disabled.written(50, 50);
+	REQUIRE(disabled.begin() == 0);
+	REQUIRE(stats.messages - messages == 2);
+	REQUIRE(stats.payloadBytes - payloadBytes == 1050);
+}
+
+namespace {
+
+using tcp = boost::asio::ip::tcp;
+namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
+
+// A websocket client with deflate turned on, as if its stream's deflate option was set
+struct DeflateClient : protocol::WebSocket
+{
+	DeflateClient(Address addr, EventMachine &em, config::Context &config, ErrorCallback ecb) :
+		WebSocket(std::move(addr), em, config, std::move(ecb))
+	{
+		auto options = protocol::Deflate::options(config);
+		options.client_enable = true;
+		m_webSocket->set_option(options);
+		m_deflate = protocol::Deflate::Meter(true);
+	}
+};
+
+}
+
+TEST_CASE("Deflate::RoundTrip")
+{
+	// A plain beast server on a thread of its own, the client's handshake blocks its thread
+	boost::asio::io_context serverContext;
+	tcp::acceptor acceptor(serverContext, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 5141));
+
+	std::string offered, echoed;
+	std::thread server([&]() {
+		tcp::socket socket(serverContext);
+		acceptor.accept(socket);
+
+		// Read the upgrade ourselves to see what the client offered
+		boost::beast::flat_buffer buffer;
+		http::request<http::string_body> request;
+		http::read(socket, buffer, request);
+		offered = std::string(request[http::field::sec_websocket_extensions]);
+
+		websocket::stream<tcp::socket> ws(std::move(socket));
+		websocket::permessage_deflate options;
+		options.server_enable = true;
+		ws.set_option(options);
+		ws.accept(request);
+
+		boost::beast::flat_buffer message;
+		ws.read(message);
+		echoed = boost::beast::buffers_to_string(message.data());
+		ws.write(message.data());
+	});
+
+	EventMachine em;
+	auto options = allocateStream(Address("ws://127.0.0.1:5141"), em);
+
+	std::atomic<bool> failed = false;
+	DeflateClient client(Address("ws://127.0.0.1:5141"), em, *options,
+		[&](const dictos::error::Exception &e, OP op) {
+			LOG(test, "Client - Error:", e, '\n', e.traceString());
+			failed = true;
+			em.stop();
+		}
+	);
+
+	auto &stats = protocol::Deflate::stats();
+	uint64_t payloadBytes = stats.payloadBytes, wireBytes = stats.wireBytes;
+
+	// Repetitive json compresses well
+	std::string sent;
+	for (auto i = 0; i < 200; i++)
+		sent += R"({"jsonrpc":"2.0","method":"ping","params":{}})";
+
+	std::string received;
+	client.connect([&]() {
+		memory::Heap payload(sent.size());
+		std::memcpy(payload.begin(), sent.data(), sent.size());
+		client.write(std::move(payload), [&]() {
+			client.read(0, [&](memory::HeapView data) {
+				received.assign(reinterpret_cast<const char *>(data.begin()), data.size());
+				em.stop();
+			});
+		});
+	});
+
+	em.run();
+	server.join();
+
+	REQUIRE(failed == false);
+	REQUIRE(offered.find("permessage-deflate") != std::string::npos);
+	REQUIRE(echoed == sent);
+	REQUIRE(received == sent);
+
+	// What actually went out on the socket is a fraction of the message
+	REQUIRE(stats.payloadBytes - payloadBytes == sent.size());
+	REQUIRE(stats.wireBytes - wireBytes < sent.size() / 4);
+}
@@ -0,0 +1,152 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("EventMachine::Shared")
+{
+	EventMachine em(2);
+
+	REQUIRE(em.shardCount() == 1);
+	REQUIRE(em.acquireShard() == 0);
+	REQUIRE(em.acquireShard() == 0);
+	REQUIRE(em.shardLoad(0) == 2);
+
+	em.releaseShard(0);
+	em.releaseShard(0);
+	REQUIRE(em.shardLoad(0) == 0);
+}
+
+TEST_CASE("EventMachine::ShardedRoundRobin")
+{
+	EventMachine em(4, EventMachine::MODE::Sharded);
+
+	REQUIRE(em.shardCount() == 4);
+	for (uint32_t idx = 0; idx < 8; idx++)
+		REQUIRE(em.acquireShard() == idx % 4);
+
+	for (uint32_t idx = 0; idx < 4; idx++) {
+		REQUIRE(em.shardLoad(idx) == 2);
+		REQUIRE(&em.context(idx) != &em.context((idx + 1) % 4));
+	}
+}
+
+TEST_CASE("EventMachine::ShardedNeedsThreads")
+{
+	// A lone shard would just be a shared machine, and one without threads nobody runs
+	REQUIRE_THROWS(EventMachine(0, EventMachine::MODE::Sharded));
+	REQUIRE_THROWS(EventMachine(1, EventMachine::MODE::Sharded));
+}
+
+TEST_CASE("EventMachine::ShardedRunOne")
+{
+	// The shards belong to their service threads, the caller gets to run none of them
+	EventMachine em(2, EventMachine::MODE::Sharded);
+	REQUIRE_THROWS(em.runOne());
+}
+
+TEST_CASE("EventMachine::ShardedLeastLoaded")
+{
+	EventMachine em(3, EventMachine::MODE::Sharded, EventMachine::PLACEMENT::LeastLoaded);
+
+	REQUIRE(em.acquireShard() == 0);
+	REQUIRE(em.acquireShard() == 1);
+	REQUIRE(em.acquireShard() == 2);
+
+	// Free up the middle shard, it should be the next one picked
+	em.releaseShard(1);
+	REQUIRE(em.acquireShard() == 1);
+}
+
+TEST_CASE("EventMachine::ShardedStream")
+{
+	EventMachine em(2, EventMachine::MODE::Sharded);
+
+	auto first = allocateStream(Address("tcp://127.0.0.1:5121"), em);
+	auto second = allocateStream(Address("tcp://127.0.0.1:5121"), em);
+
+	REQUIRE(first->shard() != second->shard());
+	REQUIRE(em.shardLoad(first->shard()) == 1);
+	REQUIRE(em.shardLoad(second->shard()) == 1);
+
+	first.reset();
+	second.reset();
+	REQUIRE(em.shardLoad(0) == 0);
+	REQUIRE(em.shardLoad(1) == 0);
+}
+
+TEST_CASE("EventMachine::CpuList")
+{
+	REQUIRE(affinity::parseCpuList("").empty());
+	REQUIRE(affinity::parseCpuList("3") == std::vector<uint32_t>{3});
+	REQUIRE(affinity::parseCpuList("0-3,8,10-11\n") == std::vector<uint32_t>{0, 1, 2, 3, 8, 10, 11});
+	REQUIRE_THROWS(affinity::parseCpuList("4-2"));
+}
+
+namespace {
+
+// A caller driven machine in hybrid mode, with a spin budget short enough to test with
+struct HybridMachine : EventMachine
+{
+	HybridMachine(std::chrono::microseconds spinBudget)
+	{
+		m_hybrid = true;
+		m_spinBudget = spinBudget;
+	}
+};
+
+}
+
+TEST_CASE("EventMachine::HybridRun")
+{
+	HybridMachine em(std::chrono::microseconds(500));
+	auto &context = em.context(0);
+
+	// A few handlers ready right away get picked up spinning, the timer only after parking
+	size_t ran = 0;
+	for (auto i = 0; i < 5; i++)
+		boost::asio::post(context, [&]() { ran++; });
+
+	boost::asio::steady_timer timer(context);
+	timer.expires_after(std::chrono::milliseconds(20));
+	timer.async_wait([&](boost::system::error_code) { ran++; });
+
+	em.run();
+
+	auto &stats = em.callerPollStats();
+	REQUIRE(ran == 6);
+	REQUIRE(stats.spinHits >= 5);
+	REQUIRE(stats.parks >= 1);
+	REQUIRE(stats.parkNanos > 0);
+	REQUIRE(stats.spinNanos > 0);
+}
+
+TEST_CASE("EventMachine::HybridSpinIsIdle")
+{
+	HybridMachine em(std::chrono::microseconds(500));
+
+	// The time a handler takes isn't time spent spinning, even when spinning picked it up
+	boost::asio::post(em.context(0), [&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		em.stop();
+	});
+	em.run();
+
+	auto &stats = em.callerPollStats();
+	REQUIRE(stats.spinHits == 1);
+	REQUIRE(stats.spinNanos < std::chrono::nanoseconds(std::chrono::milliseconds(50)).count());
+
+	// One at a time, a handler ready right away is a spin hit and nothing parks
+	HybridMachine single(std::chrono::microseconds(500));
+	auto ran = false;
+	boost::asio::post(single.context(0), [&]() { ran = true; });
+	single.runOne();
+
+	REQUIRE(ran);
+	REQUIRE(single.callerPollStats().spinHits == 1);
+	REQUIRE(single.callerPollStats().parks == 0);
+}
@@ -0,0 +1,37 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("Framer::SplitChunks")
+{
+	for (auto type : {Framer::TYPE::Fixed32, Framer::TYPE::Varint}) {
+		Framer encoder(type), decoder(type);
+
+		// A few frames back to back, including one big enough to need a multi byte varint
+		std::vector<std::string> payloads = {"a", "", std::string(300, 'b'), "{\"id\":1}"};
+		std::vector<std::byte> wire;
+		for (auto &payload : payloads) {
+			auto frame = encoder.encode(payload);
+			wire.insert(wire.end(), frame.begin(), frame.end());
+		}
+
+		// Feed it through in every chunk size so frames and headers straddle chunks
+		for (size_t chunk = 1; chunk <= wire.size(); chunk++) {
+			std::vector<std::string> decoded;
+			for (size_t offset = 0; offset < wire.size(); offset += chunk) {
+				auto size = std::min(chunk, wire.size() - offset);
+				decoder.decode(memory::HeapView(wire.data() + offset, size),
+					[&decoded](memory::HeapView frame) {
+						decoded.emplace_back(reinterpret_cast<const char *>(frame.begin()), frame.size());
+					}
+				);
+			}
+			REQUIRE(decoded == payloads);
+		}
+	}
+}
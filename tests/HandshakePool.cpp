@@ -0,0 +1,143 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+namespace {
+
+// Stands in for an ssl stream, records which thread each handshake ran on. Like a socket
+// its completions come out of its own context, then go to the handler's executor.
+struct FakeStream
+{
+	struct Socket
+	{
+		void close(boost::system::error_code &ec) { closed = true; }
+		bool closed = false;
+	};
+
+	template<class Handler>
+	void async_handshake(boost::asio::ssl::stream_base::handshake_type type, Handler handler)
+	{
+		boost::asio::post(context, [this,handler = std::move(handler)]() mutable {
+			auto executor = boost::asio::get_associated_executor(handler, context.get_executor());
+			boost::asio::dispatch(executor, [this,handler = std::move(handler)]() mutable {
+				thread = std::this_thread::get_id();
+				handler(fail ? boost::asio::error::connection_reset : boost::system::error_code());
+			});
+		});
+	}
+
+	Socket & next_layer() { return socket; }
+
+	boost::asio::io_context &context;
+	bool fail = false;
+	std::thread::id thread;
+	Socket socket;
+};
+
+}
+
+TEST_CASE("HandshakePool::Offload")
+{
+	boost::asio::io_context home;
+	protocol::HandshakePool pool(2);
+	REQUIRE(pool.offloading());
+
+	std::vector<std::unique_ptr<FakeStream>> streams;
+	for (auto i = 0; i < 10; i++) {
+		streams.push_back(std::make_unique<FakeStream>(FakeStream{home}));
+		streams.back()->fail = i == 3;
+	}
+
+	// Every handshake runs on a pool thread, and completes back on the home context
+	std::vector<std::thread::id> completedOn;
+	size_t failed = 0;
+	for (auto &stream : streams) {
+		pool.handshake(*stream, boost::asio::ssl::stream_base::client, home,
+			[&](boost::system::error_code ec) {
+				completedOn.push_back(std::this_thread::get_id());
+				if (ec)
+					failed++;
+			}
+		);
+	}
+
+	auto work = boost::asio::make_work_guard(home);
+	while (completedOn.size() < streams.size())
+		home.run_one();
+
+	REQUIRE(failed == 1);
+	for (auto &stream : streams)
+		REQUIRE(stream->thread != std::this_thread::get_id());
+	for (auto &thread : completedOn)
+		REQUIRE(thread == std::this_thread::get_id());
+
+	auto &stats = pool.stats();
+	REQUIRE(stats.handshakes == 10);
+	REQUIRE(stats.failures == 1);
+	REQUIRE(stats.queued == 0);
+	REQUIRE(stats.maxQueued >= 1);
+}
+
+TEST_CASE("HandshakePool::Inline")
+{
+	boost::asio::io_context home;
+	protocol::HandshakePool pool(0);
+	REQUIRE(!pool.offloading());
+
+	FakeStream stream{home};
+	auto done = false;
+	pool.handshake(stream, boost::asio::ssl::stream_base::server, home,
+		[&](boost::system::error_code ec) { done = !ec; });
+	home.run();
+
+	REQUIRE(done);
+	REQUIRE(stream.thread == std::this_thread::get_id());
+	REQUIRE(pool.stats().handshakes == 1);
+	REQUIRE(pool.stats().maxQueued == 0);
+}
+
+TEST_CASE("HandshakePool::SilentPeer")
+{
+	using tcp = boost::asio::ip::tcp;
+
+	boost::asio::io_context home;
+	protocol::HandshakePool pool(1, std::chrono::milliseconds(200));
+
+	// A client that connects and then never says a word
+	tcp::acceptor acceptor(home, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	tcp::socket client(home);
+	client.connect(acceptor.local_endpoint());
+
+	boost::asio::ssl::context context(boost::asio::ssl::context::tls);
+	boost::asio::ssl::stream<tcp::socket> silent(acceptor.accept(), context);
+
+	std::vector<std::string> order;
+	boost::system::error_code silentError;
+	pool.handshake(silent, boost::asio::ssl::stream_base::server, home,
+		[&](boost::system::error_code ec) {
+			silentError = ec;
+			order.push_back("silent");
+		}
+	);
+
+	// Waiting on the silent peer doesn't hold up the pool's only thread
+	FakeStream other{home};
+	pool.handshake(other, boost::asio::ssl::stream_base::client, home,
+		[&](boost::system::error_code ec) { order.push_back("other"); });
+
+	auto work = boost::asio::make_work_guard(home);
+	auto start = std::chrono::steady_clock::now();
+	while (order.size() < 2 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+		home.run_one_for(std::chrono::milliseconds(100));
+
+	REQUIRE(order == std::vector<std::string>{"other", "silent"});
+	REQUIRE(silentError == boost::asio::error::timed_out);
+	REQUIRE(!silent.next_layer().is_open());
+	REQUIRE(pool.stats().timeouts == 1);
+	REQUIRE(pool.stats().failures == 1);
+}
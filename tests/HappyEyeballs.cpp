@@ -0,0 +1,137 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+using tcp = boost::asio::ip::tcp;
+
+TEST_CASE("HappyEyeballs::Interleave")
+{
+	auto at = [](const char *ip) { return tcp::endpoint(boost::asio::ip::make_address(ip), 1); };
+
+	// The preferred family leads, then the families take turns
+	std::vector<tcp::endpoint> endpoints = {at("::1"), at("::2"), at("::3"), at("10.0.0.1"), at("10.0.0.2")};
+	auto order = protocol::HappyEyeballs::interleave(endpoints);
+	REQUIRE(order == std::vector<tcp::endpoint>{at("::1"), at("10.0.0.1"), at("::2"), at("10.0.0.2"), at("::3")});
+
+	endpoints = {at("10.0.0.1"), at("::1")};
+	order = protocol::HappyEyeballs::interleave(endpoints);
+	REQUIRE(order.front() == at("10.0.0.1"));
+}
+
+TEST_CASE("HappyEyeballs::Race")
+{
+	boost::asio::io_context context;
+
+	tcp::acceptor acceptor(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	tcp::socket accepted(context);
+	acceptor.async_accept(accepted, [](boost::system::error_code) {});
+
+	// A port nobody listens on, it gets refused so the next address goes right away
+	tcp::acceptor closed(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	auto refused = closed.local_endpoint();
+	closed.close();
+
+	std::vector<tcp::endpoint> endpoints = {refused, acceptor.local_endpoint()};
+
+	tcp::socket socket(context);
+	boost::system::error_code result = boost::asio::error::would_block;
+	auto start = std::chrono::steady_clock::now();
+	protocol::HappyEyeballs::connect(socket, endpoints, std::chrono::seconds(5),
+		[&](boost::system::error_code ec) { result = ec; });
+	context.run();
+
+	REQUIRE(!result);
+	REQUIRE(socket.is_open());
+	REQUIRE(socket.remote_endpoint() == acceptor.local_endpoint());
+	REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+	// Nobody answers at all, the last error comes back
+	tcp::socket failing(context);
+	result = boost::asio::error::would_block;
+	endpoints = {refused, refused};
+	protocol::HappyEyeballs::connect(failing, endpoints, std::chrono::seconds(5),
+		[&](boost::system::error_code ec) { result = ec; });
+	context.restart();
+	context.run();
+	REQUIRE(result == boost::asio::error::connection_refused);
+}
+
+namespace {
+
+// A listener whose backlog is full, connects to it get no answer at all
+tcp::endpoint blackhole(tcp::acceptor &acceptor, tcp::socket &filler)
+{
+	acceptor.open(tcp::v4());
+	acceptor.bind(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	acceptor.listen(0);
+	filler.connect(acceptor.local_endpoint());
+	return acceptor.local_endpoint();
+}
+
+}
+
+TEST_CASE("HappyEyeballs::Blackholed")
+{
+	boost::asio::io_context context;
+
+	tcp::acceptor full(context);
+	tcp::socket filler(context);
+	auto blackholed = blackhole(full, filler);
+
+	tcp::acceptor acceptor(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	tcp::socket accepted(context);
+	acceptor.async_accept(accepted, [](boost::system::error_code) {});
+
+	// The first address never answers, the second gets its go once the head start is up
+	std::vector<tcp::endpoint> endpoints = {blackholed, acceptor.local_endpoint()};
+
+	tcp::socket socket(context);
+	boost::system::error_code result = boost::asio::error::would_block;
+	auto start = std::chrono::steady_clock::now();
+	protocol::HappyEyeballs::connect(socket, endpoints, std::chrono::milliseconds(50),
+		[&](boost::system::error_code ec) { result = ec; });
+	context.run();
+
+	// Well before the first syn would even be sent again
+	auto took = std::chrono::steady_clock::now() - start;
+	REQUIRE(!result);
+	REQUIRE(socket.remote_endpoint() == acceptor.local_endpoint());
+	REQUIRE(took >= std::chrono::milliseconds(50));
+	REQUIRE(took < std::chrono::milliseconds(900));
+}
+
+TEST_CASE("HappyEyeballs::Cancel")
+{
+	boost::asio::io_context context;
+
+	tcp::acceptor full(context);
+	tcp::socket filler(context);
+	auto blackholed = blackhole(full, filler);
+
+	std::vector<tcp::endpoint> endpoints = {blackholed, blackholed};
+
+	// Calling the race off lets go of the socket and the callback, the attempts get closed
+	auto socket = std::make_unique<tcp::socket>(context);
+	auto called = false;
+	auto race = protocol::HappyEyeballs::connect(*socket, endpoints, std::chrono::milliseconds(20),
+		[&](boost::system::error_code ec) { called = true; });
+	REQUIRE(race);
+
+	boost::asio::steady_timer timer(context, std::chrono::milliseconds(100));
+	timer.async_wait([&](boost::system::error_code) {
+		race->cancel();
+		socket.reset();
+	});
+
+	// Nothing left outstanding once the attempts are closed
+	auto start = std::chrono::steady_clock::now();
+	context.run();
+	REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(900));
+	REQUIRE(called == false);
+	REQUIRE(race.use_count() == 1);
+}
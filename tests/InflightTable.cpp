@@ -0,0 +1,34 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("InflightTable::Basic")
+{
+	InflightTable<uint64_t, uint64_t> table(4, 8);
+
+	// Enough entries to force every shard to grow a few times
+	for (uint64_t id = 0; id < 10000; id++)
+		REQUIRE(table.insert(id, id * 2));
+	REQUIRE(!table.insert(42, 0));
+
+	auto stats = table.stats();
+	REQUIRE(stats.entries == 10000);
+	REQUIRE(stats.occupancy() <= 0.7);
+	REQUIRE(stats.meanProbe >= 1);
+
+	// Take every other one out, the rest must stay reachable across the shifted runs
+	for (uint64_t id = 0; id < 10000; id += 2)
+		REQUIRE(table.take(id).value() == id * 2);
+
+	for (uint64_t id = 0; id < 10000; id++) {
+		REQUIRE(table.contains(id) == (id % 2 == 1));
+		REQUIRE(!table.take(id + 20000));
+	}
+
+	REQUIRE(table.stats().entries == 5000);
+}
@@ -0,0 +1,96 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+namespace {
+
+std::vector<std::pair<std::string, std::string>> scan(std::string_view text, bool &complete)
+{
+	std::vector<std::pair<std::string, std::string>> members;
+	complete = JsonScanner::members(text, [&](std::string_view key, std::string_view value) {
+		members.emplace_back(key, value);
+	});
+	return members;
+}
+
+}
+
+TEST_CASE("JsonScanner::EscapesAcrossChunks")
+{
+	// Slide an escaped quote and an escaped backslash over every offset of the 16 byte scan
+	for (size_t prefix = 0; prefix < 40; prefix++) {
+		auto value = "\"" + std::string(prefix, 'a') + "\\\"b\\\\\"";
+		auto text = R"({"key":)" + value + R"(,"next":[1,"]"]})";
+
+		bool complete = false;
+		auto members = scan(text, complete);
+		REQUIRE(complete);
+		REQUIRE(members.size() == 2);
+		REQUIRE(members[0].second == value);
+		REQUIRE(members[1].second == R"([1,"]"])");
+		REQUIRE(json::parse(members[0].second) == std::string(prefix, 'a') + "\"b\\");
+	}
+}
+
+TEST_CASE("JsonScanner::TrailingBackslash")
+{
+	// The escape runs off the end, at and around the 16 byte boundary
+	for (size_t prefix = 0; prefix < 40; prefix++) {
+		auto text = R"({"key":")" + std::string(prefix, 'a') + "\\";
+		REQUIRE(!JsonScanner::members(text, [](std::string_view, std::string_view) {}));
+		REQUIRE(!JsonScanner::member(text, "key"));
+	}
+}
+
+TEST_CASE("JsonScanner::Truncated")
+{
+	std::string text = R"({"jsonrpc":"2.0","id":7,"method":"call","params":{"list":[1,{"deep":"\"}"}],"flag":true}})";
+
+	bool complete = false;
+	REQUIRE(scan(text, complete).size() == 4);
+	REQUIRE(complete);
+
+	// Every cut short version of it is refused
+	for (size_t size = 0; size < text.size(); size++) {
+		scan(std::string_view(text).substr(0, size), complete);
+		REQUIRE(!complete);
+	}
+}
+
+TEST_CASE("JsonScanner::Malformed")
+{
+	bool complete = false;
+
+	// Anything but whitespace after the object
+	scan(R"({"a":1} )", complete);
+	REQUIRE(complete);
+	scan(R"({"a":1}x)", complete);
+	REQUIRE(!complete);
+	scan(R"({"a":1}{"b":2})", complete);
+	REQUIRE(!complete);
+	scan(R"({} ,)", complete);
+	REQUIRE(!complete);
+
+	// Brackets that don't match
+	scan(R"({"a":{]})", complete);
+	REQUIRE(!complete);
+	scan(R"({"a":[}})", complete);
+	REQUIRE(!complete);
+	scan(R"({"a":[{"b":1]}]})", complete);
+	REQUIRE(!complete);
+	scan(R"({"a":[{"b":"]"}]})", complete);
+	REQUIRE(complete);
+
+	// Too deep to scan, left to a full parse
+	auto deep = R"({"a":)" + std::string(65, '[') + std::string(65, ']') + "}";
+	scan(deep, complete);
+	REQUIRE(!complete);
+	auto shallow = R"({"a":)" + std::string(64, '[') + std::string(64, ']') + "}";
+	scan(shallow, complete);
+	REQUIRE(complete);
+}
@@ -0,0 +1,70 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("Resolver::Cache")
+{
+	boost::asio::io_context context;
+	Resolver resolver;
+
+	// Two lookups in a row share the one resolve
+	std::vector<Resolver::Endpoints> results;
+	auto cb = [&](boost::system::error_code ec, Resolver::Endpoints endpoints) {
+		REQUIRE(!ec);
+		results.push_back(std::move(endpoints));
+	};
+	resolver.resolve(context, "localhost", 555, cb);
+	resolver.resolve(context, "localhost", 555, cb);
+	REQUIRE(results.empty());
+
+	context.run();
+	REQUIRE(results.size() == 2);
+	REQUIRE(!results[0].empty());
+	for (auto &endpoint : results[0])
+		REQUIRE(endpoint.port() == 555);
+
+	REQUIRE(resolver.stats().misses == 1);
+	REQUIRE(resolver.stats().coalesced == 1);
+
+	// Now it is cached, the answer is posted without another resolve
+	resolver.resolve(context, "localhost", 555, cb);
+	REQUIRE(results.size() == 2);
+	context.restart();
+	context.run();
+	REQUIRE(results.size() == 3);
+	REQUIRE(resolver.stats().misses == 1);
+	REQUIRE(resolver.stats().hits == 1);
+	REQUIRE(resolver.size() == 1);
+
+	resolver.flush();
+	REQUIRE(resolver.size() == 0);
+}
+
+TEST_CASE("Resolver::StoppedContext")
+{
+	boost::asio::io_context first, second;
+	Resolver resolver;
+
+	// Whoever started the resolve going away doesn't hold up everyone else waiting on it
+	auto firstCalled = false;
+	resolver.resolve(first, "localhost", 556, [&](boost::system::error_code, Resolver::Endpoints) { firstCalled = true; });
+	first.stop();
+
+	size_t secondCalls = 0;
+	resolver.resolve(second, "localhost", 556, [&](boost::system::error_code ec, Resolver::Endpoints endpoints) {
+		REQUIRE(!ec);
+		REQUIRE(!endpoints.empty());
+		secondCalls++;
+	});
+	second.run();
+
+	REQUIRE(secondCalls == 1);
+	REQUIRE(firstCalled == false);
+	REQUIRE(resolver.stats().misses == 1);
+	REQUIRE(resolver.stats().coalesced + resolver.stats().hits == 1);
+}
@@ -0,0 +1,77 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("Router::Basic")
+{
+	boost::asio::io_context worker;
+	auto router = std::make_shared<Router>(worker);
+
+	std::atomic<uint32_t> calls = {0};
+	std::vector<std::string> methods;
+	for (uint32_t i = 0; i < 500; i++) {
+		methods.push_back("service.method" + std::to_string(i));
+		router->route(methods.back(), [&](SessionPtr session, Command request) { calls++; });
+	}
+
+	// Every method lands on its own route, anything else on none
+	for (auto &method : methods)
+		REQUIRE(router->routes(method));
+	REQUIRE(!router->routes("service.method500"));
+	REQUIRE(!router->routes(""));
+
+	Command request("service.method7", json::object());
+	REQUIRE(router->dispatch(nullptr, request));
+	REQUIRE(calls == 1);
+	REQUIRE(router->stats("service.method7")->calls == 1);
+
+	// Unrouted requests are left alone for IncomingSig
+	Command unrouted("unknown", json::object());
+	REQUIRE(!router->dispatch(nullptr, unrouted));
+	REQUIRE(unrouted.method() == "unknown");
+
+	// Worker routes over their concurrency limit queue up until the worker gets to them
+	router->route("slow", [&](SessionPtr session, Command request) { calls++; }, {Router::EXECUTION::Worker, 1});
+	for (uint32_t i = 0; i < 10; i++) {
+		Command slow("slow", json::object());
+		REQUIRE(router->dispatch(nullptr, slow));
+	}
+
+	REQUIRE(calls == 1);
+	REQUIRE(router->stats("slow")->queued == 9);
+
+	worker.run();
+
+	REQUIRE(calls == 11);
+	REQUIRE(router->stats("slow")->calls == 10);
+	REQUIRE(router->stats("slow")->active == 0);
+}
+
+TEST_CASE("Router::HandlerThrows")
+{
+	auto router = std::make_shared<Router>();
+
+	// Whatever the handler throws stays in the router, and doesn't cost the route its slot
+	auto calls = 0;
+	router->route("throws", [&](SessionPtr session, Command request) {
+		if (calls++ % 2)
+			throw 42;
+		throw std::runtime_error("handler failed");
+	}, {Router::EXECUTION::Inline, 1});
+
+	for (auto i = 0; i < 4; i++) {
+		Command request("throws", json::object());
+		REQUIRE(router->dispatch(nullptr, request));
+	}
+
+	REQUIRE(calls == 4);
+	REQUIRE(router->stats("throws")->calls == 4);
+	REQUIRE(router->stats("throws")->failures == 4);
+	REQUIRE(router->stats("throws")->active == 0);
+	REQUIRE(router->stats("throws")->queued == 0);
+}
@@ -7,6 +7,336 @@ using namespace dictos::async;
 using namespace dictos::string::literals;
 using namespace dictos::literals;
 
+namespace {
+
+// Accepted streams are already connected, so the server side starts reading by hand
+struct ServerSession : Session
+{
+	using Session::Session;
+	using Session::enqueueRead;
+};
+
+// Session has no reply api, answer on the stream in the session's current encoding
+void reply(SessionPtr session, const Command &request, json result)
+{
+	Command response;
+	response.replyTo(request);
+	response.setResult(std::move(result));
+	session->stream()->write(Framer().encode(response.serialize(session->encoding())));
+}
+
+}
+
 TEST_CASE("websocket_session")
 {
-}
\ No newline at end of file
+}
+
+TEST_CASE("Session::CompactOutgoingStats")
+{
+	// Never connected, the request just sits in the table once its write fails
+	EventMachine em;
+	auto session = std::make_shared<Session>(allocateStream(Address("tcp://127.0.0.1:5150"), em));
+	session->setIdMode(Session::ID_MODE::Compact);
+	session->submitRequest(Command("hello", json::object()), [](Command) {});
+	em.run();
+
+	auto stats = session->outgoingStats();
+	REQUIRE(stats.entries == 1);
+	REQUIRE(stats.capacity > 0);
+	REQUIRE(stats.occupancy() > 0);
+
+	// The uuid table has nothing in it
+	session->setIdMode(Session::ID_MODE::Uuid);
+	REQUIRE(session->outgoingStats().entries == 0);
+}
+
+TEST_CASE("Session::EarlyWaitsForConnect")
+{
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5151");
+
+	// A plain tcp stream takes no early data, the request has to wait for the connect
+	auto server = allocateStream(addr, em);
+	std::string received;
+	std::atomic<size_t> writes = 0;
+	auto done = [&]() {
+		if (writes && received.find("early") != std::string::npos)
+			em.stop();
+	};
+
+	std::function<void(StreamPtr)> readNext = [&](StreamPtr stream) {
+		stream->readSome(64_kb,
+			[&,stream](memory::HeapView data)
+			{
+				received.append(reinterpret_cast<const char *>(data.begin()), data.size());
+				if (received.find("early") == std::string::npos)
+					return readNext(stream);
+				done();
+			}
+		);
+	};
+	server->accept([&](StreamPtr stream) { readNext(stream); });
+
+	auto session = std::make_shared<Session>(allocateStream(addr, em));
+	auto c1 = session->WriteSig.connect([&](SessionPtr, const Command &request) {
+		REQUIRE(request.method() == "early");
+		writes++;
+		done();
+	});
+
+	std::atomic<bool> failed = false;
+	auto c2 = session->ErrorSig.connect([&](const dictos::error::Exception &e, SessionPtr) {
+		LOG(test, "Session - Error sig called:", e, '\n', e.traceString());
+		em.stop();
+		failed = true;
+	});
+
+	session->submitEarly(Command("early", json::object()));
+	session->connect();
+	em.run();
+
+	REQUIRE(failed == false);
+	REQUIRE(writes == 1);
+}
+
+TEST_CASE("Session::OversizeFrame")
+{
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5152");
+
+	// The peer announces a 4kb frame to a session that takes at most 16 bytes
+	auto server = allocateStream(addr, em);
+	std::atomic<bool> peerClosed = false;
+	std::atomic<size_t> errors = 0;
+	auto done = [&]() {
+		if (errors && peerClosed)
+			em.stop();
+	};
+
+	StreamPtr peer;
+	signals::scoped_connection c1;
+	server->accept([&](StreamPtr stream) {
+		// The session hanging up is the only error the peer should see
+		peer = stream;
+		c1 = peer->ErrorSig.connect([&](const dictos::error::Exception &e, net::OP op, StreamPtr stream) {
+			peerClosed = true;
+			done();
+		});
+
+		memory::Heap header(4);
+		std::memcpy(header.begin(), "\x00\x00\x10\x00", 4);
+		peer->write(std::move(header));
+		peer->readSome(64_kb, [](memory::HeapView) {});
+	});
+
+	auto session = std::make_shared<Session>(allocateStream(addr, em), Framer(Framer::TYPE::Fixed32, 16));
+	auto c2 = session->ErrorSig.connect([&](const dictos::error::Exception &e, SessionPtr) {
+		LOG(test, "Session - Error sig called:", e);
+		errors++;
+		done();
+	});
+
+	session->connect();
+	em.run();
+
+	// Reported once, then the stream got closed rather than read any further
+	REQUIRE(errors == 1);
+	REQUIRE(peerClosed == true);
+}
+
+TEST_CASE("Session::NegotiateEncoding")
+{
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5153");
+
+	// The server prefers msgpack but the client only offers cbor, so cbor it is
+	auto server = allocateStream(addr, em);
+	std::shared_ptr<ServerSession> serverSession;
+	signals::scoped_connection c1;
+	std::vector<std::string> methods;
+	server->accept([&](StreamPtr stream) {
+		serverSession = std::make_shared<ServerSession>(stream);
+		serverSession->setEncodings({Command::ENCODING::MsgPack, Command::ENCODING::Cbor});
+		c1 = serverSession->IncomingSig.connect([&](SessionPtr session, const Command &request) {
+			methods.push_back(request.method());
+			reply(session, request, "pong");
+		});
+		serverSession->enqueueRead();
+	});
+
+	auto client = std::make_shared<Session>(allocateStream(addr, em));
+	client->setEncodings({Command::ENCODING::Cbor});
+
+	std::atomic<bool> failed = false;
+	auto c2 = client->ErrorSig.connect([&](const dictos::error::Exception &e, SessionPtr) {
+		LOG(test, "Session - Error sig called:", e, '\n', e.traceString());
+		em.stop();
+		failed = true;
+	});
+
+	// The first request goes out as json with the offer, the reply comes back in cbor and
+	// the second request follows in it
+	std::vector<Command::ENCODING> clientEncodings;
+	client->connect([&]() {
+		client->submitRequest(Command("first", json::object()), [&](Command result) {
+			REQUIRE(result.result() == "pong");
+			clientEncodings.push_back(client->encoding());
+
+			client->submitRequest(Command("second", json::object()), [&](Command result) {
+				REQUIRE(result.result() == "pong");
+				clientEncodings.push_back(client->encoding());
+				em.stop();
+			});
+		});
+	});
+	em.run();
+
+	REQUIRE(failed == false);
+	REQUIRE(methods == std::vector<std::string>{"first", "second"});
+	REQUIRE(clientEncodings == std::vector<Command::ENCODING>{Command::ENCODING::Cbor, Command::ENCODING::Cbor});
+	REQUIRE(serverSession->encoding() == Command::ENCODING::Cbor);
+}
+
+TEST_CASE("Session::EncodingsOptIn")
+{
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5154");
+
+	// A session left at its defaults sends plain json-rpc, no offer attached
+	auto server = allocateStream(addr, em);
+	std::string received;
+	std::function<void(StreamPtr)> readNext = [&](StreamPtr stream) {
+		stream->readSome(64_kb,
+			[&,stream](memory::HeapView data)
+			{
+				received.append(reinterpret_cast<const char *>(data.begin()), data.size());
+				if (received.find("plain") == std::string::npos)
+					return readNext(stream);
+				em.stop();
+			}
+		);
+	};
+	server->accept([&](StreamPtr stream) { readNext(stream); });
+
+	auto client = std::make_shared<Session>(allocateStream(addr, em));
+	client->connect([&]() {
+		client->submitRequest(Command("plain", json::object()));
+	});
+	em.run();
+
+	REQUIRE(received.find("encodings") == std::string::npos);
+	REQUIRE(client->encoding() == Command::ENCODING::Json);
+}
+
+TEST_CASE("Session::RequestTimeout")
+{
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5155");
+
+	// The peer reads the request and never answers
+	auto server = allocateStream(addr, em);
+	std::function<void(StreamPtr)> readNext = [&](StreamPtr stream) {
+		stream->readSome(64_kb, [&,stream](memory::HeapView) { readNext(stream); });
+	};
+	server->accept([&](StreamPtr stream) { readNext(stream); });
+
+	auto client = std::make_shared<Session>(allocateStream(addr, em));
+
+	std::optional<Command> result;
+	auto start = std::chrono::steady_clock::now();
+	client->connect([&]() {
+		client->submitRequest(Command("ignored", json::object()), [&](Command reply) {
+			result = std::move(reply);
+			em.stop();
+		}, std::chrono::milliseconds(50));
+	});
+	em.run();
+
+	REQUIRE(result.has_value());
+	REQUIRE(result->type() == Command::TYPE::Error);
+	REQUIRE(result->error()["code"] == -32000);
+	REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+	// Forgotten once timed out
+	REQUIRE(client->outgoingStats().entries == 0);
+}
+
+TEST_CASE("Session::Batch")
+{
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5156");
+
+	// The server answers each request of the batch on its own, in reverse
+	auto server = allocateStream(addr, em);
+	std::shared_ptr<ServerSession> serverSession;
+	signals::scoped_connection c1;
+	std::vector<std::string> methods;
+	server->accept([&](StreamPtr stream) {
+		serverSession = std::make_shared<ServerSession>(stream);
+		c1 = serverSession->IncomingSig.connect([&](SessionPtr session, const Command &request) {
+			methods.push_back(request.method());
+			reply(session, request, request.params()["n"]);
+		});
+		serverSession->enqueueRead();
+	});
+
+	auto client = std::make_shared<Session>(allocateStream(addr, em));
+
+	std::atomic<bool> failed = false;
+	auto c2 = client->ErrorSig.connect([&](const dictos::error::Exception &e, SessionPtr) {
+		LOG(test, "Session - Error sig called:", e, '\n', e.traceString());
+		em.stop();
+		failed = true;
+	});
+
+	std::atomic<size_t> writes = 0;
+	auto c3 = client->WriteSig.connect([&](SessionPtr, const Command &) { writes++; });
+
+	// Each reply finds its own handler
+	std::map<int, int> replies;
+	client->connect([&]() {
+		std::vector<Session::BatchRequest> batch;
+		for (auto n : {1, 2, 3}) {
+			batch.push_back({Command("batched" + std::to_string(n), json{{"n", n}}), [&,n](Command result) {
+				replies[n] = result.result().get<int>();
+				if (replies.size() == 3)
+					em.stop();
+			}});
+		}
+		client->submitBatch(std::move(batch));
+	});
+	em.run();
+
+	REQUIRE(failed == false);
+	REQUIRE(methods == std::vector<std::string>{"batched1", "batched2", "batched3"});
+	REQUIRE(replies == std::map<int, int>{{1, 1}, {2, 2}, {3, 3}});
+	REQUIRE(client->outgoingStats().entries == 0);
+
+	// One payload, one write, a write signal per request
+	REQUIRE(client->stream()->writeStats().queued == 1);
+	REQUIRE(writes == 3);
+}
+
+TEST_CASE("Session::BatchDuplicateId")
+{
+	EventMachine em;
+	auto client = std::make_shared<Session>(allocateStream(Address("tcp://127.0.0.1:5157"), em));
+
+	Command existing("existing", json::object());
+	json existingJson = existing;
+	client->submitRequest(std::move(existing), [](Command) {});
+	REQUIRE(client->outgoingStats().entries == 1);
+	auto queued = client->stream()->writeStats().queued.load();
+
+	// The second request reuses the in flight one's id, so the whole batch is refused
+	std::vector<Session::BatchRequest> batch;
+	batch.push_back({Command("fresh", json::object()), [](Command) {}});
+	batch.push_back({Command(existingJson), [](Command) {}});
+	REQUIRE_THROWS(client->submitBatch(std::move(batch)));
+
+	// The fresh request got rolled back, the one in flight kept, nothing got sent
+	REQUIRE(client->outgoingStats().entries == 1);
+	REQUIRE(client->stream()->writeStats().queued == queued);
+
+	em.run();
+}
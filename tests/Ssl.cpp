@@ -0,0 +1,155 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+#if defined(SSL_OP_ENABLE_KTLS)
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+namespace {
+
+using tcp = boost::asio::ip::tcp;
+
+// Gives the server a throw away self signed cert, so the test needs no files
+void selfSign(SSL_CTX *context)
+{
+	EVP_PKEY *key = nullptr;
+	auto keygen = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	EVP_PKEY_keygen_init(keygen);
+	EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keygen, NID_X9_62_prime256v1);
+	EVP_PKEY_keygen(keygen, &key);
+	EVP_PKEY_CTX_free(keygen);
+
+	auto cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, key);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+		reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(cert, X509_get_subject_name(cert));
+	X509_sign(cert, key, EVP_sha256());
+
+	SSL_CTX_use_certificate(context, cert);
+	SSL_CTX_use_PrivateKey(context, key);
+	X509_free(cert);
+	EVP_PKEY_free(key);
+}
+
+// Runs the ktls handshake straight on a connected socket, not verifying the made up cert
+struct KtlsClient : protocol::Ssl
+{
+	using Ssl::Ssl;
+
+	void connectTo(tcp::endpoint endpoint, bool kernel, ConnectCallback cb)
+	{
+		m_socket.next_layer().connect(endpoint);
+		handshakeKtls(std::move(cb));
+
+		// The keys only get handed to the kernel once the handshake is done, till then
+		// there's still time to ask for the user space fallback instead
+		SSL_set_verify(m_ktls.get(), SSL_VERIFY_NONE, nullptr);
+		if (!kernel)
+			SSL_clear_options(m_ktls.get(), SSL_OP_ENABLE_KTLS);
+	}
+};
+
+// Connects a ktls client to an echo server and sends a payload and some segments through
+void echo(bool kernel)
+{
+	EventMachine em;
+	auto &context = em.context(0);
+
+	boost::asio::ssl::context serverContext(boost::asio::ssl::context::tls);
+	selfSign(serverContext.native_handle());
+
+	tcp::acceptor acceptor(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	boost::asio::ssl::stream<tcp::socket> server(context, serverContext);
+
+	std::string sent = "hello ktls world", echoed(sent.size(), '\0');
+	acceptor.async_accept(server.next_layer(), [&](boost::system::error_code ec) {
+		REQUIRE(!ec);
+		server.async_handshake(boost::asio::ssl::stream_base::server, [&](boost::system::error_code ec) {
+			REQUIRE(!ec);
+			boost::asio::async_read(server, boost::asio::buffer(echoed), [&](boost::system::error_code ec, size_t) {
+				REQUIRE(!ec);
+				boost::asio::async_write(server, boost::asio::buffer(echoed), [](boost::system::error_code ec, size_t) {
+					REQUIRE(!ec);
+				});
+			});
+		});
+	});
+
+	// The net_stream options the protocol reads, taken from a stream of its own
+	auto options = allocateStream(Address("tcp://127.0.0.1:5160"), em);
+
+	std::atomic<bool> failed = false;
+	KtlsClient client(Address("ssl://127.0.0.1:5160"), em, *options,
+		[&](const dictos::error::Exception &e, OP op) {
+			LOG(test, "Client - Error:", e, '\n', e.traceString());
+			failed = true;
+			em.stop();
+		},
+		protocol::SslContext{config::Options()}
+	);
+
+	auto &stats = protocol::Ssl::ktlsStats();
+	uint64_t connections = stats.connections, send = stats.send, recv = stats.recv;
+
+	std::string received;
+	client.connectTo(acceptor.local_endpoint(), kernel, [&]() {
+		memory::Heap hello(6);
+		std::memcpy(hello.begin(), sent.data(), hello.size());
+
+		// One write at a time, as the stream's write queue would have it
+		client.write(std::move(hello), [&]() {
+			buffer::Segments segments;
+			for (std::string_view text : {"ktls ", "world"}) {
+				memory::Heap segment(text.size());
+				std::memcpy(segment.begin(), text.data(), text.size());
+				segments.push_back(std::move(segment));
+			}
+
+			client.write(std::move(segments), [&]() {
+				client.read(sent.size(), [&](memory::HeapView data) {
+					received.assign(reinterpret_cast<const char *>(data.begin()), data.size());
+					em.stop();
+				});
+			});
+		});
+	});
+
+	em.run();
+
+	REQUIRE(failed == false);
+	REQUIRE(received == sent);
+	REQUIRE(echoed == sent);
+
+	// Whatever the kernel took over is accounted for, the fallback leaves it all to openssl
+	REQUIRE(stats.connections - connections == 1);
+	REQUIRE(stats.send - send == client.ktlsSend());
+	REQUIRE(stats.recv - recv == client.ktlsRecv());
+	if (!kernel) {
+		REQUIRE(client.ktlsSend() == false);
+		REQUIRE(client.ktlsRecv() == false);
+	}
+}
+
+}
+
+TEST_CASE("Ssl::Ktls")
+{
+	// Uses the kernel where it has the tls module, falls back to openssl where it doesn't
+	echo(true);
+}
+
+TEST_CASE("Ssl::KtlsFallback")
+{
+	echo(false);
+}
+
+#endif
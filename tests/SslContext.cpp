@@ -0,0 +1,72 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+namespace {
+
+// Gets at the cache underneath lookup, so the files a context came from can be pointed
+// at something the test controls
+struct SslContextCache : protocol::SslContext
+{
+	using SslContext::cached;
+	using SslContext::SharedContext;
+};
+
+void writeFile(const file::path &path, const std::string &content)
+{
+	std::ofstream out(path.string(), std::ios::binary | std::ios::trunc);
+	out << content;
+}
+
+}
+
+TEST_CASE("SslContext::Lookup")
+{
+	// Same options, same context, whoever else set it up first
+	protocol::SslContext first{config::Options()}, second{config::Options()};
+	REQUIRE(first.nativeContext() == second.nativeContext());
+
+	auto hits = protocol::SslContext::stats().hits.load();
+	protocol::SslContext third{config::Options()};
+	REQUIRE(third.nativeContext() == first.nativeContext());
+	REQUIRE(protocol::SslContext::stats().hits - hits == 1);
+
+	// Serving is a different option set, and with that a context of its own
+	protocol::SslContext server{config::Options(), true};
+	REQUIRE(server.nativeContext() != first.nativeContext());
+	REQUIRE(SSL_CTX_get_ssl_method(server.nativeContext()) == SSL_CTX_get_ssl_method(first.nativeContext()));
+}
+
+TEST_CASE("SslContext::Cache")
+{
+	file::path cert = (std::filesystem::temp_directory_path() / "dictos-net-ssl-context.pem").string();
+	writeFile(cert, "first");
+
+	size_t setups = 0;
+	auto setup = [&](boost::asio::ssl::context &) { setups++; };
+	std::array<file::path, 3> files = {cert, file::path(), file::path()};
+
+	// Hit with the same key, miss with a different one
+	auto context = SslContextCache::cached("a", files, setup);
+	REQUIRE(SslContextCache::cached("a", files, setup) == context);
+	REQUIRE(setups == 1);
+
+	auto other = SslContextCache::cached("b", files, setup);
+	REQUIRE(other != context);
+	REQUIRE(setups == 2);
+
+	// A rewritten cert gets set up again, and from then on that one is handed out
+	writeFile(cert, "second, rotated");
+	auto rotated = SslContextCache::cached("a", files, setup);
+	REQUIRE(rotated != context);
+	REQUIRE(setups == 3);
+	REQUIRE(SslContextCache::cached("a", files, setup) == rotated);
+	REQUIRE(setups == 3);
+
+	std::filesystem::remove(cert.string());
+}
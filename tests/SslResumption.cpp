@@ -0,0 +1,249 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+namespace {
+
+using tcp = boost::asio::ip::tcp;
+
+// A cache not tied to any context, with store exposed to stand in for openssl
+struct SessionCache : protocol::SslSessionCache
+{
+	using SslSessionCache::SslSessionCache;
+	using SslSessionCache::store;
+};
+
+struct TicketKeys : protocol::SslTicketKeys
+{
+	using SslTicketKeys::SslTicketKeys;
+	using SslTicketKeys::current;
+	using SslTicketKeys::find;
+	using SslTicketKeys::KeysKept;
+};
+
+SSL_SESSION * makeSession(int version)
+{
+	auto session = SSL_SESSION_new();
+	SSL_SESSION_set_protocol_version(session, version);
+	return session;
+}
+
+// Gives the server a throw away self signed cert, so the test needs no files
+void selfSign(SSL_CTX *context)
+{
+	EVP_PKEY *key = nullptr;
+	auto keygen = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	EVP_PKEY_keygen_init(keygen);
+	EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keygen, NID_X9_62_prime256v1);
+	EVP_PKEY_keygen(keygen, &key);
+	EVP_PKEY_CTX_free(keygen);
+
+	auto cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, key);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+		reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(cert, X509_get_subject_name(cert));
+	X509_sign(cert, key, EVP_sha256());
+
+	SSL_CTX_use_certificate(context, cert);
+	SSL_CTX_use_PrivateKey(context, key);
+	X509_free(cert);
+	EVP_PKEY_free(key);
+}
+
+}
+
+TEST_CASE("SslResumption::SessionCache")
+{
+	SessionCache cache(2);
+	auto &stats = protocol::SslSessionCache::stats();
+	uint64_t stored = stats.stored, offered = stats.offered;
+
+	cache.store("a", makeSession(TLS1_2_VERSION));
+	cache.store("b", makeSession(TLS1_2_VERSION));
+	REQUIRE(cache.size() == 2);
+
+	// Full up, a new peer takes an existing one's place while a known one gets replaced
+	cache.store("c", makeSession(TLS1_2_VERSION));
+	REQUIRE(cache.size() == 2);
+	cache.store("c", makeSession(TLS1_2_VERSION));
+	REQUIRE(cache.size() == 2);
+	REQUIRE(stats.stored - stored == 4);
+
+	std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> context(SSL_CTX_new(TLS_client_method()), &SSL_CTX_free);
+	auto connection = [&]() { return std::unique_ptr<SSL, decltype(&SSL_free)>(SSL_new(context.get()), &SSL_free); };
+
+	// Nothing cached for the peer, nothing offered
+	std::string unknown = "unknown";
+	REQUIRE(cache.resume(connection().get(), unknown) == false);
+	REQUIRE(stats.offered - offered == 0);
+
+	// Tls 1.2 sessions can be resumed over and over
+	std::string key = "c";
+	REQUIRE(cache.resume(connection().get(), key));
+	REQUIRE(cache.resume(connection().get(), key));
+	REQUIRE(cache.size() == 2);
+	REQUIRE(stats.offered - offered == 2);
+
+	// Tls 1.3 tickets are single use, offering one takes it out
+	cache.store("c", makeSession(TLS1_3_VERSION));
+	REQUIRE(cache.resume(connection().get(), key));
+	REQUIRE(cache.size() == 1);
+	REQUIRE(cache.resume(connection().get(), key) == false);
+	REQUIRE(stats.offered - offered == 3);
+}
+
+TEST_CASE("SslResumption::TicketKeyRotation")
+{
+	TicketKeys keys(std::chrono::hours(1));
+
+	// Within the interval the current key stays put
+	auto first = keys.current();
+	REQUIRE(std::memcmp(keys.current().name, first.name, sizeof(first.name)) == 0);
+	REQUIRE(keys.find(first.name)->second == true);
+
+	// Tickets under a rotated out key still decrypt, but are no longer current
+	keys.rotate();
+	auto second = keys.current();
+	REQUIRE(std::memcmp(second.name, first.name, sizeof(first.name)) != 0);
+	REQUIRE(keys.find(second.name)->second == true);
+	REQUIRE(keys.find(first.name)->second == false);
+
+	// Until enough rotations pushed the key out altogether
+	for (size_t rotation = 1; rotation < TicketKeys::KeysKept; rotation++)
+		keys.rotate();
+	REQUIRE(!keys.find(first.name));
+	REQUIRE(keys.find(second.name));
+
+	unsigned char unknown[16] = {};
+	REQUIRE(!keys.find(unknown));
+
+	// Once the interval is up the next ticket gets a new key
+	TicketKeys due(std::chrono::seconds(0));
+	auto before = due.current();
+	REQUIRE(std::memcmp(due.current().name, before.name, sizeof(before.name)) != 0);
+}
+
+TEST_CASE("SslResumption::SessionKey")
+{
+	// Sessions are only offered to the same peer by streams set up the same way
+	protocol::SslContext client{config::Options()}, other{config::Options()}, server{config::Options(), true};
+	Address peer("ssl://127.0.0.1:5160");
+
+	REQUIRE(client.sessionKey(peer) == other.sessionKey(peer));
+	REQUIRE(client.sessionKey(peer) != client.sessionKey(Address("ssl://127.0.0.1:5161")));
+	REQUIRE(client.sessionKey(peer) != server.sessionKey(peer));
+}
+
+TEST_CASE("SslResumption::PerContext")
+{
+	// Every client context has a cache of its own, servers keep openssl's
+	protocol::SslContext client{config::Options()}, server{config::Options(), true};
+	REQUIRE(protocol::SslSessionCache::of(client.nativeContext()));
+	REQUIRE(!protocol::SslSessionCache::of(server.nativeContext()));
+	REQUIRE(SSL_CTX_get_session_cache_mode(server.nativeContext()) == SSL_SESS_CACHE_SERVER);
+
+	// Limits and keys don't carry over from one context to another
+	std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> first(SSL_CTX_new(TLS_method()), &SSL_CTX_free),
+		second(SSL_CTX_new(TLS_method()), &SSL_CTX_free);
+	protocol::SslSessionCache::enable(first.get(), 1);
+	protocol::SslSessionCache::enable(second.get(), 2);
+	protocol::SslTicketKeys::enable(first.get(), std::chrono::seconds(1));
+	protocol::SslTicketKeys::enable(second.get(), std::chrono::hours(1));
+	REQUIRE(protocol::SslSessionCache::of(first.get()) != protocol::SslSessionCache::of(second.get()));
+	REQUIRE(protocol::SslTicketKeys::of(first.get()) != protocol::SslTicketKeys::of(second.get()));
+}
+
+TEST_CASE("SslResumption::Reconnect")
+{
+	EventMachine em;
+	auto &context = em.context(0);
+
+	boost::asio::ssl::context serverContext(boost::asio::ssl::context::tls);
+	selfSign(serverContext.native_handle());
+	protocol::SslTicketKeys::enable(serverContext.native_handle(), std::chrono::hours(1));
+
+	// Echoes a byte on each connection it accepts
+	tcp::acceptor acceptor(context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 5162));
+	std::vector<std::unique_ptr<boost::asio::ssl::stream<tcp::socket>>> servers;
+	char echoed[3] = {};
+	std::function<void()> accept = [&]() {
+		auto server = servers.emplace_back(std::make_unique<boost::asio::ssl::stream<tcp::socket>>(context, serverContext)).get();
+		auto byte = &echoed[servers.size() - 1];
+		acceptor.async_accept(server->next_layer(), [&,server,byte](boost::system::error_code ec) {
+			REQUIRE(!ec);
+			if (servers.size() < 3)
+				accept();
+			server->async_handshake(boost::asio::ssl::stream_base::server, [server,byte](boost::system::error_code ec) {
+				REQUIRE(!ec);
+				boost::asio::async_read(*server, boost::asio::buffer(byte, 1), [server,byte](boost::system::error_code ec, size_t) {
+					REQUIRE(!ec);
+					boost::asio::async_write(*server, boost::asio::buffer(byte, 1), [](boost::system::error_code ec, size_t) {
+						REQUIRE(!ec);
+					});
+				});
+			});
+		});
+	};
+	accept();
+
+	auto options = allocateStream(Address("tcp://127.0.0.1:5162"), em);
+
+	std::atomic<bool> failed = false;
+	auto onError = [&](const dictos::error::Exception &e, OP op) {
+		LOG(test, "Client - Error:", e, '\n', e.traceString());
+		failed = true;
+		em.stop();
+	};
+
+	protocol::Ssl first(Address("ssl://127.0.0.1:5162"), em, *options, onError, protocol::SslContext{config::Options()});
+	protocol::Ssl second(Address("ssl://127.0.0.1:5162"), em, *options, onError, protocol::SslContext{config::Options()});
+	protocol::Ssl third(Address("ssl://127.0.0.1:5162"), em, *options, onError, protocol::SslContext{config::Options()});
+
+	auto &stats = protocol::SslSessionCache::stats();
+	uint64_t stored = stats.stored, offered = stats.offered, resumed = stats.resumed;
+
+	// Connects, sends a byte and reads it back, by which time the client took in the
+	// tickets the server sends after the handshake
+	auto roundTrip = [&](protocol::Ssl &client, char sent, auto next) {
+		client.m_socket.set_verify_mode(boost::asio::ssl::verify_none);
+		client.connect([&client,sent,next]() {
+			memory::Heap byte(1);
+			std::memcpy(byte.begin(), &sent, 1);
+			client.write(std::move(byte), [&client,sent,next]() {
+				client.read(1, [sent,next](memory::HeapView data) {
+					REQUIRE(*reinterpret_cast<const char *>(data.begin()) == sent);
+					next();
+				});
+			});
+		});
+	};
+
+	roundTrip(first, 'a', [&]() {
+		REQUIRE(stats.stored - stored >= 1);
+		roundTrip(second, 'b', [&]() {
+			roundTrip(third, 'c', [&]() { em.stop(); });
+		});
+	});
+
+	em.run();
+
+	REQUIRE(failed == false);
+	REQUIRE(echoed[0] == 'a');
+	REQUIRE(echoed[1] == 'b');
+	REQUIRE(echoed[2] == 'c');
+
+	// Each reconnect resumed with the ticket the connection before it got, tls 1.3
+	// tickets being single use the resumed connection had to be handed a new one
+	REQUIRE(stats.offered - offered == 2);
+	REQUIRE(stats.resumed - resumed == 2);
+}
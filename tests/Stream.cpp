@@ -79,3 +79,349 @@ TEST_CASE("Stream::Basic")
 	net::GlobalEventMachine().run();
 	REQUIRE(failed == false);
 }
+
+TEST_CASE("Stream::ReadSome")
+{
+	Address addr("tcp://127.0.0.1:5121");
+
+	auto server = allocateStream(addr);
+
+	memory::Heap writePayload(1_mb);
+	writePayload.memset('A');
+
+	// Drain the payload in whatever pieces arrive, never more than 64kb at a time
+	std::atomic<size_t> received = 0;
+	std::function<void(StreamPtr)> readNext = [&received,&readNext](StreamPtr stream) {
+		stream->readSome(64_kb,
+			[stream,&received,&readNext](memory::HeapView data)
+			{
+				REQUIRE(data.size() > 0);
+				REQUIRE(data.size() <= 64_kb);
+				REQUIRE(data.begin()[0] == std::byte('A'));
+
+				received += data.size();
+				if (received < 1_mb)
+					readNext(stream);
+			}
+		);
+	};
+
+	server->accept(
+		[&readNext](StreamPtr stream)
+		{
+			readNext(stream);
+		}
+	);
+
+	auto client = allocateStream(addr);
+	client->connect(
+		[client,&writePayload]()
+		{
+			client->write(writePayload);
+		}
+	);
+
+	std::atomic<bool> failed = false;
+	auto c1 = server->ErrorSig.connect(
+		[&failed](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Server - Error sig called:", e, '\n', e.traceString());
+			net::GlobalEventMachine().stop();
+			failed = true;
+		}
+	);
+	auto c2 = client->ErrorSig.connect(
+		[&failed](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Client - Error sig called:", e, '\n', e.traceString());
+			net::GlobalEventMachine().stop();
+			failed = true;
+		}
+	);
+
+	net::GlobalEventMachine().run();
+	REQUIRE(failed == false);
+	REQUIRE(received == 1_mb);
+}
+
+TEST_CASE("Stream::ReadPooled")
+{
+	Address addr("tcp://127.0.0.1:5124");
+
+	auto server = allocateStream(addr);
+
+	memory::Heap writePayload(100_kb);
+	writePayload.memset('A');
+
+	// The pooled block is ours to keep past the callback
+	buffer::PoolBuffer kept;
+	server->accept(
+		[&kept](StreamPtr stream)
+		{
+			stream->readPooled(100_kb,
+				[stream,&kept](buffer::PoolBuffer payload)
+				{
+					kept = std::move(payload);
+					net::GlobalEventMachine().stop();
+				}
+			);
+		}
+	);
+
+	auto client = allocateStream(addr);
+	client->connect(
+		[client,&writePayload]()
+		{
+			client->write(writePayload);
+		}
+	);
+
+	std::atomic<bool> failed = false;
+	auto c1 = server->ErrorSig.connect(
+		[&failed](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Server - Error sig called:", e, '\n', e.traceString());
+			net::GlobalEventMachine().stop();
+			failed = true;
+		}
+	);
+	auto c2 = client->ErrorSig.connect(
+		[&failed](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Client - Error sig called:", e, '\n', e.traceString());
+			net::GlobalEventMachine().stop();
+			failed = true;
+		}
+	);
+
+	net::GlobalEventMachine().run();
+	REQUIRE(failed == false);
+	REQUIRE(kept.size() == 100_kb);
+	REQUIRE(memory::HeapView(kept) == memory::HeapView(writePayload));
+}
+
+TEST_CASE("Stream::QueuedWrites")
+{
+	// Driven from this thread alone, so every write below queues before the first completes
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5122");
+
+	auto server = allocateStream(addr, em);
+
+	// Many small writes issued back to back must arrive whole and in order
+	const size_t count = 256;
+	std::atomic<size_t> written = 0;
+	std::atomic<bool> verified = false;
+	server->accept(
+		[&](StreamPtr stream)
+		{
+			stream->read(count * 4,
+				[&,stream](memory::HeapView payload)
+				{
+					REQUIRE(payload.size() == count * 4);
+					for (size_t i = 0; i < count; i++) {
+						uint32_t value;
+						std::memcpy(&value, payload.begin() + i * 4, 4);
+						REQUIRE(value == i);
+					}
+					verified = true;
+					if (written == count)
+						em.stop();
+				}
+			);
+		}
+	);
+
+	auto client = allocateStream(addr, em);
+	client->connect(
+		[&]()
+		{
+			for (uint32_t i = 0; i < count; i++) {
+				memory::Heap payload(4);
+				std::memcpy(payload.begin(), &i, 4);
+				client->write(std::move(payload), [&]() {
+					if (++written == count && verified)
+						em.stop();
+				});
+			}
+		}
+	);
+
+	std::atomic<bool> failed = false;
+	auto c1 = server->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Server - Error sig called:", e, '\n', e.traceString());
+			em.stop();
+			failed = true;
+		}
+	);
+	auto c2 = client->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Client - Error sig called:", e, '\n', e.traceString());
+			em.stop();
+			failed = true;
+		}
+	);
+
+	em.run();
+	REQUIRE(failed == false);
+	REQUIRE(written == count);
+
+	// The first write goes out alone, the rest queue behind it and go out in batches of
+	// at most max_coalesced_writes
+	auto &stats = client->writeStats();
+	REQUIRE(stats.queued == count);
+	REQUIRE(stats.batches == 1 + (count - 1 + 63) / 64);
+}
+
+TEST_CASE("Stream::ThrowingWriteCallback")
+{
+	EventMachine em;
+	Address addr("tcp://127.0.0.1:5125");
+
+	auto server = allocateStream(addr, em);
+	std::string received;
+	std::function<void(StreamPtr)> readNext = [&](StreamPtr stream) {
+		stream->readSome(64_kb,
+			[&,stream](memory::HeapView data)
+			{
+				received.append(reinterpret_cast<const char *>(data.begin()), data.size());
+				if (received.size() < 3)
+					return readNext(stream);
+				em.stop();
+			}
+		);
+	};
+	server->accept([&](StreamPtr stream) { readNext(stream); });
+
+	// A callback that throws is reported, the writes queued behind it still go out
+	std::atomic<size_t> errors = 0;
+	auto client = allocateStream(addr, em);
+	auto c1 = client->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			REQUIRE(op == OP::Write);
+			errors++;
+		}
+	);
+
+	client->connect(
+		[&]()
+		{
+			for (auto letter : {"a", "b", "c"}) {
+				memory::Heap payload(1);
+				std::memcpy(payload.begin(), letter, 1);
+				client->write(std::move(payload), []() {
+					DCORE_THROW(RuntimeError, "Write callback failed");
+				});
+			}
+		}
+	);
+
+	em.run();
+	REQUIRE(received == "abc");
+	REQUIRE(errors >= 1);
+}
+
+TEST_CASE("Stream::NamedListen")
+{
+	// A listener on a host name binds to what the name resolves to
+	EventMachine em;
+	Address addr("tcp://localhost:5126");
+
+	auto server = allocateStream(addr, em);
+	std::string received;
+	server->accept(
+		[&](StreamPtr stream)
+		{
+			stream->read(5,
+				[&,stream](memory::HeapView data)
+				{
+					received.assign(reinterpret_cast<const char *>(data.begin()), data.size());
+					em.stop();
+				}
+			);
+		}
+	);
+
+	std::atomic<bool> failed = false;
+	auto client = allocateStream(addr, em);
+	auto c1 = client->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Client - Error sig called:", e, '\n', e.traceString());
+			failed = true;
+			em.stop();
+		}
+	);
+
+	client->connect(
+		[&]()
+		{
+			memory::Heap payload(5);
+			std::memcpy(payload.begin(), "hello", 5);
+			client->write(std::move(payload));
+		}
+	);
+
+	em.run();
+	REQUIRE(failed == false);
+	REQUIRE(received == "hello");
+}
+
+TEST_CASE("Stream::WriteToResetPeer")
+{
+	auto &context = net::GlobalEventMachine().context(0);
+
+	// The peer resets the connection as soon as it's accepted
+	boost::asio::ip::tcp::acceptor acceptor(context,
+		boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 5123));
+	boost::asio::ip::tcp::socket peer(context);
+	acceptor.async_accept(peer,
+		[&peer](boost::system::error_code ec)
+		{
+			REQUIRE(!ec);
+			peer.set_option(boost::asio::socket_base::linger(true, 0));
+			peer.close();
+		}
+	);
+
+	memory::Heap payload(256_kb);
+	payload.memset('A');
+
+	// Keep the queue full until the reset shows up as a write error
+	auto client = allocateStream(Address("tcp://127.0.0.1:5123"));
+	std::function<void()> writeNext = [&]() {
+		client->write(payload, [&]() { writeNext(); });
+	};
+	client->connect(
+		[&]()
+		{
+			for (auto i = 0; i < 8; i++)
+				writeNext();
+		}
+	);
+
+	// The failed write must not leave the queue wedged, a write after it gets
+	// sent (and fails) too
+	std::atomic<size_t> writeErrors = 0, otherErrors = 0;
+	auto c1 = client->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Client - Error sig called:", e);
+			if (op != net::OP::Write) {
+				otherErrors++;
+				return;
+			}
+
+			if (++writeErrors == 1)
+				client->write(payload);
+		}
+	);
+
+	net::GlobalEventMachine().run();
+	REQUIRE(otherErrors == 0);
+	REQUIRE(writeErrors == 2);
+}
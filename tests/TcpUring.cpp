@@ -0,0 +1,158 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+#if defined(DICTOS_NET_HAS_IO_URING)
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("TcpUring::ReadWrite")
+{
+	// The ring keeps its io context busy for good, so these run on their own machine and stop it
+	EventMachine em;
+	Address addr("tcp+uring://127.0.0.1:5130");
+
+	auto server = allocateStream(addr, em);
+
+	memory::Heap bigPayload(1_mb);
+	bigPayload.memset('A');
+	memory::Heap smallPayload(100);
+	smallPayload.memset('B');
+
+	// An exact read too big for a registered buffer, one that fits in one, then
+	// readSome picks up the gathered write
+	std::string gathered;
+	std::function<void(StreamPtr)> readRest = [&](StreamPtr stream) {
+		stream->readSome(64_kb,
+			[&,stream](memory::HeapView data)
+			{
+				gathered.append(reinterpret_cast<const char *>(data.begin()), data.size());
+				if (gathered.size() < 11)
+					return readRest(stream);
+				em.stop();
+			}
+		);
+	};
+
+	server->accept(
+		[&](StreamPtr stream)
+		{
+			stream->read(1_mb,
+				[&,stream](memory::Heap payload)
+				{
+					REQUIRE(payload == bigPayload);
+					stream->read(100,
+						[&,stream](memory::Heap payload)
+						{
+							REQUIRE(payload == smallPayload);
+							readRest(stream);
+						}
+					);
+				}
+			);
+		}
+	);
+
+	auto client = allocateStream(addr, em);
+	client->connect(
+		[&]()
+		{
+			client->write(bigPayload);
+			client->write(smallPayload);
+
+			buffer::Segments segments;
+			for (std::string_view text : {"hello ", "world"}) {
+				memory::Heap segment(text.size());
+				std::memcpy(segment.begin(), text.data(), text.size());
+				segments.push_back(std::move(segment));
+			}
+			client->write(std::move(segments));
+		}
+	);
+
+	std::atomic<bool> failed = false;
+	auto c1 = server->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Server - Error sig called:", e, '\n', e.traceString());
+			em.stop();
+			failed = true;
+		}
+	);
+	auto c2 = client->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Client - Error sig called:", e, '\n', e.traceString());
+			em.stop();
+			failed = true;
+		}
+	);
+
+	em.run();
+	REQUIRE(failed == false);
+	REQUIRE(gathered == "hello world");
+}
+
+TEST_CASE("TcpUring::CloseWithPendingRead")
+{
+	EventMachine em;
+	Address addr("tcp+uring://127.0.0.1:5131");
+
+	auto server = allocateStream(addr, em);
+
+	// The read never gets any data, closing has to call it off. Its callback (and the
+	// buffer along with it) is only let go of once the kernel hands the op back.
+	std::weak_ptr<int> watch;
+	auto readCalled = false;
+	StreamPtr accepted;
+
+	boost::asio::steady_timer closeTimer(em.context(0)), deadline(em.context(0));
+
+	server->accept(
+		[&](StreamPtr stream)
+		{
+			auto sentinel = std::make_shared<int>(0);
+			watch = sentinel;
+
+			accepted = stream;
+			stream->read(16, [&,sentinel](memory::HeapView) { readCalled = true; });
+
+			// Give the read time to make it into the kernel
+			closeTimer.expires_after(std::chrono::milliseconds(100));
+			closeTimer.async_wait([&](boost::system::error_code) { accepted->close(); });
+		}
+	);
+
+	auto client = allocateStream(addr, em);
+	client->connect([]() {});
+
+	std::atomic<bool> failed = false;
+	auto c1 = server->ErrorSig.connect(
+		[&](const dictos::error::Exception &e, net::OP op, StreamPtr stream)
+		{
+			LOG(test, "Server - Error sig called:", e, '\n', e.traceString());
+			failed = true;
+		}
+	);
+
+	// Poll for the read op letting go, give up after a while
+	auto start = std::chrono::steady_clock::now();
+	std::function<void()> poll = [&]() {
+		if ((accepted && watch.expired()) || std::chrono::steady_clock::now() - start > std::chrono::seconds(5))
+			return em.stop();
+		deadline.expires_after(std::chrono::milliseconds(10));
+		deadline.async_wait([&](boost::system::error_code) { poll(); });
+	};
+	poll();
+
+	em.run();
+	REQUIRE(accepted);
+	REQUIRE(watch.expired());
+	REQUIRE(readCalled == false);
+	REQUIRE(failed == false);
+}
+
+#endif
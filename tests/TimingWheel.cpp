@@ -0,0 +1,34 @@
+#include <tests.hpp>
+#include <catch.hpp>
+
+using namespace dictos::net;
+using namespace dictos;
+using namespace dictos::async;
+using namespace dictos::string::literals;
+using namespace dictos::literals;
+
+TEST_CASE("TimingWheel::Basic")
+{
+	boost::asio::io_context context;
+	auto &wheel = boost::asio::use_service<TimingWheel>(context);
+
+	using namespace std::chrono_literals;
+	auto start = std::chrono::steady_clock::now();
+
+	// Short ones fire out of level 0, the longer one has to cascade down first
+	std::vector<int> fired;
+	wheel.schedule(20ms, [&fired]() { fired.push_back(2); });
+	wheel.schedule(5ms, [&fired]() { fired.push_back(1); });
+	wheel.schedule(150ms, [&fired]() { fired.push_back(3); });
+
+	auto cancelled = wheel.schedule(10ms, [&fired]() { fired.push_back(0); });
+	REQUIRE(wheel.size() == 4);
+	REQUIRE(wheel.cancel(cancelled));
+	REQUIRE(!wheel.cancel(cancelled));
+
+	context.run();
+
+	REQUIRE(fired == std::vector<int>{1, 2, 3});
+	REQUIRE(std::chrono::steady_clock::now() - start >= 150ms);
+	REQUIRE(wheel.size() == 0);
+}